@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "annotations.h"
+
+annotations *create_annotations(void) {
+    return calloc(1, sizeof(annotations));
+}
+
+void clear_annotations(annotations *list) {
+    list->count = 0;
+}
+
+void release_annotations(annotations **list) {
+    if ((list == NULL) || (*list == NULL)) {
+        return;
+    }
+    free((*list)->items);
+    free(*list);
+    *list = NULL;
+}
+
+void add_annotation(annotations *list, annotation_type type, CvPoint from, CvPoint to, CvScalar color, int thickness) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? (2 * list->capacity) : 64;
+        annotation *items = realloc(list->items, capacity * sizeof(annotation));
+        if (items == NULL) {
+            // annotations are a debugging aid; losing some is better than failing the analysis.
+            return;
+        }
+        list->items    = items;
+        list->capacity = capacity;
+    }
+
+    annotation *a = &(list->items[list->count++]);
+    a->type      = type;
+    a->from      = from;
+    a->to        = to;
+    a->color     = color;
+    a->thickness = thickness;
+}
+
+IplImage *render_annotations(const annotations *list, const IplImage *background) {
+    IplImage *image = cvCreateImage(cvGetSize(background), 8, 3);
+    if (background->nChannels == 1) {
+        cvCvtColor(background, image, CV_GRAY2RGB);
+    } else {
+        cvCopy(background, image, NULL);
+    }
+
+    for (int i = 0; i < list->count; ++i) {
+        const annotation *a = &(list->items[i]);
+        switch (a->type) {
+            case ANNOTATION_LINE:
+                cvLine(image, a->from, a->to, a->color, a->thickness, 8, 0);
+                break;
+            case ANNOTATION_RECTANGLE:
+                cvRectangle(image, a->from, a->to, a->color, a->thickness, 8, 0);
+                break;
+            case ANNOTATION_POINT:
+                cvLine(image, a->from, a->from, a->color, a->thickness, 8, 0);
+                break;
+        }
+    }
+
+    return image;
+}
@@ -0,0 +1,38 @@
+#ifndef _ANNOTATIONS_H
+#define _ANNOTATIONS_H
+
+#include "cv.h"
+
+// A draw list: a cheap record of what an analysis would have drawn on its annotated image, which
+// can be rasterized later (or never).
+typedef enum {
+    ANNOTATION_LINE,
+    ANNOTATION_RECTANGLE,
+    // a dot of diameter thickness at from
+    ANNOTATION_POINT
+} annotation_type;
+
+typedef struct {
+    annotation_type type;
+    CvPoint         from;
+    CvPoint         to;
+    CvScalar        color;
+    int             thickness;
+} annotation;
+
+typedef struct annotations_s {
+    int         count;
+    int         capacity;
+    annotation *items;
+} annotations;
+
+annotations *create_annotations(void);
+void clear_annotations(annotations *list);
+void release_annotations(annotations **list);
+
+void add_annotation(annotations *list, annotation_type type, CvPoint from, CvPoint to, CvScalar color, int thickness);
+
+// rasterizes the list onto a copy of background (converted to 3 channels if it is grayscale).
+IplImage *render_annotations(const annotations *list, const IplImage *background);
+
+#endif /* _ANNOTATIONS_H */
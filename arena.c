@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+enum { DEFAULT_CHUNK_SIZE = 16 * 1024 };
+
+// bytes held by the arenas (and their chunks) not yet released, across every thread.
+static size_t bytes_live = 0;
+
+typedef union {
+    long double a;
+    void       *b;
+    void      (*c)(void);
+    long long   d;
+} arena_align;
+
+typedef struct arena_chunk_s {
+    struct arena_chunk_s *next;
+    size_t                size;
+    size_t                used;
+    arena_align           data[];
+} arena_chunk;
+
+typedef struct arena_cleanup_s {
+    struct arena_cleanup_s *next;
+    void                  (*release)(void *object);
+    void                   *object;
+} arena_cleanup;
+
+struct arena_s {
+    size_t         chunk_size;
+    arena_chunk   *chunks;
+    arena_cleanup *cleanups;
+};
+
+static arena_chunk *_create_chunk(size_t size) {
+    arena_chunk *chunk = malloc(sizeof(arena_chunk) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    __atomic_add_fetch(&bytes_live, sizeof(arena_chunk) + size, __ATOMIC_RELAXED);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+arena *create_arena(size_t chunk_size) {
+    arena *a = malloc(sizeof(arena));
+    if (a == NULL) {
+        return NULL;
+    }
+    a->chunk_size = chunk_size ? chunk_size : DEFAULT_CHUNK_SIZE;
+    a->chunks     = _create_chunk(a->chunk_size);
+    a->cleanups   = NULL;
+    if (a->chunks == NULL) {
+        free(a);
+        return NULL;
+    }
+    __atomic_add_fetch(&bytes_live, sizeof(arena), __ATOMIC_RELAXED);
+    return a;
+}
+
+static void _free_chunk(arena_chunk *chunk) {
+    __atomic_sub_fetch(&bytes_live, sizeof(arena_chunk) + chunk->size, __ATOMIC_RELAXED);
+    free(chunk);
+}
+
+static void _run_cleanups(arena *a) {
+    // cleanup records live in the chunks themselves, so walk them before any chunk is freed.
+    for (arena_cleanup *c = a->cleanups; c != NULL; c = c->next) {
+        c->release(c->object);
+    }
+    a->cleanups = NULL;
+}
+
+void reset_arena(arena *a) {
+    _run_cleanups(a);
+
+    // keep the most recent chunk (the list is newest first) and free the others.
+    arena_chunk *keep = a->chunks;
+    arena_chunk *chunk = keep->next;
+    while (chunk != NULL) {
+        arena_chunk *next = chunk->next;
+        _free_chunk(chunk);
+        chunk = next;
+    }
+    keep->next = NULL;
+    keep->used = 0;
+}
+
+void release_arena(arena **a) {
+    if ((a == NULL) || (*a == NULL)) {
+        return;
+    }
+    _run_cleanups(*a);
+
+    arena_chunk *chunk = (*a)->chunks;
+    while (chunk != NULL) {
+        arena_chunk *next = chunk->next;
+        _free_chunk(chunk);
+        chunk = next;
+    }
+    __atomic_sub_fetch(&bytes_live, sizeof(arena), __ATOMIC_RELAXED);
+    free(*a);
+    *a = NULL;
+}
+
+void *arena_alloc(arena *a, size_t size) {
+    size_t rounded = (size + sizeof(arena_align) - 1) / sizeof(arena_align) * sizeof(arena_align);
+
+    arena_chunk *chunk = a->chunks;
+    if (chunk->size - chunk->used < rounded) {
+        // big requests get a chunk of their own.
+        chunk = _create_chunk((rounded > a->chunk_size) ? rounded : a->chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = a->chunks;
+        a->chunks   = chunk;
+    }
+
+    void *p = (char *)chunk->data + chunk->used;
+    chunk->used += rounded;
+    memset(p, 0, size);
+    return p;
+}
+
+void *arena_adopt(arena *a, void *object, void (*release)(void *object)) {
+    if (object == NULL) {
+        return NULL;
+    }
+    arena_cleanup *c = arena_alloc(a, sizeof(arena_cleanup));
+    if (c == NULL) {
+        release(object);
+        return NULL;
+    }
+    c->release  = release;
+    c->object   = object;
+    c->next     = a->cleanups;
+    a->cleanups = c;
+    return object;
+}
+
+size_t arena_bytes_live(void) {
+    return __atomic_load_n(&bytes_live, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,31 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+// An arena owns everything allocated for one piece of work and frees it all in one call: small
+// buffers are carved out of large chunks, and anything with its own release function (images,
+// OpenCV storage, ...) can be handed over to be released along with the arena.
+typedef struct arena_s arena;
+
+// chunk_size 0 picks a sensible default.
+arena *create_arena(size_t chunk_size);
+
+// Releases everything the arena owns, most recently acquired first, then the arena itself.
+void release_arena(arena **a);
+
+// Releases everything the arena owns but keeps its first chunk, ready to be used again.
+void reset_arena(arena *a);
+
+// zeroed memory, aligned for any type, which lives as long as the arena (NULL if out of memory).
+void *arena_alloc(arena *a, size_t size);
+
+// release(object) will be called when the arena is released or reset. Returns object, or NULL
+// (having released object straight away) if the arena can't record it.
+void *arena_adopt(arena *a, void *object, void (*release)(void *object));
+
+// bytes held right now by every arena in the process (not counting the objects they've adopted):
+// anything left over once all the work is done is a leaked arena.
+size_t arena_bytes_live(void);
+
+#endif /* _ARENA_H */
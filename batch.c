@@ -0,0 +1,382 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "decode.h"
+
+const batch_options DEFAULT_BATCH_OPTIONS = {
+    { 0, 0, 0, 0 },
+    0,
+    1,
+    DEFAULT_PUZZLE_OPTIONS_INITIALIZER,
+    0,
+    NULL
+};
+
+// one photo on its way through the pipeline.
+typedef struct batch_item_s {
+    batch_result          result;
+    IplImage             *image;
+    decode_scale          scale;
+    puzzle_context       *context;
+    // where the puzzle is in image (owned by context); result.location is the same, at full scale.
+    const CvPoint2D32f   *location;
+    puzzle_context       *squared_context;
+    // with a cache: the decoded photo's hash, the time spent analysing it, and (if it was found in
+    // the cache) what was kept of it, which result points into.
+    image_hash            hash;
+    int64                 ticks;
+    cached_analysis       cached;
+    // result.cages, once the contexts have been let go of while the item waits for its turn.
+    char                 *cages;
+    // next in the list of finished items waiting for their turn (ordered delivery).
+    struct batch_item_s  *next;
+} batch_item;
+
+// a bounded queue of items waiting for a stage.
+typedef struct {
+    batch_item      **items;
+    int               capacity;
+    int               head;
+    int               count;
+    // set once nothing more will be pushed.
+    unsigned short    closed;
+    pthread_mutex_t   lock;
+    pthread_cond_t    not_empty;
+    pthread_cond_t    not_full;
+} batch_queue;
+
+typedef struct {
+    batch       *b;
+    batch_stage  stage;
+    int          workers;
+    // workers which haven't finished yet; the last one out closes the next stage's queue.
+    int          running;
+    pthread_t   *threads;
+    batch_queue  queue;
+} batch_stage_state;
+
+struct batch_s {
+    batch_options      options;
+    batch_callback     callback;
+    void              *argument;
+    long               submitted;
+
+    batch_stage_state  stages[BATCH_STAGES];
+    // how many of stages have their queue set up.
+    int                stage_n;
+
+    // delivery, one callback at a time.
+    pthread_mutex_t    deliver_lock;
+    long               next_index;
+    // finished items which are waiting for an earlier one, sorted by index (ordered delivery).
+    batch_item        *pending;
+};
+
+static int _init_queue(batch_queue *q, int capacity) {
+    q->items    = malloc(capacity * sizeof(batch_item *));
+    q->capacity = capacity;
+    q->head     = 0;
+    q->count    = 0;
+    q->closed   = 0;
+    pthread_mutex_init(&(q->lock), NULL);
+    pthread_cond_init(&(q->not_empty), NULL);
+    pthread_cond_init(&(q->not_full), NULL);
+    return q->items != NULL;
+}
+
+static void _destroy_queue(batch_queue *q) {
+    pthread_cond_destroy(&(q->not_full));
+    pthread_cond_destroy(&(q->not_empty));
+    pthread_mutex_destroy(&(q->lock));
+    free(q->items);
+}
+
+static void _push(batch_queue *q, batch_item *item) {
+    pthread_mutex_lock(&(q->lock));
+    while (q->count == q->capacity) {
+        pthread_cond_wait(&(q->not_full), &(q->lock));
+    }
+    q->items[(q->head + q->count++) % q->capacity] = item;
+    pthread_cond_signal(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
+// the next item, or NULL once the queue is closed and empty.
+static batch_item *_pop(batch_queue *q) {
+    pthread_mutex_lock(&(q->lock));
+    while ((q->count == 0) && (! q->closed)) {
+        pthread_cond_wait(&(q->not_empty), &(q->lock));
+    }
+    batch_item *item = NULL;
+    if (q->count > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        --q->count;
+        pthread_cond_signal(&(q->not_full));
+    }
+    pthread_mutex_unlock(&(q->lock));
+    return item;
+}
+
+static void _close(batch_queue *q) {
+    pthread_mutex_lock(&(q->lock));
+    q->closed = 1;
+    pthread_cond_broadcast(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
+static void _release_item(batch_item *item) {
+    release_puzzle_context(&(item->context));
+    cvReleaseImage(&(item->image));
+    free(item->cages);
+    free((char *)item->result.path);
+    free(item);
+}
+
+// lets go of everything but item's result, for as long as it waits for an earlier item to be
+// delivered: the photo and its contexts are the bulk of it, and any number of items may wait
+// behind a slow one.
+static void _park(batch_item *item) {
+    if (item->result.cages && (item->result.cages != item->cached.cages)) {
+        // (the cages live in the squared context)
+        item->cages = malloc(strlen(item->result.cages) + 1);
+        if (item->cages == NULL) {
+            return;
+        }
+        strcpy(item->cages, item->result.cages);
+        item->result.cages = item->cages;
+    }
+    item->location = NULL;
+    release_puzzle_context(&(item->context));
+    item->squared_context = NULL;
+    cvReleaseImage(&(item->image));
+}
+
+static void _deliver(batch *b, batch_item *item) {
+    pthread_mutex_lock(&(b->deliver_lock));
+    if (! b->options.ordered) {
+        b->callback(&(item->result), b->argument);
+        _release_item(item);
+    } else {
+        if (item->result.index != b->next_index) {
+            _park(item);
+        }
+        batch_item **p = &(b->pending);
+        while ((*p != NULL) && ((*p)->result.index < item->result.index)) {
+            p = &((*p)->next);
+        }
+        item->next = *p;
+        *p = item;
+
+        while ((b->pending != NULL) && (b->pending->result.index == b->next_index)) {
+            batch_item *ready = b->pending;
+            b->pending = ready->next;
+            b->callback(&(ready->result), b->argument);
+            _release_item(ready);
+            ++b->next_index;
+        }
+    }
+    pthread_mutex_unlock(&(b->deliver_lock));
+}
+
+// fills in item's result from what the cache kept of it.
+static void _recall(batch_item *item) {
+    item->result.status = item->cached.found ? BATCH_SOLVED : BATCH_NO_PUZZLE;
+    memcpy(item->result.location, item->cached.location, sizeof(item->result.location));
+    item->result.size  = item->cached.size;
+    item->result.cages = item->cached.cages[0] ? item->cached.cages : NULL;
+}
+
+// keeps item's (finished) analysis in the cache.
+static void _remember(batch *b, batch_item *item) {
+    cached_analysis analysis;
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.found = (item->result.status == BATCH_SOLVED);
+    memcpy(analysis.location, item->result.location, sizeof(analysis.location));
+    analysis.size = item->result.size;
+    if (item->result.cages && (strlen(item->result.cages) < sizeof(analysis.cages))) {
+        strcpy(analysis.cages, item->result.cages);
+    }
+    result_cache_store(b->options.cache, item->hash, item->scale.original_width, item->scale.original_height,
+        &analysis, item->ticks / (cvGetTickFrequency() * 1000.));
+}
+
+// does one stage's work on item; returns 0 if the item is finished early (and so is to be
+// delivered rather than passed on).
+static int _process(batch *b, batch_stage stage, batch_item *item) {
+    switch (stage) {
+        case DECODE_STAGE:
+            item->image = decode_photo(item->result.path, b->options.decode_width, 3, &(item->scale));
+            if (item->image == NULL) {
+                item->result.status = BATCH_UNREADABLE;
+                return 0;
+            }
+            if (b->options.cache) {
+                item->hash = hash_image(item->image);
+                if (result_cache_lookup(b->options.cache, item->hash, item->scale.original_width,
+                        item->scale.original_height, &(item->cached))) {
+                    _recall(item);
+                    return 0;
+                }
+            }
+            return 1;
+        case LOCATE_STAGE: {
+            item->context = create_puzzle_context(item->image, &(b->options.analysis));
+            if (item->context == NULL) {
+                item->result.status = BATCH_NO_MEMORY;
+                return 0;
+            }
+            item->location = locate_puzzle_with_context(item->context, NULL);
+            if (item->location == NULL) {
+                item->result.status = BATCH_NO_PUZZLE;
+                return 0;
+            }
+            memcpy(item->result.location, item->location, sizeof(item->result.location));
+            to_original_scale(&(item->scale), item->result.location, 4);
+            return 1;
+        }
+        case SIZE_STAGE:
+            item->squared_context = create_squared_puzzle_context(item->context, item->location);
+            if (item->squared_context == NULL) {
+                item->result.status = BATCH_NO_MEMORY;
+                return 0;
+            }
+            item->result.size     = compute_puzzle_size_with_context(item->squared_context, NULL);
+            return 1;
+        case CAGES_STAGE:
+            item->result.cages  = compute_puzzle_cages_with_context(item->squared_context, item->result.size, NULL);
+            item->result.status = item->result.cages ? BATCH_SOLVED : BATCH_NO_MEMORY;
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static void *_stage_worker(void *argument) {
+    batch_stage_state *state = argument;
+    batch *b = state->b;
+
+    batch_item *item;
+    while ((item = _pop(&(state->queue))) != NULL) {
+        int64 start = cvGetTickCount();
+        int more = _process(b, state->stage, item);
+        // (decoding and hashing happen whether the photo's in the cache or not)
+        if (state->stage != DECODE_STAGE) {
+            item->ticks += cvGetTickCount() - start;
+        }
+        if (more) {
+            _push(&(b->stages[state->stage + 1].queue), item);
+        } else {
+            // (running out of memory says nothing about the photo)
+            if (b->options.cache && (state->stage != DECODE_STAGE) && (item->result.status != BATCH_NO_MEMORY)) {
+                _remember(b, item);
+            }
+            _deliver(b, item);
+        }
+    }
+
+    pthread_mutex_lock(&(state->queue.lock));
+    int last = (--state->running == 0);
+    pthread_mutex_unlock(&(state->queue.lock));
+    if (last && (state->stage + 1 < BATCH_STAGES)) {
+        _close(&(b->stages[state->stage + 1].queue));
+    }
+
+    return NULL;
+}
+
+static int _default_workers(batch_stage stage) {
+    if (stage == DECODE_STAGE) {
+        return 2;
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cores > 0) ? (int)cores : 1;
+}
+
+batch *create_batch(const batch_options *options, batch_callback callback, void *argument) {
+    batch *b = calloc(1, sizeof(batch));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->options  = options ? *options : DEFAULT_BATCH_OPTIONS;
+    b->callback = callback;
+    b->argument = argument;
+    pthread_mutex_init(&(b->deliver_lock), NULL);
+
+    int wanted[BATCH_STAGES];
+    for (batch_stage stage = DECODE_STAGE; stage < BATCH_STAGES; ++stage) {
+        batch_stage_state *state = &(b->stages[stage]);
+        state->b       = b;
+        state->stage   = stage;
+        wanted[stage]  = (b->options.workers[stage] > 0) ? b->options.workers[stage] : _default_workers(stage);
+        int capacity   = (b->options.queue_capacity > 0) ? b->options.queue_capacity : 2 * wanted[stage];
+        state->threads = calloc(wanted[stage], sizeof(pthread_t));
+        ++b->stage_n;
+        if ((! _init_queue(&(state->queue), capacity)) || (state->threads == NULL)) {
+            // nothing has started yet: release_batch just frees what was allocated.
+            release_batch(&b);
+            return NULL;
+        }
+    }
+
+    // queues first, then threads: a worker may push into the next stage as soon as it starts.
+    for (batch_stage stage = DECODE_STAGE; stage < BATCH_STAGES; ++stage) {
+        batch_stage_state *state = &(b->stages[stage]);
+        for (int i = 0; i < wanted[stage]; ++i) {
+            if (pthread_create(&(state->threads[i]), NULL, _stage_worker, state) != 0) {
+                break;
+            }
+            pthread_mutex_lock(&(state->queue.lock));
+            ++state->running;
+            pthread_mutex_unlock(&(state->queue.lock));
+            ++state->workers;
+        }
+        if (state->workers == 0) {
+            // a stage with no workers would stall everything behind it; shut down the ones
+            // already running (nothing has been submitted, so they just drain).
+            release_batch(&b);
+            return NULL;
+        }
+    }
+
+    return b;
+}
+
+int batch_submit(batch *b, const char *path) {
+    batch_item *item = calloc(1, sizeof(batch_item));
+    char *copy = malloc(strlen(path) + 1);
+    if ((item == NULL) || (copy == NULL)) {
+        free(item);
+        free(copy);
+        return 0;
+    }
+    strcpy(copy, path);
+    item->result.index = b->submitted++;
+    item->result.path  = copy;
+    _push(&(b->stages[DECODE_STAGE].queue), item);
+    return 1;
+}
+
+void release_batch(batch **b) {
+    if ((b == NULL) || (*b == NULL)) {
+        return;
+    }
+    batch *p = *b;
+
+    // closing the first queue drains the pipeline, stage by stage.
+    _close(&(p->stages[DECODE_STAGE].queue));
+    for (int stage = 0; stage < p->stage_n; ++stage) {
+        batch_stage_state *state = &(p->stages[stage]);
+        for (int i = 0; i < state->workers; ++i) {
+            pthread_join(state->threads[i], NULL);
+        }
+        free(state->threads);
+        _destroy_queue(&(state->queue));
+    }
+    pthread_mutex_destroy(&(p->deliver_lock));
+    free(p);
+    *b = NULL;
+}
@@ -0,0 +1,76 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "cache.h"
+#include "kenken.h"
+
+// A pipeline for analysing many photos: decode -> locate -> size (squaring up on the way) ->
+// cages, with a bounded queue in front of each stage and a pool of worker threads per stage, so
+// that decoding and I/O overlap the analysis of the photos ahead of them.
+
+typedef enum {
+    BATCH_SOLVED,
+    // the file couldn't be read or decoded
+    BATCH_UNREADABLE,
+    // no puzzle was found in the photo
+    BATCH_NO_PUZZLE,
+    // there wasn't the memory to analyse it
+    BATCH_NO_MEMORY
+} batch_status;
+
+typedef struct {
+    // position in the order of submission, starting at 0
+    long                index;
+    const char         *path;
+    batch_status        status;
+    // the rest are only set for BATCH_SOLVED. location is in the original photo's coordinates,
+    // whatever scale it was decoded at.
+    CvPoint2D32f        location[4];
+    puzzle_size         size;
+    const char         *cages;
+} batch_result;
+
+// Called for every photo, one call at a time, from whichever thread finished it. The result (and
+// the strings it points to) is only valid during the call.
+typedef void (*batch_callback)(const batch_result *result, void *argument);
+
+typedef enum {
+    DECODE_STAGE,
+    LOCATE_STAGE,
+    SIZE_STAGE,
+    CAGES_STAGE,
+    BATCH_STAGES
+} batch_stage;
+
+typedef struct {
+    // worker threads per stage; 0 picks one per core (for the analysis stages) or 2 (decode).
+    int             workers[BATCH_STAGES];
+    // photos waiting in front of each stage; 0 picks twice that stage's worker count.
+    int             queue_capacity;
+    // if set, results are delivered in order of submission; otherwise as soon as they're ready.
+    unsigned short  ordered;
+    puzzle_options  analysis;
+    // if > 0, JPEGs are decoded at the smallest scale which is still at least this wide (see
+    // decode_photo); otherwise at full size.
+    int             decode_width;
+    // if set, each decoded photo is looked up here first, and a photo found there is delivered
+    // without going through the analysis; the analysis of the others is kept in it. Not owned by
+    // the batch (it may outlive it, or be shared between batches).
+    result_cache   *cache;
+} batch_options;
+
+extern const batch_options DEFAULT_BATCH_OPTIONS;
+
+typedef struct batch_s batch;
+
+// options may be NULL, meaning DEFAULT_BATCH_OPTIONS.
+batch *create_batch(const batch_options *options, batch_callback callback, void *argument);
+
+// Queues a photo (path is copied). Blocks while the decode queue is full. Returns 1, or 0 if
+// there's no memory to queue it (when it won't be delivered).
+int batch_submit(batch *b, const char *path);
+
+// Waits for every submitted photo to be delivered, then stops the workers.
+void release_batch(batch **b);
+
+#endif /* _BATCH_H */
@@ -0,0 +1,73 @@
+#include <stdio.h>
+
+#include "cv.h"
+#include "highgui.h"
+#include "cages.h"
+#include "kenken.h"
+
+// Times the cage finder for each puzzle size. Each photo's puzzle is located and squared up once;
+// then the finder is run at every size on its grid image (it can be run on any grid, whatever the
+// puzzle's real size).
+//
+// usage: ./bench_cages [ -n repetitions ] image...
+
+static double _microseconds(int64 ticks) {
+    return ticks / cvGetTickFrequency();
+}
+
+int main (int argc, char** argv) {
+    int repetitions = 200;
+    int first_image = 1;
+    if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+        repetitions = atoi(argv[2]);
+        first_image = 3;
+    }
+    if ((first_image >= argc) || (repetitions < 1)) {
+        fprintf(stderr, "usage: ./bench_cages [ -n repetitions ] image...\n");
+        exit(255);
+    }
+
+    double total[CAGES_SIZE_MAX + 1] = { 0 };
+    int grids = 0;
+    for (int i = first_image; i < argc; ++i) {
+        IplImage *in = cvLoadImage(argv[i], 1);
+        if (in == NULL) {
+            fprintf(stderr, "%s: could not load\n", argv[i]);
+            continue;
+        }
+        puzzle_context *context = create_puzzle_context(in, NULL);
+        const CvPoint2D32f *location = locate_puzzle_with_context(context, NULL);
+        if (location == NULL) {
+            fprintf(stderr, "%s: no puzzle found\n", argv[i]);
+            release_puzzle_context(&context);
+            cvReleaseImage(&in);
+            continue;
+        }
+        const bitmap *grid = puzzle_context_grid(create_squared_puzzle_context(context, location));
+        ++grids;
+
+        for (int size = CAGES_SIZE_MIN; size <= CAGES_SIZE_MAX; ++size) {
+            char cages[CAGES_SIZE_MAX * CAGES_SIZE_MAX + 1];
+
+            int64 start = cvGetTickCount();
+            for (int r = 0; r < repetitions; ++r) {
+                find_cages(grid, size, cages);
+            }
+            total[size] += _microseconds(cvGetTickCount() - start) / repetitions;
+        }
+
+        release_puzzle_context(&context);
+        cvReleaseImage(&in);
+    }
+    if (grids == 0) {
+        return 1;
+    }
+
+    printf("%4s %10s\n", "size", "us");
+    for (int size = CAGES_SIZE_MIN; size <= CAGES_SIZE_MAX; ++size) {
+        printf("%4d %10.2f\n", size, total[size] / grids);
+    }
+    printf("(mean per grid, over %d grids)\n", grids);
+
+    return 0;
+}
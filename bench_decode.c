@@ -0,0 +1,136 @@
+#include <stdio.h>
+
+#include "cv.h"
+#include "decode.h"
+#include "highgui.h"
+#include "kenken.h"
+
+// Compares decoding each photo in full (cvLoadImage) with decoding it at a reduced scale
+// (decode_photo), then locating the puzzle in each. For each it gives the decode time and the
+// size of the decoded image, the time to locate the puzzle, and how far the corners found in the
+// reduced image (mapped back to full scale) are from those found in the full one.
+//
+// usage: ./bench_decode [ -n repetitions ] [ -w target_width ] image...
+
+static double _milliseconds(int64 ticks) {
+    return ticks / (cvGetTickFrequency() * 1000.);
+}
+
+// best of n decodes; the last image decoded is kept in *image.
+static double _time_decode(const char *path, int target_width, int repetitions, IplImage **image, decode_scale *scale) {
+    double best = INFINITY;
+    for (int r = 0; r < repetitions; ++r) {
+        cvReleaseImage(image);
+        int64 start = cvGetTickCount();
+        if (target_width > 0) {
+            *image = decode_photo(path, target_width, 3, scale);
+        } else {
+            *image = cvLoadImage(path, 1);
+        }
+        double ms = _milliseconds(cvGetTickCount() - start);
+        best = (ms < best) ? ms : best;
+    }
+    if ((target_width <= 0) && (*image != NULL)) {
+        *scale = (decode_scale){ (*image)->width, (*image)->height, 1 };
+    }
+    return best;
+}
+
+// the time to locate the puzzle; its corners (at full scale) go to location, which is left all
+// zero if it isn't found.
+static double _time_locate(IplImage *in, const decode_scale *scale, CvPoint2D32f location[4]) {
+    int64 start = cvGetTickCount();
+    puzzle_context *context = create_puzzle_context(in, NULL);
+    const CvPoint2D32f *found = locate_puzzle_with_context(context, NULL);
+    double ms = _milliseconds(cvGetTickCount() - start);
+
+    memset(location, 0, 4 * sizeof(CvPoint2D32f));
+    if (found) {
+        memcpy(location, found, 4 * sizeof(CvPoint2D32f));
+        to_original_scale(scale, location, 4);
+    }
+    release_puzzle_context(&context);
+    return ms;
+}
+
+static double _max_shift(const CvPoint2D32f *a, const CvPoint2D32f *b) {
+    double shift = 0;
+    for (int c = 0; c < 4; ++c) {
+        double dx = fabs(a[c].x - b[c].x);
+        double dy = fabs(a[c].y - b[c].y);
+        shift = (dx > shift) ? dx : shift;
+        shift = (dy > shift) ? dy : shift;
+    }
+    return shift;
+}
+
+static double _megabytes(const IplImage *image) {
+    return (double)image->widthStep * image->height / (1024 * 1024);
+}
+
+int main (int argc, char** argv) {
+    int repetitions  = 5;
+    int target_width = 600;
+    int first_image  = 1;
+    while ((first_image + 1 < argc) && (argv[first_image][0] == '-')) {
+        if (strcmp(argv[first_image], "-n") == 0) {
+            repetitions = atoi(argv[first_image + 1]);
+        } else if (strcmp(argv[first_image], "-w") == 0) {
+            target_width = atoi(argv[first_image + 1]);
+        } else {
+            break;
+        }
+        first_image += 2;
+    }
+    if ((first_image >= argc) || (repetitions < 1) || (target_width < 1)) {
+        fprintf(stderr, "usage: ./bench_decode [ -n repetitions ] [ -w target_width ] image...\n");
+        exit(255);
+    }
+
+    printf("%-24s %9s %9s %5s %7s %9s %9s %9s %6s\n", "image", "full ms", "scaled ms", "scale", "full MB", "scaled MB",
+        "locate ms", "scaled ms", "shift");
+
+    double full_total   = 0;
+    double scaled_total = 0;
+    double full_memory   = 0;
+    double scaled_memory = 0;
+    double full_locate   = 0;
+    double scaled_locate = 0;
+    for (int i = first_image; i < argc; ++i) {
+        IplImage *full   = NULL;
+        IplImage *scaled = NULL;
+        decode_scale full_scale, scaled_scale;
+        double full_ms   = _time_decode(argv[i], 0, repetitions, &full, &full_scale);
+        double scaled_ms = _time_decode(argv[i], target_width, repetitions, &scaled, &scaled_scale);
+        if ((full == NULL) || (scaled == NULL)) {
+            fprintf(stderr, "%s: could not load\n", argv[i]);
+            cvReleaseImage(&full);
+            cvReleaseImage(&scaled);
+            continue;
+        }
+
+        CvPoint2D32f full_location[4];
+        CvPoint2D32f scaled_location[4];
+        double full_locate_ms   = _time_locate(full, &full_scale, full_location);
+        double scaled_locate_ms = _time_locate(scaled, &scaled_scale, scaled_location);
+
+        printf("%-24s %9.2f %9.2f   1/%d %7.2f %9.2f %9.2f %9.2f %6.1f\n", argv[i], full_ms, scaled_ms, scaled_scale.denominator,
+            _megabytes(full), _megabytes(scaled), full_locate_ms, scaled_locate_ms, _max_shift(full_location, scaled_location));
+        full_total    += full_ms;
+        scaled_total  += scaled_ms;
+        full_memory   += _megabytes(full);
+        scaled_memory += _megabytes(scaled);
+        full_locate   += full_locate_ms;
+        scaled_locate += scaled_locate_ms;
+
+        cvReleaseImage(&full);
+        cvReleaseImage(&scaled);
+    }
+
+    printf("%-24s %9.2f %9.2f %5s %7.2f %9.2f %9.2f %9.2f\n", "total", full_total, scaled_total, "", full_memory, scaled_memory,
+        full_locate, scaled_locate);
+    printf("decode %.1fx faster, %.1fx less memory; decode and locate %.1fx faster\n", full_total / scaled_total,
+        full_memory / scaled_memory, (full_total + full_locate) / (scaled_total + scaled_locate));
+
+    return 0;
+}
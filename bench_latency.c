@@ -0,0 +1,126 @@
+#include <stdio.h>
+
+#include "cv.h"
+#include "highgui.h"
+#include "kenken.h"
+
+// Single-photo latency of the whole analysis (locate, square, size, cages) with the per-pixel
+// scans split across 1, 2, 4 and 8 workers. Reports p50 and p99 per photo, and checks that every
+// worker count gets the same answers as a single thread.
+//
+// usage: ./bench_latency [ -n repetitions ] image...
+
+static const int WORKER_COUNTS[] = { 1, 2, 4, 8 };
+enum { WORKER_COUNT_N = sizeof(WORKER_COUNTS) / sizeof(WORKER_COUNTS[0]) };
+
+static double _milliseconds(int64 ticks) {
+    return ticks / (cvGetTickFrequency() * 1000.);
+}
+
+static int _compare_doubles(const void *a, const void *b) {
+    double da = *((const double *)a);
+    double db = *((const double *)b);
+    return (da > db) - (da < db);
+}
+
+// nearest-rank percentile of n sorted samples.
+static double _percentile(const double *sorted, int n, int percent) {
+    int rank = (percent * n + 99) / 100;
+    return sorted[(rank > 0) ? (rank - 1) : 0];
+}
+
+// one full analysis; the answer is written to result as "size:cages".
+static double _analyse(IplImage *in, const puzzle_options *options, char *result, size_t result_size) {
+    int64 start = cvGetTickCount();
+
+    puzzle_context *context = create_puzzle_context(in, options);
+    const CvPoint2D32f *location = locate_puzzle_with_context(context, NULL);
+    puzzle_size size = 0;
+    const char *cages = NULL;
+    if (location) {
+        puzzle_context *squared_context = create_squared_puzzle_context(context, location);
+        size  = compute_puzzle_size_with_context(squared_context, NULL);
+        cages = compute_puzzle_cages_with_context(squared_context, size, NULL);
+    }
+    snprintf(result, result_size, "%d:%s", size, cages ? cages : "");
+    release_puzzle_context(&context);
+
+    return _milliseconds(cvGetTickCount() - start);
+}
+
+int main (int argc, char** argv) {
+    int repetitions = 50;
+    int first_image = 1;
+    if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+        repetitions = atoi(argv[2]);
+        first_image = 3;
+    }
+    if ((first_image >= argc) || (repetitions < 1)) {
+        fprintf(stderr, "usage: ./bench_latency [ -n repetitions ] image...\n");
+        exit(255);
+    }
+
+    work_pool *pools[WORKER_COUNT_N];
+    printf("%-24s", "image");
+    for (int w = 0; w < WORKER_COUNT_N; ++w) {
+        pools[w] = create_work_pool(WORKER_COUNTS[w]);
+        printf(" %3d: %7s %7s", WORKER_COUNTS[w], "p50 ms", "p99 ms");
+    }
+    printf(" %9s\n", "differing");
+
+    int image_n = argc - first_image;
+    double *samples     = malloc(repetitions * sizeof(double));
+    double *all_samples = malloc((size_t)WORKER_COUNT_N * image_n * repetitions * sizeof(double));
+    int all_n[WORKER_COUNT_N] = { 0 };
+
+    for (int i = first_image; i < argc; ++i) {
+        IplImage *in = cvLoadImage(argv[i], 1);
+        if (in == NULL) {
+            fprintf(stderr, "%s: could not load\n", argv[i]);
+            continue;
+        }
+
+        char expected[128];
+        char result[128];
+        int differing = 0;
+        printf("%-24s", argv[i]);
+        for (int w = 0; w < WORKER_COUNT_N; ++w) {
+            puzzle_options options = DEFAULT_PUZZLE_OPTIONS;
+            options.pool = pools[w];
+
+            for (int r = 0; r < repetitions; ++r) {
+                samples[r] = _analyse(in, &options, result, sizeof(result));
+                if ((w == 0) && (r == 0)) {
+                    strcpy(expected, result);
+                }
+                differing += (strcmp(result, expected) != 0);
+                all_samples[(size_t)w * image_n * repetitions + all_n[w]++] = samples[r];
+            }
+
+            qsort(samples, repetitions, sizeof(double), _compare_doubles);
+            printf(" %5s%7.2f %7.2f", "", _percentile(samples, repetitions, 50), _percentile(samples, repetitions, 99));
+        }
+        printf(" %9d\n", differing);
+
+        cvReleaseImage(&in);
+    }
+
+    printf("%-24s", "all photos");
+    for (int w = 0; w < WORKER_COUNT_N; ++w) {
+        double *sorted = all_samples + (size_t)w * image_n * repetitions;
+        if (all_n[w] == 0) {
+            continue;
+        }
+        qsort(sorted, all_n[w], sizeof(double), _compare_doubles);
+        printf(" %5s%7.2f %7.2f", "", _percentile(sorted, all_n[w], 50), _percentile(sorted, all_n[w], 99));
+    }
+    printf("\n");
+
+    for (int w = 0; w < WORKER_COUNT_N; ++w) {
+        release_work_pool(&pools[w]);
+    }
+    free(samples);
+    free(all_samples);
+
+    return 0;
+}
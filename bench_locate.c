@@ -0,0 +1,121 @@
+#include <stdio.h>
+
+#include "cv.h"
+#include "highgui.h"
+#include "kenken.h"
+
+// Compares ways of locating the puzzle, image by image: the Hough transform alone, the contour
+// fast path (falling back to Hough), and the pyramid mode (with the fast path). For each it gives
+// the time, and for the latter two how far their corners are from the Hough ones; the path the
+// fast path took is counted. -s scales the inputs up first, to stand in for 8-12 MP camera photos.
+//
+// usage: ./bench_locate [ -n repetitions ] [ -s scale ] image...
+
+static double _milliseconds(int64 ticks) {
+    return ticks / (cvGetTickFrequency() * 1000.);
+}
+
+// best of n; the location found is copied to location (all zero if none was found), and the way
+// it was found to path.
+static double _time_locate(IplImage *in, const puzzle_options *options, int repetitions, CvPoint2D32f location[4], locate_path *path) {
+    double best = INFINITY;
+    for (int r = 0; r < repetitions; ++r) {
+        int64 start = cvGetTickCount();
+        puzzle_context *context = create_puzzle_context(in, options);
+        const CvPoint2D32f *found = locate_puzzle_with_context(context, NULL);
+        double ms = _milliseconds(cvGetTickCount() - start);
+        best = (ms < best) ? ms : best;
+
+        memset(location, 0, 4 * sizeof(CvPoint2D32f));
+        if (found) {
+            memcpy(location, found, 4 * sizeof(CvPoint2D32f));
+        }
+        *path = puzzle_context_locate_path(context);
+        release_puzzle_context(&context);
+    }
+    return best;
+}
+
+// the largest difference in any coordinate of any corner, in input pixels (test_locate_puzzle
+// allows LOCATION_FUZZ at the original scale).
+static double _max_shift(const CvPoint2D32f *a, const CvPoint2D32f *b) {
+    double shift = 0;
+    for (int c = 0; c < 4; ++c) {
+        double dx = fabs(a[c].x - b[c].x);
+        double dy = fabs(a[c].y - b[c].y);
+        shift = (dx > shift) ? dx : shift;
+        shift = (dy > shift) ? dy : shift;
+    }
+    return shift;
+}
+
+int main (int argc, char** argv) {
+    int repetitions = 3;
+    double scale    = 1;
+    int first_image = 1;
+    while ((first_image + 1 < argc) && (argv[first_image][0] == '-')) {
+        if (strcmp(argv[first_image], "-n") == 0) {
+            repetitions = atoi(argv[first_image + 1]);
+        } else if (strcmp(argv[first_image], "-s") == 0) {
+            scale = atof(argv[first_image + 1]);
+        } else {
+            break;
+        }
+        first_image += 2;
+    }
+    if ((first_image >= argc) || (repetitions < 1) || (scale <= 0)) {
+        fprintf(stderr, "usage: ./bench_locate [ -n repetitions ] [ -s scale ] image...\n");
+        exit(255);
+    }
+
+    puzzle_options hough   = DEFAULT_PUZZLE_OPTIONS;
+    puzzle_options contour = DEFAULT_PUZZLE_OPTIONS;
+    puzzle_options pyramid = DEFAULT_PUZZLE_OPTIONS;
+    hough.corners  = CORNERS_BY_HOUGH;
+    pyramid.locate = LOCATE_PYRAMID;
+
+    printf("%-24s %5s %9s %10s %6s %7s %10s %6s %8s\n", "image", "MP", "hough ms", "contour ms", "shift", "path",
+        "pyramid ms", "shift", "speedup");
+
+    double hough_total   = 0;
+    double contour_total = 0;
+    double pyramid_total = 0;
+    int path_counts[LOCATED_BY_HOUGH + 1] = { 0 };
+    static const char *PATH_NAMES[] = { "none", "contour", "hough" };
+    for (int i = first_image; i < argc; ++i) {
+        IplImage *loaded = cvLoadImage(argv[i], 1);
+        if (loaded == NULL) {
+            fprintf(stderr, "%s: could not load\n", argv[i]);
+            continue;
+        }
+        IplImage *in = cvCreateImage(cvSize(loaded->width * scale, loaded->height * scale), 8, loaded->nChannels);
+        cvResize(loaded, in, CV_INTER_LINEAR);
+        cvReleaseImage(&loaded);
+
+        CvPoint2D32f hough_location[4];
+        CvPoint2D32f contour_location[4];
+        CvPoint2D32f pyramid_location[4];
+        locate_path hough_path, contour_path, pyramid_path;
+        double hough_ms   = _time_locate(in, &hough, repetitions, hough_location, &hough_path);
+        double contour_ms = _time_locate(in, &contour, repetitions, contour_location, &contour_path);
+        double pyramid_ms = _time_locate(in, &pyramid, repetitions, pyramid_location, &pyramid_path);
+        ++path_counts[contour_path];
+
+        printf("%-24s %5.1f %9.2f %10.2f %6.1f %7s %10.2f %6.1f %7.1fx\n", argv[i], in->width * in->height / 1e6,
+            hough_ms, contour_ms, _max_shift(hough_location, contour_location), PATH_NAMES[contour_path],
+            pyramid_ms, _max_shift(hough_location, pyramid_location), hough_ms / pyramid_ms);
+        hough_total   += hough_ms;
+        contour_total += contour_ms;
+        pyramid_total += pyramid_ms;
+
+        cvReleaseImage(&in);
+    }
+
+    printf("%-24s %5s %9.2f %10.2f %6s %7s %10.2f %6s %7.1fx\n", "total", "", hough_total, contour_total, "", "",
+        pyramid_total, "", hough_total / pyramid_total);
+    printf("fast path taken for %d of %d images (hough fallback %d, not found %d); %.2f ms saved over hough alone\n",
+        path_counts[LOCATED_BY_CONTOUR], path_counts[LOCATED_NOWHERE] + path_counts[LOCATED_BY_CONTOUR] + path_counts[LOCATED_BY_HOUGH],
+        path_counts[LOCATED_BY_HOUGH], path_counts[LOCATED_NOWHERE], hough_total - contour_total);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+
+#include "cv.h"
+#include "highgui.h"
+#include "pixels.h"
+
+// Compares the raster-order pixel visitors with the cvGet2D/cvSet2D loops they replace (column
+// by column, as those were written), over the whole of each image: the mean scan, the red/blue
+// mask paint of the cage annotations, and the brighter-than paint of the harness's cage display.
+// The outputs of each pair are checked to be identical.
+//
+// usage: ./bench_pixels [ -n repetitions ] image...
+
+static double _milliseconds(int64 ticks) {
+    return ticks / (cvGetTickFrequency() * 1000.);
+}
+
+static unsigned long _old_sum(IplImage *gray) {
+    unsigned long total = 0;
+    for (int x = 0; x < gray->width; ++x) {
+        for (int y = 0; y < gray->height; ++y) {
+            CvScalar s = cvGet2D(gray, y, x);
+            total += s.val[0];
+        }
+    }
+    return total;
+}
+
+static void _old_paint_mask(IplImage *mask, IplImage *out) {
+    for (int x = 0; x < mask->width; ++x) {
+        for (int y = 0; y < mask->height; ++y) {
+            CvScalar s = cvGet2D(mask, y, x);
+            cvSet2D(out, y, x, (s.val[0] == 0) ? CV_RGB(255, 0, 0) : CV_RGB(0, 0, 255));
+        }
+    }
+}
+
+static void _old_paint_brighter(IplImage *gray, IplImage *out) {
+    for (int x = 0; x < gray->width; ++x) {
+        for (int y = 0; y < gray->height; ++y) {
+            CvScalar s = cvGet2D(gray, y, x);
+            if (s.val[0] > 20) {
+                cvSet2D(out, y, x, CV_RGB(0, 255, 0));
+            }
+        }
+    }
+}
+
+static long _differing(IplImage *a, IplImage *b) {
+    long differing = 0;
+    for (int y = 0; y < a->height; ++y) {
+        const unsigned char *p = pixel_row(a, y);
+        const unsigned char *q = pixel_row(b, y);
+        for (int x = 0; x < a->width * a->nChannels; ++x) {
+            differing += (p[x] != q[x]);
+        }
+    }
+    return differing;
+}
+
+int main (int argc, char** argv) {
+    int repetitions = 5;
+    int first_image = 1;
+    if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+        repetitions = atoi(argv[2]);
+        first_image = 3;
+    }
+    if ((first_image >= argc) || (repetitions < 1)) {
+        fprintf(stderr, "usage: ./bench_pixels [ -n repetitions ] image...\n");
+        exit(255);
+    }
+
+    printf("%-24s %-8s %11s %11s %8s %10s\n", "image", "scan", "cvGet2D ms", "raster ms", "speedup", "differing");
+
+    static const char *SCANS[] = { "mean", "mask", "brighter" };
+    double old_totals[3] = { 0 };
+    double new_totals[3] = { 0 };
+    for (int i = first_image; i < argc; ++i) {
+        IplImage *in = cvLoadImage(argv[i], 1);
+        if (in == NULL) {
+            fprintf(stderr, "%s: could not load\n", argv[i]);
+            continue;
+        }
+        IplImage *gray = cvCreateImage(cvGetSize(in), 8, 1);
+        cvCvtColor(in, gray, CV_BGR2GRAY);
+        IplImage *mask = cvCreateImage(cvGetSize(in), 8, 1);
+        cvThreshold(gray, mask, 128, 255, CV_THRESH_BINARY_INV);
+        bitmap *packed_mask = create_bitmap(mask->width, mask->height);
+        pack_bitmap(packed_mask, (unsigned char *)mask->imageData, mask->widthStep);
+        IplImage *old_out = cvCloneImage(in);
+        IplImage *new_out = cvCloneImage(in);
+        CvRect whole = cvRect(0, 0, in->width, in->height);
+
+        for (int scan = 0; scan < 3; ++scan) {
+            // best of n, to keep the noise down.
+            double old_ms = INFINITY;
+            double new_ms = INFINITY;
+            unsigned long old_sum = 0, new_sum = 0;
+            for (int r = 0; r < repetitions; ++r) {
+                cvCopy(in, old_out, NULL);
+                cvCopy(in, new_out, NULL);
+
+                int64 start = cvGetTickCount();
+                if (scan == 0) {
+                    old_sum = _old_sum(gray);
+                } else if (scan == 1) {
+                    _old_paint_mask(mask, old_out);
+                } else {
+                    _old_paint_brighter(gray, old_out);
+                }
+                double ms = _milliseconds(cvGetTickCount() - start);
+                old_ms = (ms < old_ms) ? ms : old_ms;
+
+                start = cvGetTickCount();
+                if (scan == 0) {
+                    new_sum = sum_region(gray, whole);
+                } else if (scan == 1) {
+                    paint_mask(packed_mask, new_out, whole, CV_RGB(255, 0, 0), CV_RGB(0, 0, 255));
+                } else {
+                    paint_brighter(gray, new_out, whole, 20, CV_RGB(0, 255, 0));
+                }
+                ms = _milliseconds(cvGetTickCount() - start);
+                new_ms = (ms < new_ms) ? ms : new_ms;
+            }
+
+            long differing = (scan == 0) ? (old_sum != new_sum) : _differing(old_out, new_out);
+            printf("%-24s %-8s %11.2f %11.2f %7.1fx %10ld\n", argv[i], SCANS[scan], old_ms, new_ms, old_ms / new_ms, differing);
+            old_totals[scan] += old_ms;
+            new_totals[scan] += new_ms;
+        }
+
+        cvReleaseImage(&new_out);
+        cvReleaseImage(&old_out);
+        release_bitmap(&packed_mask);
+        cvReleaseImage(&mask);
+        cvReleaseImage(&gray);
+        cvReleaseImage(&in);
+    }
+
+    for (int scan = 0; scan < 3; ++scan) {
+        printf("%-24s %-8s %11.2f %11.2f %7.1fx\n", "total", SCANS[scan], old_totals[scan], new_totals[scan],
+            old_totals[scan] / new_totals[scan]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cv.h"
+#include "highgui.h"
+#include "solver.h"
+
+// Times the solver on two fixed suites of random puzzles per size, each built around a random
+// Latin square (so it has a solution) from the same seed every run:
+//  - typical: cages of 1 to 4 cells, with every operation, as printed puzzles have them.
+//  - hard: cages of 2 to 6 cells, adding or multiplying only and with no givens, which leaves
+//    propagation the least to go on.
+// Every solution is checked against its puzzle, and a typical puzzle which takes longer than
+// worst_us counts as a failure. The hard suite has no such limit: its worst 9x9 puzzles take tens
+// of milliseconds, some thousands of guesses.
+//
+// Then the parallel search, on 1, 2, 4, ... up to max_workers workers: first the hardest 9x9
+// puzzles with one solution that the hard suite turned up, then the 7x7 puzzle which is all one
+// cage (as test/IMG_0675.JPG's cages come out) counted up to COUNT_LIMIT solutions. Speedups
+// only mean something up to the number of cores, which is printed alongside: on one core they
+// show only how splitting the search changes its guesses, and its overhead. A suite puzzle
+// which takes longer than PARALLEL_WORST_MS on any pool counts as a failure.
+//
+// usage: ./bench_solver [ -n puzzles ] [ -w max_workers ]
+
+enum { CELLS_MAX = CAGES_SIZE_MAX * CAGES_SIZE_MAX };
+
+static const char CAGE_NAMES[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+enum { CAGE_NAME_N = sizeof(CAGE_NAMES) - 1 };
+
+typedef struct {
+    const char *name;
+    int         cage_min;
+    int         cage_max;
+    int         all_operations;
+    // the longest any one puzzle may take (0 for no limit)
+    double      worst_us;
+} suite;
+
+static const suite SUITES[] = {
+    { "typical", 1, 4, 1, 1000 },
+    { "hard",    2, 6, 0, 0    }
+};
+enum { SUITE_N = sizeof(SUITES) / sizeof(SUITES[0]) };
+
+// each a layout and its clues in cage order (see parse_puzzle)
+static const char *PARALLEL_SUITE[] = {
+    "ABCCDDDDEBBCCCFFGEBBHCIJJGGKBHIIILGGMNOOPLLLGMNOOPPQQRMSTUPPVRRMSTUUWXXYMSTUWWXXX 3= 3072x 33+ 23+ 10x 10+ 27+ 6x 432x 12+ 5= 27+ 3024x 63x 168x 27+ 4+ 192x 9+ 14+ 26+ 2= 15+ 720x 3=",
+    "AAABBCDEEFFBBBCDDEGGGHHCIIJKLLLHCCIJKMMNOOOJJKKNNOPPQRKSTNPPQQRSSTTUVVWWXXTTTVYYY 16+ 23+ 8640x 35x 28x 27x 12+ 17+ 15+ 26+ 19+ 16+ 20x 630x 9+ 420x 21+ 24x 432x 36288x 1= 9+ 15x 7+ 16+",
+    "ABBBCCDDDEBBFCCDDDEEGFHCIIJEEGGGKJJJLLMNNKOJJLLPPNNOQQRRPNNSTUURRVSSSWXXRYYYYWWXX 2= 21+ 1260x 37+ 1440x 15+ 20+ 6= 9+ 1120x 9x 2520x 2= 3360x 6x 54x 18x 24+ 18+ 7= 14+ 6= 108x 17+ 432x",
+    "AABBBBCCCDBBEFFCGGDHHHIJKGGLMMHNJKKOLMHHNJPKKMMQQQPPPKMRQQSSSPTRRRQUUTTTVRRWXXXYT 12x 39+ 21+ 11+ 1= 15x 25+ 10080x 2= 216x 540x 6+ 31+ 63x 4= 240x 33+ 29+ 19+ 27+ 10+ 6= 2= 20x 8=",
+    "ABBCCDDEEAABBCDDEFAAAGHHEEIJJGGGHKLIJMMGKKKIINNOOPPQRISTTUPPQRVSTTWWXRRVSTTYWXXVV 30+ 180x 30x 22+ 3360x 3= 12096x 15+ 1080x 15+ 17+ 8= 9+ 8+ 8+ 25+ 6+ 18+ 240x 1728x 3= 18+ 17+ 18+ 4=",
+    "ABBBCCDDEAFFFFDDGGAHFFIIJJGAHKKIILLGMMKKIILNGOOKPPPLNNQORRSSLNNTTRRRUUNVTTTWRXUUU 72x 24+ 20x 162x 1= 10080x 22+ 14+ 35+ 12+ 15+ 32+ 14x 6048x 42x 72x 5= 22680x 3x 26+ 840x 6= 3= 6=",
+    "AAABBCCDEABBBBCFDDGHHIIIFDDGGJJIIIKKGGGJLLKKMNNNNOOPMMQRNSSPPMTQRRRUUUVTQRWXXXUVT 12+ 21600x 12x 4032x 9= 30x 17010x 10+ 1764x 16+ 23+ 30x 42x 32+ 11+ 162x 8+ 24+ 6+ 10+ 1512x 10x 5= 18+",
+    "ABBCCCDDDAAAECDDFFGAAEHHHIIJJKELHHIIJJKKMMMIINOPPQQQRRNSSSSQTURNNNVSTTTWXXNVVYTTW 2160x 20x 28+ 22+ 11+ 11+ 8= 2016x 8640x 315x 15+ 2= 15+ 648x 7= 8+ 225x 14+ 10080x 23+ 6= 16+ 35x 11+ 4=",
+    "ABCDEFFFFBBDDGHFIJBBKDGGLIJMKKDGNLOJKKPPPQQJJKRRRRQQQJSTRUVQWWWSTUUVXXXWYYUUVVVWW 1= 20+ 2= 30+ 6= 33+ 26+ 3= 28x 29+ 29+ 3+ 9= 4= 6= 24x 35280x 480x 12+ 11+ 31+ 810x 5376x 9+ 6x",
+};
+enum { PARALLEL_SUITE_N = sizeof(PARALLEL_SUITE) / sizeof(PARALLEL_SUITE[0]) };
+
+static const char *ONE_CAGE = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA 196+";
+enum { COUNT_LIMIT = 20000 };
+// (the slowest takes about 30ms built with -O2, 100ms without)
+enum { PARALLEL_WORST_MS = 250 };
+
+static double _microseconds(int64 ticks) {
+    return ticks / cvGetTickFrequency();
+}
+
+// xorshift, so that the suites are the same whichever C library this runs on.
+static unsigned long long _state = 88172645463325252ULL;
+
+static int _random(int n) {
+    _state ^= _state << 13;
+    _state ^= _state >> 7;
+    _state ^= _state << 17;
+    return (int)((_state >> 33) % n);
+}
+
+static void _shuffle(int *values, int n) {
+    for (int i = n - 1; i > 0; --i) {
+        int j = _random(i + 1);
+        int t = values[i];
+        values[i] = values[j];
+        values[j] = t;
+    }
+}
+
+// the cyclic square with its rows, columns and symbols shuffled.
+static void _latin_square(int size, unsigned char *square) {
+    int rows[CAGES_SIZE_MAX], columns[CAGES_SIZE_MAX], symbols[CAGES_SIZE_MAX];
+    for (int i = 0; i < size; ++i) {
+        rows[i] = columns[i] = symbols[i] = i;
+    }
+    _shuffle(rows, size);
+    _shuffle(columns, size);
+    _shuffle(symbols, size);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            square[y * size + x] = symbols[(rows[y] + columns[x]) % size] + 1;
+        }
+    }
+}
+
+// Grows cages from the cells in a random order, each to a random length (or until it's boxed
+// in), and names them in order of their first cell. Returns the number of cages.
+static int _cages(int size, int cage_min, int cage_max, char *cages) {
+    int order[CELLS_MAX];
+    int owner[CELLS_MAX];
+    for (int i = 0; i < size * size; ++i) {
+        order[i] = i;
+        owner[i] = -1;
+    }
+    _shuffle(order, size * size);
+
+    int cage_n = 0;
+    for (int o = 0; o < size * size; ++o) {
+        if (owner[order[o]] != -1) {
+            continue;
+        }
+        int members[CELLS_MAX];
+        int member_n = 0;
+        int length = cage_min + _random(cage_max - cage_min + 1);
+        members[member_n++] = order[o];
+        owner[order[o]] = cage_n;
+        while (member_n < length) {
+            int free[4 * CELLS_MAX];
+            int free_n = 0;
+            for (int m = 0; m < member_n; ++m) {
+                int x = members[m] % size;
+                int y = members[m] / size;
+                const int neighbours[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+                for (int i = 0; i < 4; ++i) {
+                    int nx = neighbours[i][0];
+                    int ny = neighbours[i][1];
+                    if ((nx >= 0) && (nx < size) && (ny >= 0) && (ny < size) && (owner[ny * size + nx] == -1)) {
+                        free[free_n++] = ny * size + nx;
+                    }
+                }
+            }
+            if (free_n == 0) {
+                break;
+            }
+            int next = free[_random(free_n)];
+            members[member_n++] = next;
+            owner[next] = cage_n;
+        }
+        ++cage_n;
+    }
+
+    int name[CELLS_MAX];
+    for (int c = 0; c < cage_n; ++c) {
+        name[c] = -1;
+    }
+    int named = 0;
+    for (int i = 0; i < size * size; ++i) {
+        if (name[owner[i]] == -1) {
+            name[owner[i]] = named++;
+        }
+        cages[i] = (name[owner[i]] < CAGE_NAME_N) ? CAGE_NAMES[name[owner[i]]] : '?';
+    }
+    cages[size * size] = 0;
+    return cage_n;
+}
+
+static cage_clue _clue(const suite *s, const int *values, int k) {
+    if (k == 1) {
+        return (cage_clue){ CAGE_GIVEN, values[0] };
+    }
+    long sum = 0;
+    long product = 1;
+    for (int i = 0; i < k; ++i) {
+        sum += values[i];
+        product *= values[i];
+    }
+    if ((k == 2) && s->all_operations) {
+        int larger  = (values[0] > values[1]) ? values[0] : values[1];
+        int smaller = (values[0] > values[1]) ? values[1] : values[0];
+        switch (_random(4)) {
+            case 0:
+                if (larger % smaller == 0) {
+                    return (cage_clue){ CAGE_DIVIDE, larger / smaller };
+                }
+                return (cage_clue){ CAGE_SUBTRACT, larger - smaller };
+            case 1:
+                return (cage_clue){ CAGE_SUBTRACT, larger - smaller };
+            default:
+                break;
+        }
+    }
+    return _random(2) ? (cage_clue){ CAGE_ADD, sum } : (cage_clue){ CAGE_MULTIPLY, product };
+}
+
+// fills in puzzle (whose cages and clues point at the given buffers). 0 if there'd be more cages
+// than names.
+static int _puzzle(const suite *s, int size, kenken_puzzle *puzzle, char *cages, cage_clue *clues) {
+    unsigned char square[CELLS_MAX];
+    _latin_square(size, square);
+    int cage_n = _cages(size, s->cage_min, s->cage_max, cages);
+    if (cage_n > CAGE_NAME_N) {
+        return 0;
+    }
+    for (int c = 0; c < cage_n; ++c) {
+        int values[CELLS_MAX];
+        int k = 0;
+        for (int i = 0; i < size * size; ++i) {
+            if (cages[i] == CAGE_NAMES[c]) {
+                values[k++] = square[i];
+            }
+        }
+        clues[c] = _clue(s, values, k);
+    }
+    *puzzle = (kenken_puzzle){ size, cages, clues, cage_n };
+    return 1;
+}
+
+// Solves PARALLEL_SUITE and counts ONE_CAGE's solutions on pools of 1, 2, 4, ... workers. Returns
+// the number of wrong answers, and of suite puzzles over PARALLEL_WORST_MS.
+static int _parallel(int max_workers) {
+    int failures = 0;
+    double first_suite = 0;
+    double first_count = 0;
+    printf("\n%7s %10s %10s %8s %8s %10s %8s %8s\n", "workers", "suite ms", "worst ms", "speedup", "guesses",
+        "count ms", "speedup", "guesses");
+    for (int workers = 1; workers <= max_workers; workers *= 2) {
+        work_pool *pool = create_work_pool(workers);
+
+        double suite = 0;
+        double worst = 0;
+        long suite_guesses = 0;
+        for (int i = 0; i < PARALLEL_SUITE_N; ++i) {
+            kenken_puzzle puzzle;
+            char cages[CELLS_MAX + 1];
+            cage_clue clues[CAGE_NAME_N];
+            parse_puzzle(PARALLEL_SUITE[i], &puzzle, cages, clues);
+            unsigned char solution[CELLS_MAX];
+            solver_stats stats;
+            int64 start = cvGetTickCount();
+            int solved = solve_puzzle_parallel(&puzzle, solution, &stats, pool);
+            double us = _microseconds(cvGetTickCount() - start);
+            suite += us;
+            worst = (us > worst) ? us : worst;
+            suite_guesses += stats.nodes;
+            failures += (solved != 1) || ! check_solution(&puzzle, solution);
+            failures += us > PARALLEL_WORST_MS * 1000.0;
+        }
+
+        kenken_puzzle puzzle;
+        char cages[CELLS_MAX + 1];
+        cage_clue clues[CAGE_NAME_N];
+        parse_puzzle(ONE_CAGE, &puzzle, cages, clues);
+        solver_stats stats;
+        int64 start = cvGetTickCount();
+        long count = count_solutions_parallel(&puzzle, COUNT_LIMIT, &stats, pool);
+        double counting = _microseconds(cvGetTickCount() - start);
+        failures += (count != COUNT_LIMIT);
+
+        first_suite = (workers == 1) ? suite : first_suite;
+        first_count = (workers == 1) ? counting : first_count;
+        printf("%7d %10.1f %10.1f %8.2f %8ld %10.1f %8.2f %8ld\n", work_pool_workers(pool), suite / 1000, worst / 1000,
+            first_suite / suite, suite_guesses, counting / 1000, first_count / counting, stats.nodes);
+        release_work_pool(&pool);
+    }
+    printf("(%d puzzles in the suite, each in at most %dms; counting to %d; %ld cores)\n", PARALLEL_SUITE_N,
+        PARALLEL_WORST_MS, COUNT_LIMIT, sysconf(_SC_NPROCESSORS_ONLN));
+    return failures;
+}
+
+static void _usage(void) {
+    fprintf(stderr, "usage: ./bench_solver [ -n puzzles ] [ -w max_workers ]\n");
+    exit(255);
+}
+
+int main (int argc, char** argv) {
+    int puzzles = 200;
+    int max_workers = 16;
+    for (int i = 1; i < argc; i += 2) {
+        if ((i + 1 < argc) && (strcmp(argv[i], "-n") == 0)) {
+            puzzles = atoi(argv[i + 1]);
+        } else if ((i + 1 < argc) && (strcmp(argv[i], "-w") == 0)) {
+            max_workers = atoi(argv[i + 1]);
+        } else {
+            _usage();
+        }
+    }
+    if ((puzzles < 1) || (max_workers < 1)) {
+        _usage();
+    }
+
+    int failures = 0;
+    printf("%-8s %4s %10s %10s %12s %13s %8s\n", "suite", "size", "mean us", "worst us", "mean guesses",
+        "worst guesses", "failed");
+    for (int s = 0; s < SUITE_N; ++s) {
+        for (int size = CAGES_SIZE_MIN; size <= CAGES_SIZE_MAX; ++size) {
+            double total = 0;
+            double worst = 0;
+            long guesses = 0;
+            long worst_guesses = 0;
+            int failed = 0;
+            for (int n = 0; n < puzzles; ++n) {
+                kenken_puzzle puzzle;
+                char cages[CELLS_MAX + 1];
+                cage_clue clues[CAGE_NAME_N];
+                while (! _puzzle(&SUITES[s], size, &puzzle, cages, clues)) {
+                }
+
+                unsigned char solution[CELLS_MAX];
+                solver_stats stats;
+                int64 start = cvGetTickCount();
+                int solved = solve_puzzle(&puzzle, solution, &stats);
+                double us = _microseconds(cvGetTickCount() - start);
+
+                total += us;
+                worst = (us > worst) ? us : worst;
+                guesses += stats.nodes;
+                worst_guesses = (stats.nodes > worst_guesses) ? stats.nodes : worst_guesses;
+                failed += (solved != 1) || ! check_solution(&puzzle, solution)
+                    || ((SUITES[s].worst_us > 0) && (us > SUITES[s].worst_us));
+            }
+            printf("%-8s %4d %10.2f %10.2f %12.1f %13ld %8d\n", SUITES[s].name, size, total / puzzles, worst,
+                (double)guesses / puzzles, worst_guesses, failed);
+            failures += failed;
+        }
+    }
+    printf("(%d puzzles per suite and size)\n", puzzles);
+
+    failures += _parallel(max_workers);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+
+#include "cv.h"
+#include "highgui.h"
+#include "pixels.h"
+#include "threshold.h"
+
+// Compares the fused threshold kernel with the cvCvtColor + mean scan + cvAdaptiveThreshold path
+// it replaces, image by image. Exits non-zero if they differ anywhere: THRESHOLD_FUSED is only to
+// become the default once they don't.
+//
+// usage: ./bench_threshold [ -n repetitions ] image...
+
+static double _milliseconds(int64 ticks) {
+    return ticks / (cvGetTickFrequency() * 1000.);
+}
+
+static int _block_size(IplImage *in) {
+    int block_size = (int)(in->width / 9);
+    if ((block_size % 2) == 0) {
+        block_size += 1;
+    }
+    return block_size;
+}
+
+static void _opencv_path(IplImage *in, IplImage *out) {
+    IplImage *img = cvCreateImage(cvGetSize(in), 8, 1);
+    cvCvtColor(in, img, CV_BGR2GRAY);
+
+    unsigned long total = sum_region(img, cvRect(0, 0, img->width, img->height));
+    int mean_intensity = (int)(total / (img->width * img->height));
+
+    cvAdaptiveThreshold(img, out, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV,
+        _block_size(in), (int)(mean_intensity / 3.6 + 0.5));
+    cvReleaseImage(&img);
+}
+
+static void _fused_path(IplImage *in, IplImage *out) {
+    int mean_intensity = threshold_offsets((unsigned char *)in->imageData, in->widthStep, in->nChannels,
+        in->width, in->height, _block_size(in), (signed char *)out->imageData, out->widthStep);
+    threshold_apply((unsigned char *)out->imageData, out->widthStep, out->width, out->height,
+        (int)(mean_intensity / 3.6 + 0.5));
+}
+
+int main (int argc, char** argv) {
+    int repetitions = 5;
+    int first_image = 1;
+    if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+        repetitions = atoi(argv[2]);
+        first_image = 3;
+    }
+    if ((first_image >= argc) || (repetitions < 1)) {
+        fprintf(stderr, "usage: ./bench_threshold [ -n repetitions ] image...\n");
+        exit(255);
+    }
+
+    printf("%-24s %11s %11s %8s %10s\n", "image", "opencv ms", "fused ms", "speedup", "differing");
+
+    double opencv_total = 0;
+    double fused_total  = 0;
+    long differing_total = 0;
+    for (int i = first_image; i < argc; ++i) {
+        IplImage *in = cvLoadImage(argv[i], 1);
+        if (in == NULL) {
+            fprintf(stderr, "%s: could not load\n", argv[i]);
+            continue;
+        }
+        IplImage *opencv_out = cvCreateImage(cvGetSize(in), 8, 1);
+        IplImage *fused_out  = cvCreateImage(cvGetSize(in), 8, 1);
+
+        // best of n, to keep the noise down.
+        double opencv_ms = INFINITY;
+        double fused_ms  = INFINITY;
+        for (int r = 0; r < repetitions; ++r) {
+            int64 start = cvGetTickCount();
+            _opencv_path(in, opencv_out);
+            double ms = _milliseconds(cvGetTickCount() - start);
+            opencv_ms = (ms < opencv_ms) ? ms : opencv_ms;
+
+            start = cvGetTickCount();
+            _fused_path(in, fused_out);
+            ms = _milliseconds(cvGetTickCount() - start);
+            fused_ms = (ms < fused_ms) ? ms : fused_ms;
+        }
+
+        long differing = 0;
+        for (int y = 0; y < in->height; ++y) {
+            const unsigned char *a = (unsigned char *)opencv_out->imageData + y * opencv_out->widthStep;
+            const unsigned char *b = (unsigned char *)fused_out->imageData + y * fused_out->widthStep;
+            for (int x = 0; x < in->width; ++x) {
+                differing += (a[x] != b[x]);
+            }
+        }
+
+        printf("%-24s %11.2f %11.2f %7.1fx %10ld\n", argv[i], opencv_ms, fused_ms, opencv_ms / fused_ms, differing);
+        opencv_total += opencv_ms;
+        differing_total += differing;
+        fused_total  += fused_ms;
+
+        cvReleaseImage(&opencv_out);
+        cvReleaseImage(&fused_out);
+        cvReleaseImage(&in);
+    }
+
+    printf("%-24s %11.2f %11.2f %7.1fx %10ld\n", "total", opencv_total, fused_total, opencv_total / fused_total,
+        differing_total);
+
+    return differing_total ? 1 : 0;
+}
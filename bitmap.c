@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+bitmap *create_bitmap(int width, int height) {
+    bitmap *b = malloc(sizeof(bitmap));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->width         = width;
+    b->height        = height;
+    b->words_per_row = (width + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    b->bits          = calloc((size_t)height * b->words_per_row, sizeof(bitmap_word));
+    if (b->bits == NULL) {
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+void release_bitmap(bitmap **b) {
+    if ((b == NULL) || (*b == NULL)) {
+        return;
+    }
+    free((*b)->bits);
+    free(*b);
+    *b = NULL;
+}
+
+void pack_bitmap(bitmap *b, const unsigned char *pixels, int step) {
+    for (int y = 0; y < b->height; ++y) {
+        const unsigned char *in = pixels + (size_t)y * step;
+        bitmap_word *out = bitmap_row(b, y);
+        memset(out, 0, b->words_per_row * sizeof(bitmap_word));
+        int x = 0;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        // 8 pixels at a time: flag the bytes which are nonzero, then gather the flags (as denoise
+        // does for bytes which are 255).
+        for (; x + 8 <= b->width; x += 8) {
+            uint64_t v;
+            memcpy(&v, in + x, sizeof(v));
+            uint64_t set = (((v & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | v) & 0x8080808080808080ULL;
+            out[x / BITMAP_WORD_BITS] |= (((set >> 7) * 0x0102040810204080ULL) >> 56) << (x % BITMAP_WORD_BITS);
+        }
+#endif
+        for (; x < b->width; ++x) {
+            out[x / BITMAP_WORD_BITS] |= (bitmap_word)(in[x] != 0) << (x % BITMAP_WORD_BITS);
+        }
+    }
+}
+
+void unpack_bitmap(const bitmap *b, unsigned char *pixels, int step, int channels) {
+    for (int y = 0; y < b->height; ++y) {
+        const bitmap_word *in = bitmap_row(b, y);
+        unsigned char *out    = pixels + (size_t)y * step;
+        for (int x = 0; x < b->width; ++x) {
+            memset(out + x * channels, ((in[x / BITMAP_WORD_BITS] >> (x % BITMAP_WORD_BITS)) & 1) ? 255 : 0, channels);
+        }
+    }
+}
+
+// the bits of a word for columns [x0, x1) of it (0 <= x0 < x1 <= BITMAP_WORD_BITS).
+static bitmap_word _span(int x0, int x1) {
+    bitmap_word upto = (x1 == BITMAP_WORD_BITS) ? ~(bitmap_word)0 : (((bitmap_word)1 << x1) - 1);
+    return upto & ~(((bitmap_word)1 << x0) - 1);
+}
+
+unsigned long bitmap_count(const bitmap *b, int x0, int y0, int x1, int y1) {
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+    x1 = (x1 > b->width) ? b->width : x1;
+    y1 = (y1 > b->height) ? b->height : y1;
+    if ((x1 <= x0) || (y1 <= y0)) {
+        return 0;
+    }
+
+    int first = x0 / BITMAP_WORD_BITS;
+    int last  = (x1 - 1) / BITMAP_WORD_BITS;
+    bitmap_word first_mask = _span(x0 % BITMAP_WORD_BITS, (first == last) ? (x1 - first * BITMAP_WORD_BITS) : BITMAP_WORD_BITS);
+    bitmap_word last_mask  = _span(0, x1 - last * BITMAP_WORD_BITS);
+
+    unsigned long total = 0;
+    for (int y = y0; y < y1; ++y) {
+        const bitmap_word *row = bitmap_row(b, y);
+        if (first == last) {
+            total += __builtin_popcountll(row[first] & first_mask);
+            continue;
+        }
+        total += __builtin_popcountll(row[first] & first_mask);
+        for (int i = first + 1; i < last; ++i) {
+            total += __builtin_popcountll(row[i]);
+        }
+        total += __builtin_popcountll(row[last] & last_mask);
+    }
+    return total;
+}
+
+void bitmap_column_counts(const bitmap *b, unsigned long *counts) {
+    memset(counts, 0, b->width * sizeof(unsigned long));
+    for (int y = 0; y < b->height; ++y) {
+        const bitmap_word *row = bitmap_row(b, y);
+        for (int i = 0; i < b->words_per_row; ++i) {
+            for (bitmap_word w = row[i]; w; w &= w - 1) {
+                ++counts[i * BITMAP_WORD_BITS + __builtin_ctzll(w)];
+            }
+        }
+    }
+}
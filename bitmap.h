@@ -0,0 +1,48 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A binary image packed one bit per pixel, an eighth of the size of the 0/255 8-bit image it
+// stands for (which is usually still needed, briefly, to make it): pixel x of row y is bit
+// (x % 64) of word (x / 64) of the row. Rows start on a word boundary, and the bits past width in
+// the last word of a row are always clear.
+typedef uint64_t bitmap_word;
+
+enum { BITMAP_WORD_BITS = 64 };
+
+typedef struct {
+    int          width;
+    int          height;
+    int          words_per_row;
+    bitmap_word *bits;
+} bitmap;
+
+// all clear (NULL if out of memory).
+bitmap *create_bitmap(int width, int height);
+void release_bitmap(bitmap **b);
+
+static inline bitmap_word *bitmap_row(const bitmap *b, int y) {
+    return b->bits + (size_t)y * b->words_per_row;
+}
+
+static inline int bitmap_get(const bitmap *b, int x, int y) {
+    return (bitmap_row(b, y)[x / BITMAP_WORD_BITS] >> (x % BITMAP_WORD_BITS)) & 1;
+}
+
+// Sets the pixels which are nonzero in the 8-bit image pixels (b's size, step bytes per row) and
+// clears the rest.
+void pack_bitmap(bitmap *b, const unsigned char *pixels, int step);
+
+// Writes b out as an 8-bit image with channels interleaved channels: 255 in every channel of a
+// set pixel, 0 in every channel of a clear one.
+void unpack_bitmap(const bitmap *b, unsigned char *pixels, int step, int channels);
+
+// set pixels in columns [x0, x1) and rows [y0, y1), clipped to the bitmap.
+unsigned long bitmap_count(const bitmap *b, int x0, int y0, int x1, int y1);
+
+// counts[x] gets the number of set pixels in column x, for each of b's columns.
+void bitmap_column_counts(const bitmap *b, unsigned long *counts);
+
+#endif /* _BITMAP_H */
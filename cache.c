@@ -0,0 +1,322 @@
+// for mmap, ftruncate and fcntl locks
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+// the hash is of the image shrunk to (HASH_SIDE + 1) x HASH_SIDE gray pixels: bit i is whether
+// pixel i is brighter than the one to its right.
+enum { HASH_SIDE = 16 };
+// the same photo at another size has (about) the same shape; these are how far apart the aspect
+// ratios of two photos can be, as a fraction, and still be the same.
+#define ASPECT_TOLERANCE 0.01
+
+// a backing file which doesn't start with these (or whose entries are of another capacity or
+// size) is started over rather than read.
+enum { CACHE_MAGIC = 0x6b6b6361 };
+enum { CACHE_VERSION = 2 };
+
+const cache_options DEFAULT_CACHE_OPTIONS = { 1024, NULL, 8, DEFAULT_PUZZLE_OPTIONS_INITIALIZER };
+
+// the puzzle_options which change what the analysis makes of a photo, as an entry keeps them.
+enum { ANALYSIS_FIELDS = 6 };
+
+// The header and entries are laid out the same in memory and in the file, with fixed-size
+// fields. The entries in use are the first count, in a list from the most recently used (head)
+// to the least (tail).
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t entry_size;
+    int32_t  head;
+    int32_t  tail;
+    uint32_t count;
+    uint32_t reserved;
+} cache_header;
+
+typedef struct {
+    uint64_t hash[4];
+    int32_t  analysis[ANALYSIS_FIELDS];
+    float    aspect;
+    float    cost_ms;
+    // neighbours in the list (-1 at the ends)
+    int32_t  newer;
+    int32_t  older;
+    // the corners as fractions of the photo's width and height
+    float    location[8];
+    int32_t  size;
+    uint8_t  found;
+    char     cages[CAGES_SIZE_MAX * CAGES_SIZE_MAX + 1];
+} cache_entry;
+
+struct result_cache_s {
+    cache_options   options;
+    // options.analysis, as its entries keep it
+    int32_t         analysis[ANALYSIS_FIELDS];
+    pthread_mutex_t lock;
+    // the header, followed by the entries: mapped from file if there is one, otherwise allocated.
+    void           *memory;
+    size_t          length;
+    int             file;
+    cache_header   *header;
+    cache_entry    *entries;
+    cache_counters  counters;
+};
+
+// whether the header and the list look like a cache of this capacity: a file another build wrote
+// (or which was cut short) is started over.
+static int _valid(const result_cache *cache) {
+    const cache_header *header = cache->header;
+    const int32_t count = (int32_t)header->count;
+    if ((header->magic != CACHE_MAGIC) || (header->version != CACHE_VERSION) ||
+        (header->capacity != (uint32_t)cache->options.capacity) || (header->entry_size != sizeof(cache_entry)) ||
+        (header->count > header->capacity)) {
+        return 0;
+    }
+    int32_t i = header->head;
+    int32_t newer = -1;
+    for (int32_t n = 0; n < count; ++n) {
+        if ((i < 0) || (i >= count) || (cache->entries[i].newer != newer)) {
+            return 0;
+        }
+        newer = i;
+        i = cache->entries[i].older;
+    }
+    return (i == -1) && (header->tail == newer);
+}
+
+static void _reset(result_cache *cache) {
+    cache_header *header = cache->header;
+    memset(header, 0, sizeof(cache_header));
+    header->magic      = CACHE_MAGIC;
+    header->version    = CACHE_VERSION;
+    header->capacity   = (uint32_t)cache->options.capacity;
+    header->entry_size = sizeof(cache_entry);
+    header->head       = -1;
+    header->tail       = -1;
+}
+
+static void _analysis_fields(const puzzle_options *options, int32_t *fields) {
+    fields[0] = options->threshold;
+    fields[1] = options->size_estimator;
+    fields[2] = options->locate;
+    fields[3] = options->pyramid_width;
+    fields[4] = options->corners;
+    fields[5] = options->canonical_cell_size;
+}
+
+// maps the backing file (of length bytes); NULL if it can't be had, or another process has it.
+static void *_map(result_cache *cache) {
+    cache->file = open(cache->options.path, O_RDWR | O_CREAT, 0644);
+    if (cache->file < 0) {
+        return NULL;
+    }
+    struct flock whole;
+    memset(&whole, 0, sizeof(whole));
+    whole.l_type   = F_WRLCK;
+    whole.l_whence = SEEK_SET;
+    if ((fcntl(cache->file, F_SETLK, &whole) != 0) || (ftruncate(cache->file, (off_t)cache->length) != 0)) {
+        return NULL;
+    }
+    void *memory = mmap(NULL, cache->length, PROT_READ | PROT_WRITE, MAP_SHARED, cache->file, 0);
+    return (memory == MAP_FAILED) ? NULL : memory;
+}
+
+result_cache *create_result_cache(const cache_options *options) {
+    result_cache *cache = calloc(1, sizeof(result_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->options = options ? *options : DEFAULT_CACHE_OPTIONS;
+    cache->file    = -1;
+    _analysis_fields(&(cache->options.analysis), cache->analysis);
+    pthread_mutex_init(&(cache->lock), NULL);
+    if (cache->options.capacity < 1) {
+        release_result_cache(&cache);
+        return NULL;
+    }
+
+    cache->length = sizeof(cache_header) + (size_t)cache->options.capacity * sizeof(cache_entry);
+    cache->memory = cache->options.path ? _map(cache) : malloc(cache->length);
+    if (cache->memory == NULL) {
+        release_result_cache(&cache);
+        return NULL;
+    }
+    cache->header  = cache->memory;
+    cache->entries = (cache_entry *)(cache->header + 1);
+    if ((cache->options.path == NULL) || (! _valid(cache))) {
+        _reset(cache);
+    }
+    return cache;
+}
+
+void release_result_cache(result_cache **cache) {
+    if ((cache == NULL) || (*cache == NULL)) {
+        return;
+    }
+    result_cache *c = *cache;
+    if (c->file >= 0) {
+        if (c->memory != NULL) {
+            munmap(c->memory, c->length);
+        }
+        // (which lets go of the lock)
+        close(c->file);
+    } else {
+        free(c->memory);
+    }
+    pthread_mutex_destroy(&(c->lock));
+    free(c);
+    *cache = NULL;
+}
+
+image_hash hash_image(const IplImage *image) {
+    // small enough to live on the stack
+    unsigned char shrunk_data[HASH_SIDE * (HASH_SIDE + 1) * 3];
+    unsigned char gray_data[HASH_SIDE * (HASH_SIDE + 1)];
+    CvMat shrunk;
+    CvMat gray;
+    cvInitMatHeader(&gray, HASH_SIDE, HASH_SIDE + 1, CV_8UC1, gray_data, HASH_SIDE + 1);
+    if (image->nChannels == 3) {
+        cvInitMatHeader(&shrunk, HASH_SIDE, HASH_SIDE + 1, CV_8UC3, shrunk_data, 3 * (HASH_SIDE + 1));
+        cvResize(image, &shrunk, CV_INTER_AREA);
+        cvCvtColor(&shrunk, &gray, CV_BGR2GRAY);
+    } else {
+        cvResize(image, &gray, CV_INTER_AREA);
+    }
+
+    image_hash hash;
+    memset(&hash, 0, sizeof(hash));
+    for (int y = 0; y < HASH_SIDE; ++y) {
+        const unsigned char *row = gray_data + y * (HASH_SIDE + 1);
+        for (int x = 0; x < HASH_SIDE; ++x) {
+            int i = y * HASH_SIDE + x;
+            hash.bits[i / 64] |= (uint64_t)(row[x] > row[x + 1]) << (i % 64);
+        }
+    }
+    return hash;
+}
+
+static int _distance(const uint64_t *a, const uint64_t *b) {
+    int distance = 0;
+    for (int i = 0; i < 4; ++i) {
+        distance += __builtin_popcountll(a[i] ^ b[i]);
+    }
+    return distance;
+}
+
+static void _unlink(result_cache *cache, int32_t i) {
+    cache_entry *entry = &(cache->entries[i]);
+    if (entry->newer >= 0) {
+        cache->entries[entry->newer].older = entry->older;
+    } else {
+        cache->header->head = entry->older;
+    }
+    if (entry->older >= 0) {
+        cache->entries[entry->older].newer = entry->newer;
+    } else {
+        cache->header->tail = entry->newer;
+    }
+}
+
+static void _link_first(result_cache *cache, int32_t i) {
+    cache_entry *entry = &(cache->entries[i]);
+    entry->newer = -1;
+    entry->older = cache->header->head;
+    if (entry->older >= 0) {
+        cache->entries[entry->older].newer = i;
+    } else {
+        cache->header->tail = i;
+    }
+    cache->header->head = i;
+}
+
+// the closest entry of about this aspect within max_distance of hash, and made with the cache's
+// options, or -1 if there's none.
+static int32_t _find(const result_cache *cache, const image_hash *hash, double aspect, int max_distance) {
+    int32_t found = -1;
+    int best = max_distance + 1;
+    for (int32_t i = 0; i < (int32_t)cache->header->count; ++i) {
+        const cache_entry *entry = &(cache->entries[i]);
+        if ((fabs(entry->aspect - aspect) > ASPECT_TOLERANCE * aspect) ||
+            (memcmp(entry->analysis, cache->analysis, sizeof(entry->analysis)) != 0)) {
+            continue;
+        }
+        int distance = _distance(entry->hash, hash->bits);
+        if (distance < best) {
+            found = i;
+            best  = distance;
+        }
+    }
+    return found;
+}
+
+int result_cache_lookup(result_cache *cache, image_hash hash, int width, int height, cached_analysis *analysis) {
+    pthread_mutex_lock(&(cache->lock));
+    ++cache->counters.lookups;
+    int32_t i = _find(cache, &hash, (double)width / height, cache->options.max_distance);
+    if (i >= 0) {
+        const cache_entry *entry = &(cache->entries[i]);
+        ++cache->counters.hits;
+        cache->counters.saved_ms += entry->cost_ms;
+        _unlink(cache, i);
+        _link_first(cache, i);
+
+        memset(analysis, 0, sizeof(cached_analysis));
+        analysis->found = entry->found;
+        for (int c = 0; c < 4; ++c) {
+            analysis->location[c] = cvPoint2D32f(entry->location[2 * c] * width, entry->location[2 * c + 1] * height);
+        }
+        analysis->size = entry->size;
+        memcpy(analysis->cages, entry->cages, sizeof(analysis->cages));
+    }
+    pthread_mutex_unlock(&(cache->lock));
+    return i >= 0;
+}
+
+void result_cache_store(result_cache *cache, image_hash hash, int width, int height, const cached_analysis *analysis,
+        double cost_ms) {
+    pthread_mutex_lock(&(cache->lock));
+    // the same photo again replaces what was kept of it; otherwise the next free entry, or the least
+    // recently used.
+    double aspect = (double)width / height;
+    int32_t i = _find(cache, &hash, aspect, 0);
+    if (i >= 0) {
+        _unlink(cache, i);
+    } else if (cache->header->count < cache->header->capacity) {
+        i = (int32_t)cache->header->count++;
+    } else {
+        i = cache->header->tail;
+        _unlink(cache, i);
+    }
+
+    cache_entry *entry = &(cache->entries[i]);
+    memcpy(entry->hash, hash.bits, sizeof(entry->hash));
+    memcpy(entry->analysis, cache->analysis, sizeof(entry->analysis));
+    entry->aspect  = (float)aspect;
+    entry->cost_ms = (float)cost_ms;
+    entry->found   = (uint8_t)(analysis->found != 0);
+    for (int c = 0; c < 4; ++c) {
+        entry->location[2 * c]     = analysis->location[c].x / width;
+        entry->location[2 * c + 1] = analysis->location[c].y / height;
+    }
+    entry->size = analysis->size;
+    memcpy(entry->cages, analysis->cages, sizeof(entry->cages));
+    entry->cages[sizeof(entry->cages) - 1] = 0;
+    _link_first(cache, i);
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+cache_counters result_cache_counters(result_cache *cache) {
+    pthread_mutex_lock(&(cache->lock));
+    cache_counters counters = cache->counters;
+    pthread_mutex_unlock(&(cache->lock));
+    return counters;
+}
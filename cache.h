@@ -0,0 +1,82 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdint.h>
+
+#include "cv.h"
+#include "cages.h"
+#include "kenken.h"
+
+// Remembers what the analysis made of photos, so that the same puzzle photographed (or uploaded)
+// again doesn't go through it again. Photos are keyed on a perceptual hash of the photo shrunk to
+// a few hundred gray pixels, which a re-encode, a resize or a little noise barely changes: two
+// photos of the same shape whose hashes differ in few enough bits are taken to be the same. The
+// corners are kept as fractions of the photo's width and height, so they carry over to a copy at
+// another size.
+//
+// The cache holds a bounded number of results, dropping the least recently used to make room. It
+// lives in memory, or in a file mapped into memory, which keeps it across restarts (one process
+// at a time: the file is locked while it's open). Safe to share between threads.
+//
+// What the analysis makes of a photo depends on its puzzle_options, so every result is kept with
+// the options it was made with, and only looked up by a cache opened with the same ones. Caches of
+// different options can share a file, each seeing only its own results.
+
+typedef struct result_cache_s result_cache;
+
+typedef struct {
+    // results kept, at most.
+    int             capacity;
+    // the backing file (created if need be, and started over if it isn't a cache of this
+    // capacity); NULL keeps the cache in memory only.
+    const char     *path;
+    // photos whose hashes differ in at most this many of their 256 bits are the same photo.
+    int             max_distance;
+    // the options the results stored are made with (the pool aside, which doesn't change them).
+    puzzle_options  analysis;
+} cache_options;
+
+extern const cache_options DEFAULT_CACHE_OPTIONS;
+
+typedef struct {
+    uint64_t bits[4];
+} image_hash;
+
+typedef struct {
+    // whether there was a puzzle in the photo; the rest are only set if so.
+    unsigned short found;
+    CvPoint2D32f   location[4];
+    puzzle_size    size;
+    // empty if the cages couldn't be worked out.
+    char           cages[CAGES_SIZE_MAX * CAGES_SIZE_MAX + 1];
+} cached_analysis;
+
+typedef struct {
+    long   lookups;
+    long   hits;
+    // what the analysis of the photos which hit took when they were stored.
+    double saved_ms;
+} cache_counters;
+
+// options may be NULL, meaning DEFAULT_CACHE_OPTIONS. NULL if the memory (or the backing file)
+// can't be had.
+result_cache *create_result_cache(const cache_options *options);
+void release_result_cache(result_cache **cache);
+
+// The hash of an 8-bit, gray or BGR image. The image may be the photo at any scale.
+image_hash hash_image(const IplImage *image);
+
+// Looks for a photo of width x height (at the scale its locations are wanted at) with about this
+// hash. 1 if there is one, with its analysis in analysis (the location scaled to width x height);
+// 0 otherwise.
+int result_cache_lookup(result_cache *cache, image_hash hash, int width, int height, cached_analysis *analysis);
+
+// Keeps the analysis of a width x height photo (its location at that scale), which took cost_ms
+// to work out.
+void result_cache_store(result_cache *cache, image_hash hash, int width, int height, const cached_analysis *analysis,
+    double cost_ms);
+
+// the counters since the cache was created.
+cache_counters result_cache_counters(result_cache *cache);
+
+#endif /* _CACHE_H */
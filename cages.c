@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cages.h"
+
+// the boxes of one puzzle row (or column) as a bitboard: bit x is box x.
+typedef uint16_t cage_row;
+
+static const char CAGE_NAMES[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+enum { CAGE_NAME_N = sizeof(CAGE_NAMES) - 1 };
+
+// The sample on the line after box `across` (of the size - 1 lines crossing a row or column),
+// in box `along` of the other direction. On a vertical line, across runs along x and along
+// down y; on a horizontal line the other way round.
+static cage_sample _sample(int px_size, int size, int vertical, int across, int along) {
+    // fuzz observations: the boxes are a little longer along the line than across it, so that a
+    //   line which isn't quite straight still runs through them.
+    int fuzz_along  = px_size / (size * 3.9);
+    int fuzz_across = px_size / (size * 4.0);
+
+    int across_center = (across + 1) * (px_size / size);
+    int along_center  = (2 * along + 1) * (px_size / size / 2);
+
+    cage_sample s = {
+        across_center - fuzz_across, along_center - fuzz_along,
+        across_center + fuzz_across, along_center + fuzz_along
+    };
+    if (! vertical) {
+        s = (cage_sample){ s.y0, s.x0, s.y1, s.x1 };
+    }
+    return s;
+}
+
+int cage_samples(int px_size, int size, cage_sample *samples) {
+    int n = 0;
+    for (int vertical = 1; vertical >= 0; --vertical) {
+        for (int along = 0; along < size; ++along) {
+            for (int across = 0; across < size - 1; ++across) {
+                samples[n++] = _sample(px_size, size, vertical, across, along);
+            }
+        }
+    }
+    return n;
+}
+
+// For the lines running one way, which can be crossed: bit across of open[along] is set if the
+// line after box across (in box along of the other direction) is an ordinary edge rather than a
+// cage border. A line is a border if its sample is closer to the heaviest sample than to the
+// lightest.
+static void _open_lines(const bitmap *grid, int size, int vertical, cage_row *open) {
+    const int px_size = grid->height;
+    int means[CAGES_SIZE_MAX][CAGES_SIZE_MAX - 1];
+    int mean_min = -1;
+    int mean_max = -1;
+    for (int along = 0; along < size; ++along) {
+        for (int across = 0; across < size - 1; ++across) {
+            cage_sample s = _sample(px_size, size, vertical, across, along);
+            long total    = 255 * bitmap_count(grid, s.x0, s.y0, s.x1 + 1, s.y1 + 1);
+            int mean      = total / ((s.x1 - s.x0 + 1) * (s.y1 - s.y0 + 1));
+
+            means[along][across] = mean;
+            mean_min = ((mean_min == -1) || (mean < mean_min)) ? mean : mean_min;
+            mean_max = ((mean_max == -1) || (mean > mean_max)) ? mean : mean_max;
+        }
+    }
+
+    for (int along = 0; along < size; ++along) {
+        open[along] = 0;
+        for (int across = 0; across < size - 1; ++across) {
+            int border = abs(means[along][across] - mean_max) < abs(means[along][across] - mean_min);
+            open[along] |= (cage_row)(! border) << across;
+        }
+    }
+}
+
+// Grows cage (one bitboard per puzzle row) across every open line it touches, until it stops
+// growing: open_right[y] says which boxes of row y connect to their right-hand neighbour,
+// open_down[x] which boxes of column x connect to the one below.
+static void _flood(int size, cage_row *cage, const cage_row *open_right, const cage_row *open_down) {
+    // open_down, turned into rows: bit x of down[y] connects box (x, y) to (x, y + 1).
+    cage_row down[CAGES_SIZE_MAX];
+    for (int y = 0; y < size; ++y) {
+        down[y] = 0;
+        for (int x = 0; x < size; ++x) {
+            down[y] |= (cage_row)((open_down[x] >> y) & 1) << x;
+        }
+    }
+
+    int grown;
+    do {
+        grown = 0;
+        for (int y = 0; y < size; ++y) {
+            cage_row row = cage[y];
+            row |= ((row & open_right[y]) << 1) | ((row >> 1) & open_right[y]);
+            if (y > 0) {
+                row |= cage[y - 1] & down[y - 1];
+            }
+            if (y + 1 < size) {
+                row |= cage[y + 1] & down[y];
+            }
+            if (row != cage[y]) {
+                cage[y] = row;
+                grown   = 1;
+            }
+        }
+    } while (grown);
+}
+
+int find_cages(const bitmap *grid, int size, char *cages) {
+    if ((size < CAGES_SIZE_MIN) || (size > CAGES_SIZE_MAX)) {
+        return 0;
+    }
+
+    cage_row open_right[CAGES_SIZE_MAX];
+    cage_row open_down[CAGES_SIZE_MAX];
+    _open_lines(grid, size, 1, open_right);
+    _open_lines(grid, size, 0, open_down);
+
+    // a new cage starts at the first box (in reading order) not yet in one.
+    cage_row unlabelled[CAGES_SIZE_MAX];
+    for (int y = 0; y < size; ++y) {
+        unlabelled[y] = (cage_row)((1 << size) - 1);
+    }
+    int next_cage = 0;
+    for (int y = 0; y < size; ++y) {
+        while (unlabelled[y]) {
+            cage_row cage[CAGES_SIZE_MAX] = { 0 };
+            cage[y] = unlabelled[y] & -unlabelled[y];
+            _flood(size, cage, open_right, open_down);
+
+            for (int row = y; row < size; ++row) {
+                for (cage_row boxes = cage[row]; boxes; boxes &= boxes - 1) {
+                    // (a 9x9 could in principle have more cages than there are names)
+                    cages[row * size + __builtin_ctz(boxes)] = (next_cage < CAGE_NAME_N) ? CAGE_NAMES[next_cage] : '?';
+                }
+                unlabelled[row] &= ~cage[row];
+            }
+            ++next_cage;
+        }
+    }
+    cages[size * size] = 0;
+    return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef _CAGES_H
+#define _CAGES_H
+
+#include "bitmap.h"
+
+// Cage detection on the grid image (ink set) of a squared-up puzzle of size x size boxes.
+//
+// Every line between two neighbouring boxes is sampled for ink around its middle: a cage border
+// is drawn thicker than an ordinary edge, so the samples split into heavy and light ones. The
+// boxes are then labelled as cages by flooding across the light lines, a puzzle row at a time as
+// bitboards.
+
+enum { CAGES_SIZE_MIN = 3 };
+enum { CAGES_SIZE_MAX = 9 };
+
+// the most samples any size takes (see cage_samples).
+enum { CAGE_SAMPLES_MAX = 2 * CAGES_SIZE_MAX * (CAGES_SIZE_MAX - 1) };
+
+// a box of pixels, columns [x0, x1] and rows [y0, y1] (inclusive).
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} cage_sample;
+
+// The boxes sampled in a px_size square grid image: first those on the vertical lines (row by
+// row of the puzzle, left to right), then those on the horizontal ones (column by column, top to
+// bottom). Returns how many were written to samples, which needs room for CAGE_SAMPLES_MAX.
+int cage_samples(int px_size, int size, cage_sample *samples);
+
+// Writes the cage layout found in grid (which must be square) to cages: size * size cage names,
+// box by box in reading order, then a NUL. Cages are named A, B, C, ... in order of their first
+// box. Returns 0 (writing nothing) if there is no puzzle of that size.
+int find_cages(const bitmap *grid, int size, char *cages);
+
+#endif /* _CAGES_H */
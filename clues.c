@@ -0,0 +1,861 @@
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clues.h"
+
+// characters are compared at GLYPH_WIDTH x GLYPH_HEIGHT pixels, a row to 16 bits, so that four
+// rows make a word.
+enum { GLYPH_WIDTH = 12 };
+enum { GLYPH_HEIGHT = 16 };
+enum { GLYPH_WORDS = GLYPH_HEIGHT / 4 };
+
+// the clue corner of a box, as fractions of the box's side.
+#define CORNER_WIDTH  0.9
+#define CORNER_HEIGHT 0.55
+// each line of a box is looked for this fraction of a side either way of where it should be.
+#define LINE_SEARCH   0.25
+// blobs of ink longer than this fraction of a side are lines, not print.
+#define PRINT_MAX     0.35
+// a character wider than this fraction of the height of the line of text is two, blurred together.
+#define SPLIT_WIDTH   1.0
+
+// a corner with less contrast than this between its paper and its ink is blank.
+enum { CONTRAST_MIN = 20 };
+// a corner with more blobs of ink than this is too noisy to read.
+enum { BLOBS_MAX = 64 };
+
+// The weights of the differences in shape (width over height) and in height (over the height of
+// the line of text) against the bits a character differs from a template in; a character which
+// differs from every template it might be by more than GLYPH_DISTANCE_MAX is unreadable.
+#define ASPECT_WEIGHT      16
+#define HEIGHT_WEIGHT      24
+#define GLYPH_DISTANCE_MAX 1000
+
+typedef struct {
+    char        symbol;
+    float       aspect;
+    float       height;
+    const char *rows[GLYPH_HEIGHT];
+} glyph_template;
+
+// each character as the even-numbered test photos print it, the average of (after it) that many of
+// them; the odd-numbered ones are held out, to see how well the templates do on photos they
+// weren't made from (see test_locate_puzzle).
+static const glyph_template TEMPLATES[] = {
+    { '0', 0.71, 0.99, {  // 13
+        "............",
+        "...######...",
+        "..########..",
+        ".#########..",
+        ".###....###.",
+        "####....###.",
+        "####....###.",
+        "####....####",
+        "####....####",
+        "####....####",
+        "####....###.",
+        ".###....###.",
+        ".####..####.",
+        "..########..",
+        "...######...",
+        "....###.....",
+    } },
+    { '1', 0.44, 0.96, {  // 77
+        ".......###..",
+        "....#######.",
+        ".##########.",
+        "###########.",
+        ".##########.",
+        "...########.",
+        ".....######.",
+        ".....######.",
+        ".....######.",
+        "......#####.",
+        "......#####.",
+        "......#####.",
+        "......#####.",
+        "......#####.",
+        "......#####.",
+        ".......###..",
+    } },
+    { '2', 0.65, 0.99, {  // 66
+        "....####....",
+        "..########..",
+        ".##########.",
+        ".####..#####",
+        ".###....####",
+        "........####",
+        ".......#####",
+        ".......####.",
+        ".....#####..",
+        "....#####...",
+        "...#####....",
+        "..#####.....",
+        ".######.....",
+        "##########..",
+        "###########.",
+        ".########...",
+    } },
+    { '3', 0.65, 1.00, {  // 57
+        ".....#......",
+        "..########..",
+        ".#########..",
+        "###########.",
+        ".##...#####.",
+        "......#####.",
+        ".....######.",
+        ".....######.",
+        ".....######.",
+        "......######",
+        ".......#####",
+        ".#......####",
+        "####..######",
+        ".##########.",
+        "..########..",
+        "...#####....",
+    } },
+    { '4', 0.68, 0.99, {  // 27
+        ".......##...",
+        "......####..",
+        ".....#####..",
+        "....######..",
+        "...#######..",
+        "...#######..",
+        "..########..",
+        "..########..",
+        ".##########.",
+        "###########.",
+        "############",
+        "############",
+        "..##########",
+        "......#####.",
+        ".......###..",
+        "........##..",
+    } },
+    { '5', 0.66, 1.00, {  // 30
+        "....#.......",
+        "..#######...",
+        ".#######....",
+        ".#####......",
+        ".#####......",
+        "########....",
+        "##########..",
+        "###########.",
+        ".###..######",
+        ".......#####",
+        "........####",
+        "........####",
+        ".###...####.",
+        ".#########..",
+        "..#######...",
+        "...#####....",
+    } },
+    { '6', 0.66, 1.03, {  // 19
+        "............",
+        "...######...",
+        "..########..",
+        ".######.#...",
+        ".#####......",
+        ".########...",
+        "##########..",
+        "###########.",
+        "###########.",
+        "#####..#####",
+        ".###....####",
+        ".###....####",
+        ".##########.",
+        ".#########..",
+        "..#######...",
+        "....####....",
+    } },
+    { '7', 0.65, 0.98, {  // 12
+        "...#..###...",
+        "..##########",
+        "..##########",
+        ".....######.",
+        ".....#####..",
+        ".....#####..",
+        ".....####...",
+        ".....###....",
+        "....####....",
+        "...####.....",
+        "...####.....",
+        "...###......",
+        "..####......",
+        "..####......",
+        "..###.......",
+        "...#........",
+    } },
+    { '8', 0.69, 1.00, {  // 14
+        ".......#....",
+        "..########..",
+        ".##########.",
+        ".##########.",
+        ".####.#####.",
+        ".##########.",
+        ".##########.",
+        ".##########.",
+        ".##########.",
+        ".####..#####",
+        "####....####",
+        "####....####",
+        "#####..#####",
+        ".##########.",
+        "..########..",
+        "...######...",
+    } },
+    { '9', 0.72, 1.00, {  // 11
+        "............",
+        "..##...#....",
+        ".########...",
+        ".#########..",
+        "####...###..",
+        "####...####.",
+        ".###...####.",
+        ".###########",
+        ".###########",
+        "..##########",
+        "...#########",
+        "...########.",
+        "..########..",
+        "..########..",
+        "..#######...",
+        "...####.....",
+    } },
+    { '+', 0.98, 0.77, {  // 86
+        "............",
+        "......#.....",
+        "......#.....",
+        ".....##.....",
+        ".....###....",
+        "....####....",
+        "...######...",
+        "###########.",
+        "############",
+        "..#######...",
+        "....####....",
+        ".....###....",
+        ".....###....",
+        ".....##.....",
+        "......#.....",
+        "............",
+    } },
+    { '-', 3.81, 0.24, {  // 89
+        "............",
+        "............",
+        ".##########.",
+        "############",
+        "############",
+        "############",
+        "############",
+        "############",
+        "############",
+        "############",
+        "############",
+        "###########.",
+        ".##########.",
+        ".########...",
+        "............",
+        "............",
+    } },
+    { 'x', 0.95, 0.76, {  // 29
+        "............",
+        "##........##",
+        ".##......##.",
+        ".###....###.",
+        "..###..###..",
+        "...#######..",
+        "...######...",
+        "....#####...",
+        "...######...",
+        "...######...",
+        "...#######..",
+        "..########..",
+        ".####...##..",
+        ".###.....##.",
+        "###.......#.",
+        "............",
+    } },
+    { '/', 0.83, 1.03, {  // 30
+        ".....##.....",
+        "....####....",
+        "....####....",
+        ".....##.....",
+        "............",
+        "............",
+        "............",
+        "############",
+        "############",
+        ".....#......",
+        "............",
+        "............",
+        ".....##.....",
+        "....####....",
+        ".....###....",
+        ".....##.....",
+    } },
+};
+enum { TEMPLATE_N = sizeof(TEMPLATES) / sizeof(TEMPLATES[0]) };
+
+typedef struct {
+    uint64_t words[GLYPH_WORDS];
+} glyph_bits;
+
+typedef struct {
+    const unsigned char *gray;
+    int                  step;
+    int                  px_size;
+    int                  size;
+    // of a box
+    int                  side;
+} clue_image;
+
+// a blob (or, once merged, a character) of ink in a corner, its box inclusive.
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    int area;
+    // the gray of its darkest pixel
+    int darkest;
+} clue_blob;
+
+// where one corner's ink is worked on: big enough for the corner of any box of the puzzle.
+typedef struct {
+    // the corner, in the image
+    int            x0;
+    int            y0;
+    int            width;
+    int            height;
+    // the gray of the corner's paper
+    int            paper;
+    // per pixel of the corner: whether it's ink, then the blob it's in (from 1, 0 for none).
+    unsigned char *ink;
+    short         *labels;
+    int           *stack;
+    // per column (row) of the image, the first pixel below the top line (right of the left line)
+    short         *below_top;
+    short         *right_of_left;
+    // per blob (from 1), whether it's part of a character
+    unsigned char  on_line[BLOBS_MAX + 1];
+} clue_scratch;
+
+// the packed templates, in TEMPLATES' order.
+typedef struct {
+    glyph_bits bits[TEMPLATE_N];
+} template_set;
+
+static void _pack_templates(template_set *set) {
+    memset(set, 0, sizeof(template_set));
+    for (int t = 0; t < TEMPLATE_N; ++t) {
+        for (int y = 0; y < GLYPH_HEIGHT; ++y) {
+            const char *row = TEMPLATES[t].rows[y];
+            for (int x = 0; row && row[x] && (x < GLYPH_WIDTH); ++x) {
+                if (row[x] == '#') {
+                    set->bits[t].words[y / 4] |= (uint64_t)1 << ((y % 4) * 16 + x);
+                }
+            }
+        }
+    }
+}
+
+static int _clamp(int value, int low, int high) {
+    return (value < low) ? low : ((value > high) ? high : value);
+}
+
+// the darkest of rows [from, to) over columns [a0, a1), or (vertical) of columns [from, to) over
+// rows [a0, a1).
+static int _darkest_line(const clue_image *image, int vertical, int from, int to, int a0, int a1) {
+    int darkest = from;
+    long darkest_total = LONG_MAX;
+    for (int i = from; i < to; ++i) {
+        long total = 0;
+        for (int a = a0; a < a1; ++a) {
+            total += vertical ? image->gray[a * image->step + i] : image->gray[i * image->step + a];
+        }
+        if (total < darkest_total) {
+            darkest = i;
+            darkest_total = total;
+        }
+    }
+    return darkest;
+}
+
+// the gray below which fraction of the corner's pixels are.
+static int _percentile(const long *histogram, long total, double fraction) {
+    long wanted = (long)(total * fraction);
+    long seen = 0;
+    for (int g = 0; g < 256; ++g) {
+        seen += histogram[g];
+        if (seen > wanted) {
+            return g;
+        }
+    }
+    return 255;
+}
+
+static long _histogram(const clue_image *image, const clue_scratch *s, long *histogram) {
+    memset(histogram, 0, 256 * sizeof(long));
+    for (int y = 0; y < s->height; ++y) {
+        const unsigned char *row = image->gray + (s->y0 + y) * image->step + s->x0;
+        for (int x = 0; x < s->width; ++x) {
+            ++histogram[row[x]];
+        }
+    }
+    return (long)s->width * s->height;
+}
+
+static int _gray_at(const clue_image *image, int vertical, int along, int across) {
+    return vertical ? image->gray[along * image->step + across] : image->gray[across * image->step + along];
+}
+
+// Follows a line (across the image, or down it if vertical) from where it crosses seed at across,
+// over [from, to), one pixel up or down (left or right) at a time. past gets, for each pixel along
+// it, the first pixel below (right of) it which is as light as paper, or thickness_max past its
+// darkest pixel.
+static void _follow_line(const clue_image *image, int vertical, int seed, int across, int from, int to,
+        int thickness_max, int paper, short *past) {
+    const int last = image->px_size - 1;
+    for (int direction = -1; direction <= 1; direction += 2) {
+        int at = across;
+        for (int along = (direction < 0) ? seed : seed + 1; (along >= from) && (along < to); along += direction) {
+            int darkest = at;
+            for (int a = _clamp(at - 1, 0, last); a <= _clamp(at + 1, 0, last); ++a) {
+                if (_gray_at(image, vertical, along, a) < _gray_at(image, vertical, along, darkest)) {
+                    darkest = a;
+                }
+            }
+            at = darkest;
+            int end = at;
+            while ((end < last) && (end - at < thickness_max) &&
+                (_gray_at(image, vertical, along, end + 1) + CONTRAST_MIN < paper)) {
+                ++end;
+            }
+            past[along] = (short)(end + 1);
+        }
+    }
+}
+
+// Finds the corner of box (row, column) and loosely marks the ink in it (see _sharpen). 0 if it's
+// blank.
+static int _corner(const clue_image *image, int row, int column, clue_scratch *s) {
+    const int side = image->side;
+    const int last = image->px_size - 1;
+    const int search = (int)(side * LINE_SEARCH);
+    const int margin = side / 10;
+
+    // the top line, looked for away from the print (which is at the left), then the left line
+    // below the print
+    const int middle = column * side + side / 2;
+    int top = _darkest_line(image, 0, _clamp(row * side - search, 0, last), _clamp(row * side + search, 0, last) + 1,
+        middle - side / 6, middle + side / 6);
+    const int below_print = _clamp(top + (3 * side) / 4, 0, last);
+    int left = _darkest_line(image, 1, _clamp(column * side - search, 0, last),
+        _clamp(column * side + search, 0, last) + 1, below_print - side / 4, _clamp(below_print + side / 4, 0, last) + 1);
+
+    s->x0     = _clamp(left - margin, 0, last);
+    s->y0     = _clamp(top - margin, 0, last);
+    s->width  = _clamp(left + (int)(side * CORNER_WIDTH), 0, image->px_size) - s->x0;
+    s->height = _clamp(top + (int)(side * CORNER_HEIGHT), 0, image->px_size) - s->y0;
+
+    long histogram[256];
+    long total = _histogram(image, s, histogram);
+    s->paper = _percentile(histogram, total, 0.5);
+    if (s->paper - _percentile(histogram, total, 0.01) < CONTRAST_MIN) {
+        return 0;
+    }
+
+    // the lines needn't be straight: each is followed across the corner, and only what's below
+    // the top one and right of the left one is looked at.
+    _follow_line(image, 0, _clamp(middle, s->x0, s->x0 + s->width - 1), top, s->x0, s->x0 + s->width, margin,
+        s->paper, s->below_top);
+    _follow_line(image, 1, below_print, left, s->y0, below_print + 1, margin, s->paper, s->right_of_left);
+
+    for (int y = 0; y < s->height; ++y) {
+        const unsigned char *row_pixels = image->gray + (s->y0 + y) * image->step + s->x0;
+        for (int x = 0; x < s->width; ++x) {
+            s->ink[y * s->width + x] = (row_pixels[x] + CONTRAST_MIN < s->paper) &&
+                (s->y0 + y >= s->below_top[s->x0 + x]) && (s->x0 + x >= s->right_of_left[s->y0 + y]);
+        }
+    }
+    return 1;
+}
+
+// Each blob of ink (as loosely marked by _corner) is print or a line, both darker in the middle
+// than at the edges: which of its pixels are ink is settled by its own contrast with the paper,
+// so that faint print and dark lines are both read at their own halfway mark.
+static void _sharpen(const clue_image *image, clue_scratch *s, const clue_blob *blobs) {
+    for (int y = 0; y < s->height; ++y) {
+        const unsigned char *row_pixels = image->gray + (s->y0 + y) * image->step + s->x0;
+        for (int x = 0; x < s->width; ++x) {
+            int label = s->labels[y * s->width + x];
+            s->ink[y * s->width + x] = label && (2 * row_pixels[x] < s->paper + blobs[label - 1].darkest);
+        }
+    }
+}
+
+// Labels the 8-connected blobs of the corner's ink. Returns how many there are, or -1 if there
+// are too many.
+static int _label(const clue_image *image, clue_scratch *s, clue_blob *blobs) {
+    const int w = s->width;
+    const int h = s->height;
+    memset(s->labels, 0, (size_t)w * h * sizeof(short));
+    int blob_n = 0;
+    for (int start = 0; start < w * h; ++start) {
+        if ((! s->ink[start]) || s->labels[start]) {
+            continue;
+        }
+        if (blob_n == BLOBS_MAX) {
+            return -1;
+        }
+        clue_blob *b = &(blobs[blob_n++]);
+        *b = (clue_blob){ w, h, -1, -1, 0, 255 };
+        int depth = 0;
+        s->stack[depth++] = start;
+        s->labels[start] = (short)blob_n;
+        while (depth) {
+            int at = s->stack[--depth];
+            int x = at % w;
+            int y = at / w;
+            b->x0 = (x < b->x0) ? x : b->x0;
+            b->y0 = (y < b->y0) ? y : b->y0;
+            b->x1 = (x > b->x1) ? x : b->x1;
+            b->y1 = (y > b->y1) ? y : b->y1;
+            ++b->area;
+            int gray = image->gray[(s->y0 + y) * image->step + s->x0 + x];
+            b->darkest = (gray < b->darkest) ? gray : b->darkest;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = x + dx;
+                    int ny = y + dy;
+                    if ((nx < 0) || (ny < 0) || (nx >= w) || (ny >= h)) {
+                        continue;
+                    }
+                    int next = ny * w + nx;
+                    if (s->ink[next] && ! s->labels[next]) {
+                        s->labels[next] = (short)blob_n;
+                        s->stack[depth++] = next;
+                    }
+                }
+            }
+        }
+    }
+    return blob_n;
+}
+
+// whether the blob is what's left of a line at the corner's edge: thin, and along the edge.
+static int _is_line(const clue_scratch *s, const clue_blob *b) {
+    const int w = b->x1 - b->x0 + 1;
+    const int h = b->y1 - b->y0 + 1;
+    return (((b->x0 == 0) || (b->x1 == s->width - 1)) && (4 * w <= h)) ||
+        (((b->y0 == 0) || (b->y1 == s->height - 1)) && (4 * h <= w));
+}
+
+// whether the corner's pixel (x, y) is ink of a character.
+static int _character_ink(const clue_scratch *s, int x, int y) {
+    return s->on_line[s->labels[y * s->width + x]];
+}
+
+// Splits glyph (which is too wide for one character) at its faintest column, away from its ends,
+// into it and the next glyph, each shrunk to its ink.
+static void _split(const clue_scratch *s, clue_blob *glyph, clue_blob *next) {
+    const int w = glyph->x1 - glyph->x0 + 1;
+    int faintest = glyph->x0 + w / 2;
+    int faintest_ink = INT_MAX;
+    for (int x = glyph->x0 + w / 3; x <= glyph->x1 - w / 3; ++x) {
+        int ink = 0;
+        for (int y = glyph->y0; y <= glyph->y1; ++y) {
+            ink += _character_ink(s, x, y);
+        }
+        if (ink < faintest_ink) {
+            faintest = x;
+            faintest_ink = ink;
+        }
+    }
+    *next = (clue_blob){ faintest + 1, glyph->y0, glyph->x1, glyph->y1, 0, glyph->darkest };
+    glyph->x1 = faintest - 1;
+    clue_blob *halves[2] = { glyph, next };
+    for (int h = 0; h < 2; ++h) {
+        clue_blob *half = halves[h];
+        int y0 = half->y1;
+        int y1 = half->y0;
+        for (int y = half->y0; y <= half->y1; ++y) {
+            for (int x = half->x0; x <= half->x1; ++x) {
+                if (_character_ink(s, x, y)) {
+                    y0 = (y < y0) ? y : y0;
+                    y1 = y;
+                }
+            }
+        }
+        half->y0 = (y0 <= y1) ? y0 : half->y0;
+        half->y1 = (y0 <= y1) ? y1 : half->y1;
+    }
+}
+
+// Picks the characters out of the corner's blobs: those on the line of text the tallest blob is
+// on, left to right, blobs which overlap across merged into one (÷ is three), and any too wide
+// for one character (print blurred together) split. Returns how many characters there are (at
+// most CLUE_GLYPHS_MAX), with height the height of the tallest.
+static int _characters(clue_scratch *s, const clue_blob *blobs, int blob_n, int side, clue_blob *glyphs,
+        int *height) {
+    const int print_max = (int)(side * PRINT_MAX);
+    memset(s->on_line, 0, sizeof(s->on_line));
+    int tallest = -1;
+    for (int i = 0; i < blob_n; ++i) {
+        const clue_blob *b = &(blobs[i]);
+        if ((b->x1 - b->x0 >= print_max) || (b->y1 - b->y0 >= print_max) || _is_line(s, b)) {
+            continue;
+        }
+        if ((tallest < 0) || (b->y1 - b->y0 > blobs[tallest].y1 - blobs[tallest].y0)) {
+            tallest = i;
+        }
+    }
+    if (tallest < 0) {
+        return 0;
+    }
+    const clue_blob line = blobs[tallest];
+    *height = line.y1 - line.y0 + 1;
+
+    // on the line, by where they start across
+    int order[BLOBS_MAX];
+    int order_n = 0;
+    for (int i = 0; i < blob_n; ++i) {
+        const clue_blob *b = &(blobs[i]);
+        if ((b->x1 - b->x0 >= print_max) || (b->y1 - b->y0 >= print_max) || _is_line(s, b) ||
+            (b->y0 + b->y1 < 2 * line.y0) || (b->y0 + b->y1 > 2 * line.y1)) {
+            continue;
+        }
+        int j = order_n++;
+        while ((j > 0) && (blobs[order[j - 1]].x0 > b->x0)) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = i;
+    }
+
+    // specks are noise; a gap wider than the line is tall is the end of the clue.
+    const int speck = *height / 5;
+    int glyph_n = 0;
+    // a glyph of one blob over another (a divide sign, say) is never characters blurred together.
+    unsigned char merged[CLUE_GLYPHS_MAX];
+    for (int k = 0; k < order_n; ++k) {
+        const clue_blob *b = &(blobs[order[k]]);
+        clue_blob *last = glyph_n ? &(glyphs[glyph_n - 1]) : NULL;
+        if (last && (b->x0 <= last->x1)) {
+            // (characters which only just overlap may still be split apart below)
+            merged[glyph_n - 1] |= ((b->x1 <= last->x1) || (b->x0 <= last->x0)) &&
+                ((b->x1 - b->x0 >= speck) || (b->y1 - b->y0 >= speck));
+            last->x0 = (b->x0 < last->x0) ? b->x0 : last->x0;
+            last->y0 = (b->y0 < last->y0) ? b->y0 : last->y0;
+            last->x1 = (b->x1 > last->x1) ? b->x1 : last->x1;
+            last->y1 = (b->y1 > last->y1) ? b->y1 : last->y1;
+            last->area += b->area;
+            s->on_line[order[k] + 1] = 1;
+            continue;
+        }
+        if ((b->x1 - b->x0 < speck) && (b->y1 - b->y0 < speck)) {
+            continue;
+        }
+        if (last && (b->x0 - last->x1 > *height)) {
+            break;
+        }
+        if (glyph_n == CLUE_GLYPHS_MAX) {
+            return 0;
+        }
+        merged[glyph_n] = 0;
+        glyphs[glyph_n++] = *b;
+        s->on_line[order[k] + 1] = 1;
+    }
+
+    for (int g = 0; g < glyph_n; ++g) {
+        clue_blob *glyph = &(glyphs[g]);
+        if (merged[g] || (glyph->x1 - glyph->x0 + 1 <= SPLIT_WIDTH * *height) ||
+            (2 * (glyph->y1 - glyph->y0 + 1) < *height)) {
+            continue;
+        }
+        if (glyph_n == CLUE_GLYPHS_MAX) {
+            return 0;
+        }
+        memmove(glyph + 2, glyph + 1, (glyph_n - g - 1) * sizeof(clue_blob));
+        memmove(merged + g + 2, merged + g + 1, glyph_n - g - 1);
+        merged[g + 1] = 0;
+        ++glyph_n;
+        _split(s, glyph, glyph + 1);
+        // (either half may need splitting again)
+        --g;
+    }
+    return glyph_n;
+}
+
+// A character scaled to GLYPH_WIDTH x GLYPH_HEIGHT: a pixel is set if at least half of what it
+// covers is ink.
+static void _glyph_bits(const clue_scratch *s, const clue_blob *glyph, glyph_bits *bits) {
+    memset(bits, 0, sizeof(glyph_bits));
+    const int w = glyph->x1 - glyph->x0 + 1;
+    const int h = glyph->y1 - glyph->y0 + 1;
+    for (int gy = 0; gy < GLYPH_HEIGHT; ++gy) {
+        int y0 = glyph->y0 + gy * h / GLYPH_HEIGHT;
+        int y1 = glyph->y0 + ((gy + 1) * h + GLYPH_HEIGHT - 1) / GLYPH_HEIGHT;
+        for (int gx = 0; gx < GLYPH_WIDTH; ++gx) {
+            int x0 = glyph->x0 + gx * w / GLYPH_WIDTH;
+            int x1 = glyph->x0 + ((gx + 1) * w + GLYPH_WIDTH - 1) / GLYPH_WIDTH;
+            int ink = 0;
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    ink += _character_ink(s, x, y);
+                }
+            }
+            if (2 * ink >= (y1 - y0) * (x1 - x0)) {
+                bits->words[gy / 4] |= (uint64_t)1 << ((gy % 4) * 16 + gx);
+            }
+        }
+    }
+}
+
+static int _distance(const glyph_bits *a, const glyph_bits *b) {
+    int distance = 0;
+    for (int i = 0; i < GLYPH_WORDS; ++i) {
+        distance += __builtin_popcountll(a->words[i] ^ b->words[i]);
+    }
+    return distance;
+}
+
+// The closest template to the character among symbols, or ? if none of them is close enough.
+static char _classify(const template_set *set, const glyph_bits *bits, double aspect, double height,
+        const char *symbols) {
+    char best = '?';
+    double best_distance = GLYPH_DISTANCE_MAX;
+    for (int t = 0; t < TEMPLATE_N; ++t) {
+        if (strchr(symbols, TEMPLATES[t].symbol) == NULL) {
+            continue;
+        }
+        double distance = _distance(bits, &(set->bits[t])) + ASPECT_WEIGHT * fabs(log(aspect / TEMPLATES[t].aspect)) +
+            HEIGHT_WEIGHT * fabs(height - TEMPLATES[t].height);
+        if (distance < best_distance) {
+            best = TEMPLATES[t].symbol;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+// Reads the clue of the cage whose first box is box, of boxes boxes, to clue. Returns 1 if every
+// character of it could be read.
+static int _read_clue(const clue_image *image, const template_set *set, clue_scratch *s, int box, int boxes,
+        char *clue, clue_glyph *read, int *read_n) {
+    clue_blob blobs[BLOBS_MAX];
+    clue_blob glyphs[CLUE_GLYPHS_MAX];
+    int height = 0;
+    int blob_n = _corner(image, box / image->size, box % image->size, s) ? _label(image, s, blobs) : 0;
+    if (blob_n > 0) {
+        _sharpen(image, s, blobs);
+        blob_n = _label(image, s, blobs);
+    }
+    int glyph_n = (blob_n > 0) ? _characters(s, blobs, blob_n, image->side, glyphs, &height) : 0;
+
+    // a target, then (unless the cage is one box) an operation
+    int digit_n = (boxes == 1) ? glyph_n : glyph_n - 1;
+    if (digit_n < 1) {
+        strcpy(clue, "?");
+        return 0;
+    }
+    int complete = 1;
+    for (int g = 0; g < glyph_n; ++g) {
+        const clue_blob *glyph = &(glyphs[g]);
+        glyph_bits bits;
+        _glyph_bits(s, glyph, &bits);
+        const double aspect = (double)(glyph->x1 - glyph->x0 + 1) / (glyph->y1 - glyph->y0 + 1);
+        const char *symbols = (g < digit_n) ? "0123456789" : ((boxes == 2) ? "+-x/" : "+x");
+        clue[g] = _classify(set, &bits, aspect, (double)(glyph->y1 - glyph->y0 + 1) / height, symbols);
+        complete = complete && (clue[g] != '?');
+        if (read) {
+            read[(*read_n)++] = (clue_glyph){ clue[g], s->x0 + glyph->x0, s->y0 + glyph->y0, s->x0 + glyph->x1,
+                s->y0 + glyph->y1 };
+        }
+    }
+    clue[glyph_n] = 0;
+    if (boxes == 1) {
+        strcat(clue, "=");
+    }
+    return complete;
+}
+
+static void _release_scratch(clue_scratch *s) {
+    free(s->ink);
+    free(s->labels);
+    free(s->stack);
+    free(s->below_top);
+    free(s->right_of_left);
+}
+
+// 0 if there's no memory for it.
+static int _create_scratch(const clue_image *image, clue_scratch *s) {
+    const int margin = image->side / 10;
+    const int most = ((int)(image->side * CORNER_WIDTH) + margin + 1) * ((int)(image->side * CORNER_HEIGHT) + margin + 1);
+    s->ink           = malloc(most);
+    s->labels        = malloc(most * sizeof(short));
+    s->stack         = malloc(most * sizeof(int));
+    s->below_top     = malloc(image->px_size * sizeof(short));
+    s->right_of_left = malloc(image->px_size * sizeof(short));
+    if ((s->ink == NULL) || (s->labels == NULL) || (s->stack == NULL) || (s->below_top == NULL) ||
+        (s->right_of_left == NULL)) {
+        _release_scratch(s);
+        return 0;
+    }
+    return 1;
+}
+
+int read_clues(const unsigned char *gray, int step, int px_size, int size, const char *cages, char *clues,
+        clue_glyph *glyphs, int *glyph_n) {
+    if ((size < CAGES_SIZE_MIN) || (size > CAGES_SIZE_MAX) || (px_size < size)) {
+        return -1;
+    }
+    const clue_image image = { gray, step, px_size, size, px_size / size };
+
+    clue_scratch s;
+    if (! _create_scratch(&image, &s)) {
+        return -1;
+    }
+    template_set set;
+    _pack_templates(&set);
+
+    // each cage's first box (in reading order), and how many boxes it has
+    const int cells = size * size;
+    int first[CAGES_SIZE_MAX * CAGES_SIZE_MAX];
+    int boxes[CAGES_SIZE_MAX * CAGES_SIZE_MAX];
+    char names[CAGES_SIZE_MAX * CAGES_SIZE_MAX];
+    int cage_n = 0;
+    for (int i = 0; i < cells; ++i) {
+        int c = 0;
+        while ((c < cage_n) && (names[c] != cages[i])) {
+            ++c;
+        }
+        if (c == cage_n) {
+            names[cage_n] = cages[i];
+            first[cage_n] = i;
+            boxes[cage_n++] = 0;
+        }
+        ++boxes[c];
+    }
+
+    if (glyph_n) {
+        *glyph_n = 0;
+    }
+    int read = 0;
+    char *at = clues;
+    for (int c = 0; c < cage_n; ++c) {
+        if (c) {
+            *at++ = ' ';
+        }
+        read += _read_clue(&image, &set, &s, first[c], boxes[c], at, glyphs, glyph_n);
+        at += strlen(at);
+    }
+    *at = 0;
+
+    _release_scratch(&s);
+    return read;
+}
@@ -0,0 +1,43 @@
+#ifndef _CLUES_H
+#define _CLUES_H
+
+#include "cages.h"
+
+// Reading the clue of each cage - its target and operation, printed in the top left corner of
+// its first box - off the gray image of a squared-up puzzle, once its cages are known.
+//
+// Only that corner of each first box is looked at. Its own lines are found first (a photo of a
+// page which isn't quite flat doesn't square up exactly), then its ink is thresholded against the
+// corner's own paper, so that faint print isn't lost to a threshold set for the whole puzzle. The
+// characters on the line of text are matched against a small template of each digit and operator,
+// packed one bit per pixel, by counting the bits they differ in. Where the cage allows, the last
+// character is an operator: a cage of one box has none, only one of two boxes can subtract or
+// divide.
+
+// the most characters any one clue is read as.
+enum { CLUE_GLYPHS_MAX = 8 };
+// room for the clues of a puzzle with a cage of every box (see read_clues): read_clues takes any
+// layout, and find_cages names the cages past its 52nd all ?, which reads as one more.
+enum { CLUES_LENGTH_MAX = CAGES_SIZE_MAX * CAGES_SIZE_MAX * (CLUE_GLYPHS_MAX + 2) };
+
+// one character read, and the box of pixels (inclusive) it was read from.
+typedef struct {
+    char symbol;
+    int  x0;
+    int  y0;
+    int  x1;
+    int  y1;
+} clue_glyph;
+
+// Writes the clues of the size x size puzzle in gray (px_size x px_size 8-bit pixels, step bytes
+// per row), whose cage layout is cages (as find_cages writes it), to clues: one per cage, in cage
+// order, separated by spaces, each its target followed by one of + - x / (or = for a cage of one
+// box), e.g. "12x 3- 5=". A character which can't be read is written as ?, as is a clue where
+// nothing at all could be. clues needs room for CLUES_LENGTH_MAX. If glyphs is set, it gets what
+// was read of each character (room for CLUES_LENGTH_MAX of them), and glyph_n how many there were.
+// Returns the number of clues read in full, or -1 if the size is out of range (or there is no
+// memory).
+int read_clues(const unsigned char *gray, int step, int px_size, int size, const char *cages, char *clues,
+    clue_glyph *glyphs, int *glyph_n);
+
+#endif /* _CLUES_H */
@@ -0,0 +1,70 @@
+#include "combinations.h"
+#include "combination_tables.h"
+
+static combination_mask _all(int size) {
+    return (combination_mask)((1 << size) - 1);
+}
+
+// for cages beyond the tables
+static combination_mask _sum_reach(int size, int k, long target) {
+    combination_mask mask = 0;
+    for (int v = 1; v <= size; ++v) {
+        int fits = (target - v >= k - 1) && (target - v <= (long)(k - 1) * size);
+        mask |= (combination_mask)(fits << (v - 1));
+    }
+    return mask;
+}
+
+static combination_mask _divisors(int size, long target) {
+    combination_mask mask = 0;
+    for (int v = 1; v <= size; ++v) {
+        mask |= (combination_mask)(((target > 0) && (target % v == 0)) << (v - 1));
+    }
+    return mask;
+}
+
+static combination_mask _product(int run, long target) {
+    int low = COMBINATION_PRODUCT_FIRST[run];
+    int high = COMBINATION_PRODUCT_FIRST[run + 1];
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (COMBINATION_PRODUCTS[middle] < target) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return ((low < COMBINATION_PRODUCT_FIRST[run + 1]) && (COMBINATION_PRODUCTS[low] == target)) ?
+        COMBINATION_PRODUCT_MASKS[low] : 0;
+}
+
+combination_mask combination_candidates(int size, cage_operation operation, int k, long target) {
+    if ((size < CAGES_SIZE_MIN) || (size > CAGES_SIZE_MAX) || (k < 1)) {
+        return 0;
+    }
+    const int by_size = (size - CAGES_SIZE_MIN) * CAGES_SIZE_MAX;
+    const int run = (size - CAGES_SIZE_MIN) * COMBINATIONS_CELLS_MAX + (k - 1);
+    switch (operation) {
+        case CAGE_GIVEN:
+            if (k != 1) {
+                return 0;
+            }
+            // fall through
+        case CAGE_ADD:
+            if (k > COMBINATIONS_CELLS_MAX) {
+                return _sum_reach(size, k, target);
+            }
+            return ((target >= k) && (target <= (long)k * size)) ?
+                COMBINATION_SUMS[COMBINATION_SUM_FIRST[run] + (target - k)] : 0;
+        case CAGE_MULTIPLY:
+            if (k > COMBINATIONS_CELLS_MAX) {
+                return _divisors(size, target);
+            }
+            return (target >= 1) ? _product(run, target) : 0;
+        case CAGE_SUBTRACT:
+            return ((k == 2) && (target >= 0) && (target < size)) ? COMBINATION_DIFFERENCES[by_size + target] : 0;
+        case CAGE_DIVIDE:
+            return ((k == 2) && (target >= 1) && (target <= size)) ? COMBINATION_QUOTIENTS[by_size + (target - 1)] : 0;
+    }
+    return _all(size);
+}
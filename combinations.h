@@ -0,0 +1,29 @@
+#ifndef _COMBINATIONS_H
+#define _COMBINATIONS_H
+
+#include <stdint.h>
+
+#include "solver.h"
+
+// Which values a cage's clue allows its cells, looked up rather than worked out. For every puzzle
+// size, operation, cage of up to COMBINATIONS_CELLS_MAX cells and target, the tables hold the
+// union of the values in all the ways k values from 1..size (repeats allowed, in any order) make
+// the target: bit v - 1 is set if v is in one of them. They're written by make_combinations when
+// the tree is built (see combination_tables.h).
+//
+// Sums are indexed directly by target. Products aren't dense enough for that (a cage of six
+// cells of a 9x9 puzzle has 784 different products, the greatest 531441), so each size and cage
+// length has its products sorted, to be searched. Subtract and divide cages have two cells, and
+// a given is a sum of one.
+
+enum { COMBINATIONS_CELLS_MAX = 6 };
+
+typedef uint16_t combination_mask;
+
+// The values which can be in a cell of a k cell cage of a size x size puzzle, going by its clue
+// alone; 0 if no k values make target. Cages of more than COMBINATIONS_CELLS_MAX cells aren't in
+// the tables: a sum keeps the values which leave the rest of it within reach, and a product its
+// divisors.
+combination_mask combination_candidates(int size, cage_operation operation, int k, long target);
+
+#endif /* _COMBINATIONS_H */
@@ -0,0 +1,124 @@
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "highgui.h"
+#include "decode.h"
+
+enum { MAX_DENOMINATOR = 8 };
+
+// libjpeg reports errors by calling error_exit, which must not return; its default exits the
+// process. This one jumps back into _decode_jpeg instead.
+typedef struct {
+    struct jpeg_error_mgr manager;
+    jmp_buf               recover;
+} decode_error;
+
+static void _error_exit(j_common_ptr info) {
+    longjmp(((decode_error *)info->err)->recover, 1);
+}
+
+static int _is_jpeg(FILE *file) {
+    unsigned char magic[2];
+    int is_jpeg = (fread(magic, 1, 2, file) == 2) && (magic[0] == 0xff) && (magic[1] == 0xd8);
+    rewind(file);
+    return is_jpeg;
+}
+
+static int _denominator(int width, int target_width) {
+    int denominator = 1;
+    if (target_width > 0) {
+        while ((denominator < MAX_DENOMINATOR) && ((width + 2 * denominator - 1) / (2 * denominator) >= target_width)) {
+            denominator *= 2;
+        }
+    }
+    return denominator;
+}
+
+// NULL (with file rewound) if it can't be decoded here: the caller falls back to cvLoadImage.
+static IplImage *_decode_jpeg(FILE *file, int target_width, int channels, decode_scale *scale) {
+    struct jpeg_decompress_struct info;
+    decode_error error;
+    // volatile: assigned between setjmp and a possible longjmp.
+    IplImage *volatile image = NULL;
+
+    info.err = jpeg_std_error(&(error.manager));
+    error.manager.error_exit = _error_exit;
+    if (setjmp(error.recover)) {
+        jpeg_destroy_decompress(&info);
+        IplImage *partial = image;
+        cvReleaseImage(&partial);
+        rewind(file);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+    if ((info.jpeg_color_space == JCS_CMYK) || (info.jpeg_color_space == JCS_YCCK)) {
+        // libjpeg can't turn these into RGB; OpenCV can.
+        jpeg_destroy_decompress(&info);
+        rewind(file);
+        return NULL;
+    }
+
+    scale->original_width  = info.image_width;
+    scale->original_height = info.image_height;
+    scale->denominator     = _denominator(info.image_width, target_width);
+    info.scale_num         = 1;
+    info.scale_denom       = scale->denominator;
+    info.out_color_space   = (channels == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&info);
+
+    image = cvCreateImage(cvSize(info.output_width, info.output_height), 8, channels);
+    while (info.output_scanline < info.output_height) {
+        unsigned char *row = (unsigned char *)image->imageData + (size_t)info.output_scanline * image->widthStep;
+        jpeg_read_scanlines(&info, &row, 1);
+        if (channels == 3) {
+            // RGB to BGR, in place.
+            for (int x = 0; x < image->width; ++x) {
+                unsigned char red = row[3 * x];
+                row[3 * x]        = row[3 * x + 2];
+                row[3 * x + 2]    = red;
+            }
+        }
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+
+    return image;
+}
+
+IplImage *decode_photo(const char *path, int target_width, int channels, decode_scale *scale) {
+    decode_scale ignored;
+    scale = scale ? scale : &ignored;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    IplImage *image = NULL;
+    if (_is_jpeg(file)) {
+        image = _decode_jpeg(file, target_width, channels, scale);
+    }
+    fclose(file);
+
+    if (image == NULL) {
+        image = cvLoadImage(path, (channels == 1) ? 0 : 1);
+        if (image != NULL) {
+            scale->original_width  = image->width;
+            scale->original_height = image->height;
+            scale->denominator     = 1;
+        }
+    }
+    return image;
+}
+
+void to_original_scale(const decode_scale *scale, CvPoint2D32f *points, int n) {
+    // the centre of decoded pixel x is the centre of the block of original pixels it stands for.
+    for (int i = 0; i < n; ++i) {
+        points[i].x = (points[i].x + 0.5f) * scale->denominator - 0.5f;
+        points[i].y = (points[i].y + 0.5f) * scale->denominator - 0.5f;
+    }
+}
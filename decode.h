@@ -0,0 +1,27 @@
+#ifndef _DECODE_H
+#define _DECODE_H
+
+#include "cv.h"
+
+// Loading photos no bigger than the analysis needs. A JPEG can be decoded at 1/2, 1/4 or 1/8 scale
+// for a fraction of the time and memory of a full decode (the inverse DCT of each block simply
+// produces fewer pixels), so the full-size image never exists at all.
+
+typedef struct {
+    int original_width;
+    int original_height;
+    // 1, 2, 4 or 8: each decoded pixel stands for a denominator x denominator block of the original.
+    int denominator;
+} decode_scale;
+
+// Decodes the photo at path as an 8-bit image of channels (1: grayscale, 3: BGR) channels, at the
+// smallest of full, 1/2, 1/4 and 1/8 scale which is still at least target_width pixels wide (full
+// scale if target_width <= 0). Only JPEGs are decoded at a reduced scale; anything else is loaded
+// with cvLoadImage, at full scale. The scale it was decoded at goes to scale (which may be NULL).
+// NULL if the photo can't be read.
+IplImage *decode_photo(const char *path, int target_width, int channels, decode_scale *scale);
+
+// maps n points found in a decoded image back to the coordinates of the original photo.
+void to_original_scale(const decode_scale *scale, CvPoint2D32f *points, int n);
+
+#endif /* _DECODE_H */
@@ -0,0 +1,255 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "denoise.h"
+
+// The reference behaviour is a scan with x outer and y inner, clearing lonely pixels as it goes.
+// Relative to that order, the 8 neighbours of (x, y) split into 4 which have already been visited
+// ("earlier": the whole of column x-1, plus (x, y-1)) and 4 which have not ("later"). Clearing
+// only ever lowers counts, so a pixel is:
+//   - certainly cleared if its full neighbour count is already within the limit;
+//   - certainly kept if its later neighbours alone exceed the limit, or if every earlier ink
+//     neighbour is itself certainly kept;
+//   - otherwise a candidate, settled one at a time in scan order (these are rare).
+// The first two classes are computed for 64 pixels per word operation.
+
+typedef uint64_t word;
+
+enum { WORD_BITS = 64 };
+enum { MAX_NEIGHBORS = 8 };
+
+typedef struct {
+    int   width;
+    int   height;
+    int   words_per_row;
+    // height + 2 rows; rows 0 and height + 1 are blank padding, so pixel row y is stored at y + 1.
+    word *bits;
+} packed_image;
+
+static word *_row(const packed_image *p, int y) {
+    return p->bits + (size_t)(y + 1) * p->words_per_row;
+}
+
+static int _pack(packed_image *p, const unsigned char *pixels, int width, int height, int step) {
+    p->width         = width;
+    p->height        = height;
+    p->words_per_row = (width + WORD_BITS - 1) / WORD_BITS;
+    p->bits          = calloc((size_t)(height + 2) * p->words_per_row, sizeof(word));
+    if (p->bits == NULL) {
+        return 0;
+    }
+
+    for (int y = 0; y < height; ++y) {
+        const unsigned char *in = pixels + (size_t)y * step;
+        word *out = _row(p, y);
+        int x = 0;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        // 8 pixels at a time: flag the bytes which are exactly 255, then gather the flags.
+        for (; x + 8 <= width; x += 8) {
+            uint64_t v;
+            memcpy(&v, in + x, sizeof(v));
+            uint64_t ink = (((v & 0x7f7f7f7f7f7f7f7fULL) + 0x0101010101010101ULL) & v) & 0x8080808080808080ULL;
+            out[x / WORD_BITS] |= (((ink >> 7) * 0x0102040810204080ULL) >> 56) << (x % WORD_BITS);
+        }
+#endif
+        for (; x < width; ++x) {
+            out[x / WORD_BITS] |= (word)(in[x] == 255) << (x % WORD_BITS);
+        }
+    }
+    return 1;
+}
+
+// neighbour planes: bit x of the result holds pixel x-1 (west) or x+1 (east) of the row.
+static word _west(const word *row, int i) {
+    return (row[i] << 1) | ((i > 0) ? (row[i - 1] >> (WORD_BITS - 1)) : 0);
+}
+
+static word _east(const word *row, int i, int words_per_row) {
+    return (row[i] >> 1) | ((i + 1 < words_per_row) ? (row[i + 1] << (WORD_BITS - 1)) : 0);
+}
+
+// at_least[k] gets a bit set wherever k or more of the planes have it set (for k <= limit).
+static void _count(const word *planes, int n, word *at_least, int limit) {
+    for (int k = 1; k <= limit; ++k) {
+        at_least[k] = 0;
+    }
+    for (int p = 0; p < n; ++p) {
+        for (int k = limit; k > 1; --k) {
+            at_least[k] |= at_least[k - 1] & planes[p];
+        }
+        at_least[1] |= planes[p];
+    }
+}
+
+static int _get(const packed_image *p, int x, int y) {
+    if ((x < 0) || (x >= p->width)) {
+        return 0;
+    }
+    return (_row(p, y)[x / WORD_BITS] >> (x % WORD_BITS)) & 1;
+}
+
+static void _clear(packed_image *p, int x, int y) {
+    _row(p, y)[x / WORD_BITS] &= ~((word)1 << (x % WORD_BITS));
+}
+
+// clears candidate (x, y) of out if its scan-order neighbours leave it lonely: earlier neighbours
+// are read from out (already settled), later ones from in (not yet visited).
+static void _settle(const packed_image *in, packed_image *out, int x, int y, int min_blob_size) {
+    int ink_neighbors = _get(out, x - 1, y - 1) + _get(out, x - 1, y) + _get(out, x - 1, y + 1)
+                      + _get(out, x, y - 1)
+                      + _get(in, x, y + 1)
+                      + _get(in, x + 1, y - 1) + _get(in, x + 1, y) + _get(in, x + 1, y + 1);
+    if (ink_neighbors <= min_blob_size) {
+        _clear(out, x, y);
+    }
+}
+
+void denoise(unsigned char *pixels, int width, int height, int step, int min_blob_size) {
+    if ((width <= 0) || (height <= 0)) {
+        return;
+    }
+    if (min_blob_size >= MAX_NEIGHBORS) {
+        // nothing can have more neighbours than that: every ink pixel goes.
+        for (int y = 0; y < height; ++y) {
+            memset(pixels + (size_t)y * step, 0, width);
+        }
+        return;
+    }
+    if (min_blob_size < 0) {
+        return;
+    }
+
+    packed_image in, out, candidates;
+    in.bits = out.bits = candidates.bits = NULL;
+    if (! _pack(&in, pixels, width, height, step)) {
+        return;
+    }
+    out = in;
+    out.bits = malloc((size_t)(height + 2) * in.words_per_row * sizeof(word));
+    candidates = in;
+    candidates.bits = calloc((size_t)(height + 2) * in.words_per_row, sizeof(word));
+    if ((out.bits == NULL) || (candidates.bits == NULL)) {
+        free(in.bits);
+        free(out.bits);
+        free(candidates.bits);
+        return;
+    }
+    memcpy(out.bits, in.bits, (size_t)(height + 2) * in.words_per_row * sizeof(word));
+
+    const int limit = min_blob_size + 1;
+    const int wpr   = in.words_per_row;
+
+    // pass 1: clear the certain ones, and mark the pixels that the scan order might still clear.
+    for (int y = 0; y < height; ++y) {
+        const word *above = _row(&in, y - 1);
+        const word *here  = _row(&in, y);
+        const word *below = _row(&in, y + 1);
+        word *cleared     = _row(&out, y);
+        word *maybe       = _row(&candidates, y);
+        for (int i = 0; i < wpr; ++i) {
+            if (here[i] == 0) {
+                continue;
+            }
+            word planes[MAX_NEIGHBORS] = {
+                // later
+                below[i], _east(above, i, wpr), _east(here, i, wpr), _east(below, i, wpr),
+                // earlier
+                above[i], _west(above, i), _west(here, i), _west(below, i)
+            };
+            word later[MAX_NEIGHBORS + 1], total[MAX_NEIGHBORS + 1];
+            _count(planes, 4, later, limit);
+            _count(planes, MAX_NEIGHBORS, total, limit);
+
+            cleared[i] &= total[limit];
+            maybe[i]    = here[i] & total[limit] & ~later[limit];
+        }
+    }
+
+    // pass 2: a candidate whose earlier ink neighbours are all certainly kept is itself kept.
+    // Count the survivors per column so they can be bucketed into scan order (if there's the
+    // memory for it; otherwise they're found by walking the columns, below).
+    int *column_counts = calloc(width + 1, sizeof(int));
+    int total_candidates = 0;
+    for (int y = 0; y < height; ++y) {
+        const word *above = _row(&in, y - 1);
+        const word *here  = _row(&in, y);
+        const word *below = _row(&in, y + 1);
+        const word *done_above = _row(&out, y - 1);
+        const word *done_here  = _row(&out, y);
+        const word *done_below = _row(&out, y + 1);
+        const word *maybe_above = _row(&candidates, y - 1);
+        const word *maybe_here  = _row(&candidates, y);
+        const word *maybe_below = _row(&candidates, y + 1);
+        word *maybe = _row(&candidates, y);
+        for (int i = 0; i < wpr; ++i) {
+            if (maybe[i] == 0) {
+                continue;
+            }
+            // an earlier neighbour is in doubt if it was ink and is either cleared or a candidate.
+            word doubtful = (above[i] & ~done_above[i]) | maybe_above[i];
+            doubtful |= _west(above, i) & ~_west(done_above, i);
+            doubtful |= _west(here, i)  & ~_west(done_here, i);
+            doubtful |= _west(below, i) & ~_west(done_below, i);
+            doubtful |= _west(maybe_above, i) | _west(maybe_here, i) | _west(maybe_below, i);
+
+            maybe[i] &= doubtful;
+            for (word w = maybe[i]; w; w &= w - 1) {
+                if (column_counts) {
+                    ++column_counts[i * WORD_BITS + __builtin_ctzll(w)];
+                }
+                ++total_candidates;
+            }
+        }
+    }
+
+    // pass 3: settle the remaining candidates one at a time, in scan order.
+    int *order = ((total_candidates > 0) && column_counts) ? malloc(total_candidates * sizeof(int)) : NULL;
+    if (order) {
+        int start = 0;
+        for (int x = 0; x < width; ++x) {
+            int n = column_counts[x];
+            column_counts[x] = start;
+            start += n;
+        }
+        for (int y = 0; y < height; ++y) {
+            const word *maybe = _row(&candidates, y);
+            for (int i = 0; i < wpr; ++i) {
+                for (word w = maybe[i]; w; w &= w - 1) {
+                    int x = i * WORD_BITS + __builtin_ctzll(w);
+                    order[column_counts[x]++] = y * width + x;
+                }
+            }
+        }
+        for (int c = 0; c < total_candidates; ++c) {
+            _settle(&in, &out, order[c] % width, order[c] / width, min_blob_size);
+        }
+        free(order);
+    } else if (total_candidates > 0) {
+        // (slower, but needs no memory)
+        for (int x = 0; x < width; ++x) {
+            for (int y = 0; y < height; ++y) {
+                if (_get(&candidates, x, y)) {
+                    _settle(&in, &out, x, y, min_blob_size);
+                }
+            }
+        }
+    }
+    free(column_counts);
+
+    // write back only the pixels which were cleared.
+    for (int y = 0; y < height; ++y) {
+        const word *before = _row(&in, y);
+        const word *after  = _row(&out, y);
+        unsigned char *row = pixels + (size_t)y * step;
+        for (int i = 0; i < wpr; ++i) {
+            for (word w = before[i] & ~after[i]; w; w &= w - 1) {
+                row[i * WORD_BITS + __builtin_ctzll(w)] = 0;
+            }
+        }
+    }
+
+    free(in.bits);
+    free(out.bits);
+    free(candidates.bits);
+}
@@ -0,0 +1,12 @@
+#ifndef _DENOISE_H
+#define _DENOISE_H
+
+// Removes "noise" spots from an 8-bit binary (0/255) image, in place: every ink pixel with at
+// most min_blob_size ink 8-neighbours is cleared.
+//
+// Pixels are judged in the same order as a plain column-by-column scan which clears as it goes
+// (so clearing one pixel can tip a later neighbour below the limit), and the output is identical
+// to that scan. The work is done on a 1-bit-per-pixel copy of the image, 64 pixels at a time.
+void denoise(unsigned char *pixels, int width, int height, int step, int min_blob_size);
+
+#endif /* _DENOISE_H */
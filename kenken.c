@@ -1,23 +1,260 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "cv.h"
+#include "annotations.h"
+#include "arena.h"
+#include "bitmap.h"
+#include "cages.h"
+#include "clues.h"
+#include "denoise.h"
 #include "kenken.h"
+#include "pixels.h"
+#include "threshold.h"
+
+struct puzzle_context_s {
+    // everything below which isn't borrowed from the caller lives in (or is released with) this.
+    arena          *arena;
+    // set for contexts owned by another context (see create_squared_puzzle_context).
+    puzzle_context *parent;
+
+    IplImage       *in;
+    puzzle_options  options;
+
+    // each of these is computed on first use, then kept until the context is released. The
+    // binary images are kept packed; OpenCV gets an 8-bit copy only for the calls that need one.
+    // Packing only shrinks what a context holds on to: computing either bitmap, or handing it to
+    // OpenCV, still takes a full-size 8-bit image for the length of the call.
+    IplImage       *gray_image;
+    bitmap         *threshold_bitmap;
+    CvSeq          *contour;
+    bitmap         *grid_bitmap;
+    // the grid's ink per row and per column, in running-sum form (see grid_profile).
+    struct grid_profile_s *grid_profiles;
+
+    // how locate_puzzle_with_context found the puzzle, if it has.
+    locate_path     located_by;
+
+    // if set, every analysis also records what it draws here.
+    annotations    *annotations;
+    // set by the one-shot entry points, whose callers own (and release) their annotated images.
+    unsigned short  caller_owns_annotated;
+};
+
+enum { PUZZLE_SIZE_MIN = CAGES_SIZE_MIN };
+enum { PUZZLE_SIZE_MAX = CAGES_SIZE_MAX };
+
+const puzzle_options DEFAULT_PUZZLE_OPTIONS = DEFAULT_PUZZLE_OPTIONS_INITIALIZER;
+
+static void _release_image(void *image) {
+    IplImage *img = image;
+    cvReleaseImage(&img);
+}
 
-static IplImage *_threshold(IplImage *in) {
-    IplImage *img = cvCreateImage(cvGetSize(in), 8, 1);
+static void _release_storage(void *storage) {
+    CvMemStorage *s = storage;
+    cvReleaseMemStorage(&s);
+}
 
-    // convert to grayscale
-    cvCvtColor(in, img, CV_BGR2GRAY);
-
-    // compute the mean intensity. This is used to adjust constant_reduction value below.
-    long total = 0;
-    for (int x = 0; x < img->width; ++x) {
-        for (int y = 0; y < img->height; ++y) {
-            CvScalar s = cvGet2D(img, y, x);
-            total += s.val[0];
+static void _release_bitmap(void *b) {
+    bitmap *packed = b;
+    release_bitmap(&packed);
+}
+
+static void _release_child(void *child) {
+    arena *a = ((puzzle_context *)child)->arena;
+    release_arena(&a);
+}
+
+static IplImage *_context_image(puzzle_context *context, CvSize size, int channels) {
+    return arena_adopt(context->arena, cvCreateImage(size, 8, channels), _release_image);
+}
+
+static bitmap *_context_bitmap(puzzle_context *context, CvSize size) {
+    return arena_adopt(context->arena, create_bitmap(size.width, size.height), _release_bitmap);
+}
+
+// an 8-bit (0/255) copy of packed, which the caller releases.
+static IplImage *_unpack(const bitmap *packed) {
+    IplImage *image = cvCreateImage(cvSize(packed->width, packed->height), 8, 1);
+    unpack_bitmap(packed, (unsigned char *)image->imageData, image->widthStep, 1);
+    return image;
+}
+
+static CvMemStorage *_context_storage(puzzle_context *context) {
+    return arena_adopt(context->arena, cvCreateMemStorage(0), _release_storage);
+}
+
+puzzle_context *create_puzzle_context(IplImage *in, const puzzle_options *options) {
+    arena *a = create_arena(0);
+    if (a == NULL) {
+        return NULL;
+    }
+    puzzle_context *context = arena_alloc(a, sizeof(puzzle_context));
+    if (context == NULL) {
+        release_arena(&a);
+        return NULL;
+    }
+    context->arena   = a;
+    context->in      = in;
+    context->options = options ? *options : DEFAULT_PUZZLE_OPTIONS;
+    return context;
+}
+
+puzzle_context *create_puzzle_context_from_pixels(const unsigned char *pixels, int width, int height, int stride,
+        pixel_format format, const puzzle_options *options) {
+    // NV12's luma plane is a grayscale image in its own right; its chroma plane is never needed.
+    int channels = (format == PIXELS_BGR) ? 3 : 1;
+    if ((pixels == NULL) || (width <= 0) || (height <= 0) || (stride < width * channels)) {
+        return NULL;
+    }
+
+    puzzle_context *context = create_puzzle_context(NULL, options);
+    if (context == NULL) {
+        return NULL;
+    }
+    // only the header is the context's; the pixels stay the caller's.
+    IplImage *header = arena_alloc(context->arena, sizeof(IplImage));
+    if (header == NULL) {
+        release_puzzle_context(&context);
+        return NULL;
+    }
+    cvInitImageHeader(header, cvSize(width, height), IPL_DEPTH_8U, channels, IPL_ORIGIN_TL, 4);
+    cvSetData(header, (void *)pixels, stride);
+    context->in = header;
+
+    return context;
+}
+
+void release_puzzle_context(puzzle_context **context) {
+    if ((context == NULL) || (*context == NULL)) {
+        return;
+    }
+    if ((*context)->parent == NULL) {
+        // the context itself lives in its arena, so this is the last thing to touch it.
+        arena *a = (*context)->arena;
+        release_arena(&a);
+    }
+    *context = NULL;
+}
+
+IplImage *puzzle_context_image(const puzzle_context *context) {
+    return context->in;
+}
+
+locate_path puzzle_context_locate_path(const puzzle_context *context) {
+    return context->located_by;
+}
+
+void record_puzzle_annotations(puzzle_context *context, annotations *list) {
+    context->annotations = list;
+}
+
+// Where one analysis draws its annotations: an image (if the caller asked for one), the context's
+// draw list (if one is being recorded), both, or neither.
+typedef struct {
+    IplImage    *image;
+    annotations *list;
+} canvas;
+
+static canvas _open_canvas(puzzle_context *context, const bitmap *background, IplImage **annotated) {
+    canvas c = { NULL, context->annotations };
+    if (annotated) {
+        CvSize size = cvSize(background->width, background->height);
+        if (context->caller_owns_annotated) {
+            *annotated = cvCreateImage(size, 8, 3);
+        } else {
+            *annotated = _context_image(context, size, 3);
         }
+        unpack_bitmap(background, (unsigned char *)(*annotated)->imageData, (*annotated)->widthStep, 3);
+        c.image = *annotated;
+    }
+    return c;
+}
+
+static void _draw_line(canvas *c, CvPoint from, CvPoint to, CvScalar color, int thickness) {
+    if (c->image) {
+        cvLine(c->image, from, to, color, thickness, 8, 0);
+    }
+    if (c->list) {
+        add_annotation(c->list, ANNOTATION_LINE, from, to, color, thickness);
     }
-    int mean_intensity = (int)(total / (img->width * img->height));
+}
+
+static void _draw_rectangle(canvas *c, CvPoint from, CvPoint to, CvScalar color, int thickness) {
+    if (c->image) {
+        cvRectangle(c->image, from, to, color, thickness, 8, 0);
+    }
+    if (c->list) {
+        add_annotation(c->list, ANNOTATION_RECTANGLE, from, to, color, thickness);
+    }
+}
+
+static void _draw_point(canvas *c, CvPoint2D32f at, CvScalar color, int thickness) {
+    if (c->image) {
+        cvLine(c->image, cvPointFrom32f(at), cvPointFrom32f(at), color, thickness, 8, 0);
+    }
+    if (c->list) {
+        add_annotation(c->list, ANNOTATION_POINT, cvPointFrom32f(at), cvPointFrom32f(at), color, thickness);
+    }
+}
+
+static IplImage *_gray(puzzle_context *context) {
+    if (context->gray_image) {
+        return context->gray_image;
+    }
+
+    if (context->in->nChannels == 1) {
+        // already is
+        context->gray_image = context->in;
+        return context->gray_image;
+    }
+
+    // convert to grayscale
+    context->gray_image = _context_image(context, cvGetSize(context->in), 1);
+    cvCvtColor(context->in, context->gray_image, CV_BGR2GRAY);
+
+    return context->gray_image;
+}
+
+// constant_reduction observations: magic, but adapting this value to the mean intensity of the
+//   image as a whole seems to help.
+static int _constant_reduction(int mean_intensity) {
+    return (int)(mean_intensity / 3.6 + 0.5);
+}
+
+// the fused threshold, one band of rows at a time (see threshold_offsets_rows).
+typedef struct {
+    IplImage *source;
+    IplImage *threshold_image;
+    int       block_size;
+    // per band
+    long     *totals;
+    int       constant_reduction;
+} threshold_job;
+
+static void _threshold_offsets_band(void *argument, int band, int y0, int y1) {
+    threshold_job *job = argument;
+    IplImage *source   = job->source;
+    job->totals[band]  = threshold_offsets_rows((unsigned char *)source->imageData, source->widthStep,
+        source->nChannels, source->width, source->height, job->block_size, y0, y1,
+        (signed char *)job->threshold_image->imageData, job->threshold_image->widthStep);
+}
+
+static void _threshold_apply_band(void *argument, int band, int y0, int y1) {
+    threshold_job *job = argument;
+    IplImage *out      = job->threshold_image;
+    threshold_apply((unsigned char *)out->imageData + y0 * out->widthStep, out->widthStep,
+        out->width, y1 - y0, job->constant_reduction);
+}
+
+static bitmap *_threshold(puzzle_context *context) {
+    if (context->threshold_bitmap) {
+        return context->threshold_bitmap;
+    }
+
+    IplImage *in = context->in;
 
     // apply thresholding (converts it to a binary image)
     // block_size observations: higher value does better for images with variable lighting (e.g.
@@ -26,67 +263,79 @@ static IplImage *_threshold(IplImage *in) {
     //   seem to do better with different values (e.g. contour location is better with smaller numbers,
     //   but cage location is better with larger...) but for now, have been able to settle on value
     //   which works pretty well for most cases.
-    int block_size = (int)(img->width / 9);
+    int block_size = (int)(in->width / 9);
     if ((block_size % 2) == 0) {
         // must be odd
         block_size += 1;
     }
-    // constant_reduction observations: magic, but adapting this value to the mean intensity of the
-    //   image as a whole seems to help.
-    int constant_reduction = (int)(mean_intensity / 3.6 + 0.5);
 
-    IplImage *threshold_image = cvCreateImage(cvGetSize(img), 8, 1);
-    cvAdaptiveThreshold(img, threshold_image, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV,
-        block_size, constant_reduction);
-    cvReleaseImage(&img);
+    // the 8-bit image is only needed until it is packed, but while it lives it is full size: both
+    // ways of thresholding, and denoise, work on bytes.
+    IplImage *threshold_image = cvCreateImage(cvGetSize(in), 8, 1);
 
-    // try to get rid of "noise" spots.
-    int min_blob_size = 2;
-    for (int x = 0; x < threshold_image->width; ++x) {
-        for (int y = 0; y < threshold_image->height; ++y) {
-            CvScalar s = cvGet2D(threshold_image, y, x);
-            int ink_neighbors = 0;
-            if (s.val[0] == 255) {
-                for (int dx = -1; dx <= 1; ++dx) {
-                    if ((x + dx >= 0) && (x + dx < threshold_image->width)) {
-                        for (int dy = -1; dy <= 1; ++dy) {
-                            if ((y + dy >= 0) && (y + dy < threshold_image->height)) {
-                                if (! ((dy == 0) && (dx == 0))) {
-                                    CvScalar m = cvGet2D(threshold_image, y + dy, x + dx);
-                                    if (m.val[0] == 255) {
-                                        ++ink_neighbors;
-                                        if (ink_neighbors > min_blob_size) {
-                                            break;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        if (ink_neighbors > min_blob_size) {
-                            break;
-                        }
-                    }
-                }
-                if (ink_neighbors <= min_blob_size) {
-                    s.val[0] = 0;
-                    cvSet2D(threshold_image, y, x, s);
-                }
-            }
+    if (context->options.threshold == THRESHOLD_OPENCV) {
+        IplImage *img = _gray(context);
+
+        // compute the mean intensity. This is used to adjust constant_reduction value below.
+        unsigned long total = sum_region(img, cvRect(0, 0, img->width, img->height));
+        int mean_intensity = (int)(total / (img->width * img->height));
+
+        cvAdaptiveThreshold(img, threshold_image, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV,
+            block_size, _constant_reduction(mean_intensity));
+    } else {
+        // grayscale, mean intensity and local means all come out of one pass over the input; only
+        // the final comparison (which needs the mean intensity) is left for a second, cheap pass.
+        // with a pool, each pass is split into bands; the band totals are summed in band order.
+        // every band of the first pass converts the block_size rows around its edges over again,
+        // so its bands are kept at least twice that tall.
+        work_pool *pool = context->options.pool;
+        int bands       = band_count(pool, in->height, 2 * block_size);
+        long single_total;
+        long *totals    = arena_alloc(context->arena, bands * sizeof(long));
+        if (totals == NULL) {
+            // without the memory for the band totals, it's done in one band, as without a pool
+            pool   = NULL;
+            bands  = 1;
+            totals = &single_total;
+        }
+        threshold_job job = {
+            context->gray_image ? context->gray_image : in, threshold_image, block_size, totals, 0
+        };
+        run_bands(pool, in->height, 2 * block_size, _threshold_offsets_band, &job);
+
+        long total = 0;
+        for (int band = 0; band < bands; ++band) {
+            total += job.totals[band];
         }
+        job.constant_reduction = _constant_reduction((int)(total / ((long)in->width * in->height)));
+        run_bands(pool, in->height, 0, _threshold_apply_band, &job);
     }
 
-    return threshold_image;
+    // try to get rid of "noise" spots.
+    int min_blob_size = 2;
+    denoise((unsigned char *)threshold_image->imageData, threshold_image->width, threshold_image->height,
+        threshold_image->widthStep, min_blob_size);
+
+    context->threshold_bitmap = _context_bitmap(context, cvGetSize(in));
+    pack_bitmap(context->threshold_bitmap, (unsigned char *)threshold_image->imageData, threshold_image->widthStep);
+    cvReleaseImage(&threshold_image);
+
+    return context->threshold_bitmap;
 }
 
-static CvSeq *_locate_puzzle_contour(IplImage *in) {
-    IplImage *threshold_image = _threshold(in);
+static CvSeq *_locate_puzzle_contour(puzzle_context *context) {
+    if (context->contour) {
+        return context->contour;
+    }
+
+    // cvFindContours scribbles on its input, which is why it gets a copy of its own.
+    IplImage *scratch_image = _unpack(_threshold(context));
 
-    CvMemStorage* storage = cvCreateMemStorage(0);
     CvSeq* contour = 0;
 
-    cvFindContours(threshold_image, storage, &contour, sizeof(CvContour), CV_RETR_CCOMP, CV_CHAIN_APPROX_SIMPLE, cvPoint(0, 0));
+    cvFindContours(scratch_image, _context_storage(context), &contour, sizeof(CvContour), CV_RETR_CCOMP, CV_CHAIN_APPROX_SIMPLE, cvPoint(0, 0));
 
-    cvReleaseImage(&threshold_image);
+    cvReleaseImage(&scratch_image);
 
     double max_area    = fabs(cvContourArea(contour, CV_WHOLE_SEQ));
     CvSeq *max_contour = contour;
@@ -99,18 +348,34 @@ static CvSeq *_locate_puzzle_contour(IplImage *in) {
         }
     }
 
+    context->contour = max_contour;
     return max_contour;
 }
 
-static IplImage *_grid(IplImage *in) {
-    CvSeq *contour = _locate_puzzle_contour(in);
+static bitmap *_grid(puzzle_context *context) {
+    if (context->grid_bitmap) {
+        return context->grid_bitmap;
+    }
+
+    CvSeq *contour = _locate_puzzle_contour(context);
 
-    // draw the contour onto an otherwise blank image
-    IplImage *grid_image = cvCreateImage(cvGetSize(in), 8, 1);
+    // draw the contour onto an otherwise blank (full-size, 8-bit) image, then keep it packed. The
+    // ink in a box of the grid is counted straight off the packed bits, 64 pixels at a time; in a
+    // band across the whole grid, from its profiles (see _grid_profiles).
+    IplImage *grid_image = cvCreateImage(cvGetSize(context->in), 8, 1);
+    cvSetZero(grid_image);
     CvScalar color = CV_RGB(255, 255, 255);
     cvDrawContours(grid_image, contour, color, color, -1, CV_FILLED, 8, cvPoint(0, 0) );
 
-    return grid_image;
+    context->grid_bitmap = _context_bitmap(context, cvGetSize(context->in));
+    pack_bitmap(context->grid_bitmap, (unsigned char *)grid_image->imageData, grid_image->widthStep);
+    cvReleaseImage(&grid_image);
+
+    return context->grid_bitmap;
+}
+
+const bitmap *puzzle_context_grid(puzzle_context *context) {
+    return _grid(context);
 }
 
 static void intersect(CvPoint *a, CvPoint *b, CvPoint2D32f *i) {
@@ -124,13 +389,12 @@ static void intersect(CvPoint *a, CvPoint *b, CvPoint2D32f *i) {
    return;
 }
 
-const CvPoint2D32f* locate_puzzle(IplImage *in, IplImage **annotated) {
-    IplImage *grid_image = _grid(in);
-
-    *annotated = cvCloneImage(in);
+static const CvPoint2D32f *_locate_by_hough(puzzle_context *context, IplImage **annotated) {
+    IplImage *in = context->in;
+    bitmap *grid = _grid(context);
 
     // find lines using Hough transform
-    CvMemStorage* storage = cvCreateMemStorage(0);
+    CvMemStorage* storage = _context_storage(context);
     CvSeq* lines = 0;
 
     double distance_resolution = 1;
@@ -138,12 +402,12 @@ const CvPoint2D32f* locate_puzzle(IplImage *in, IplImage **annotated) {
     int threshold              = 60;
     int minimum_line_length    = in->width / 2;
     int maximum_join_gap       = in->width / 10;
+    IplImage *grid_image = _unpack(grid);
     lines = cvHoughLines2(grid_image, storage, CV_HOUGH_PROBABILISTIC,  distance_resolution, angle_resolution, threshold, minimum_line_length, maximum_join_gap);
-
-    cvCvtColor(grid_image, *annotated, CV_GRAY2RGB);
-
     cvReleaseImage(&grid_image);
 
+    canvas annotation = _open_canvas(context, grid, annotated);
+
     double most_horizontal = INFINITY;
     for (int i = 0; i < lines->total; ++i) {
         CvPoint *line = (CvPoint*)cvGetSeqElem(lines,i);
@@ -175,7 +439,7 @@ const CvPoint2D32f* locate_puzzle(IplImage *in, IplImage **annotated) {
             slope = dy / dx;
         }
 
-        cvLine(*annotated, line[0], line[1], CV_RGB(255, 0, 0), 1, 8, 0);
+        _draw_line(&annotation, line[0], line[1], CV_RGB(255, 0, 0), 1);
         if (abs(slope - most_horizontal) <= 1) {
             if ((top == -1) || (line[1].y < ((CvPoint*)cvGetSeqElem(lines,top))[1].y)) {
                 top = i;
@@ -198,50 +462,304 @@ const CvPoint2D32f* locate_puzzle(IplImage *in, IplImage **annotated) {
     }
 
     CvPoint *top_line    = (CvPoint*)cvGetSeqElem(lines,top);
-    cvLine(*annotated, top_line[0], top_line[1], CV_RGB(0, 0, 255), 6, 8, 0);
+    _draw_line(&annotation, top_line[0], top_line[1], CV_RGB(0, 0, 255), 6);
 
     CvPoint *bottom_line = (CvPoint*)cvGetSeqElem(lines,bottom);
-    cvLine(*annotated, bottom_line[0], bottom_line[1], CV_RGB(0, 255, 255), 6, 8, 0);
+    _draw_line(&annotation, bottom_line[0], bottom_line[1], CV_RGB(0, 255, 255), 6);
 
     CvPoint *left_line   = (CvPoint*)cvGetSeqElem(lines,left);
-    cvLine(*annotated, left_line[0], left_line[1], CV_RGB(0, 255, 0), 6, 8, 0);
+    _draw_line(&annotation, left_line[0], left_line[1], CV_RGB(0, 255, 0), 6);
 
     CvPoint *right_line  = (CvPoint*)cvGetSeqElem(lines,right);
-    cvLine(*annotated, right_line[0], right_line[1], CV_RGB(255, 255, 0), 6, 8, 0);
+    _draw_line(&annotation, right_line[0], right_line[1], CV_RGB(255, 255, 0), 6);
 
     CvPoint2D32f *coordinates;
-    coordinates = malloc(sizeof(CvPoint2D32f) * 4);
+    coordinates = arena_alloc(context->arena, sizeof(CvPoint2D32f) * 4);
 
     // top left
     intersect(top_line, left_line, &(coordinates[0]));
-    cvLine(*annotated, cvPointFrom32f(coordinates[0]), cvPointFrom32f(coordinates[0]), CV_RGB(255, 255, 0), 10, 8, 0);
+    _draw_point(&annotation, coordinates[0], CV_RGB(255, 255, 0), 10);
 
     //printf("top_left: %.0f, %.0f\n", coordinates[0].x, coordinates[0].y);
 
     // top right
     intersect(top_line, right_line, &(coordinates[1]));
-    cvLine(*annotated, cvPointFrom32f(coordinates[1]), cvPointFrom32f(coordinates[1]), CV_RGB(255, 255, 0), 10, 8, 0);
+    _draw_point(&annotation, coordinates[1], CV_RGB(255, 255, 0), 10);
 
     //printf("top_right: %.0f, %.0f\n", coordinates[1].x, coordinates[1].y);
 
     // bottom right
     intersect(bottom_line, right_line, &(coordinates[2]));
-    cvLine(*annotated, cvPointFrom32f(coordinates[2]), cvPointFrom32f(coordinates[2]), CV_RGB(255, 255, 0), 10, 8, 0);
+    _draw_point(&annotation, coordinates[2], CV_RGB(255, 255, 0), 10);
 
     //printf("bottom_right: %.0f, %.0f\n", coordinates[2].x, coordinates[2].y);
 
     // bottom left
     intersect(bottom_line, left_line, &(coordinates[3]));
-    cvLine(*annotated, cvPointFrom32f(coordinates[3]), cvPointFrom32f(coordinates[3]), CV_RGB(255, 255, 0), 10, 8, 0);
+    _draw_point(&annotation, coordinates[3], CV_RGB(255, 255, 0), 10);
 
     //printf("bottom_left: %.0f, %.0f\n", coordinates[3].x, coordinates[3].y);
 
+    context->located_by = LOCATED_BY_HOUGH;
     return coordinates;
 }
 
-IplImage *square_puzzle(IplImage *in, const CvPoint2D32f *location) {
-    int xsize = location[1].x - location[0].x;
-    int ysize = xsize;
+// orders a quadrilateral's corners top left, top right, bottom right, bottom left.
+static void _order_corners(CvPoint2D32f *corners) {
+    CvPoint2D32f center = cvPoint2D32f(0, 0);
+    for (int i = 0; i < 4; ++i) {
+        center.x += corners[i].x / 4;
+        center.y += corners[i].y / 4;
+    }
+
+    // clockwise (on screen, where y points down) is increasing angle.
+    double angles[4];
+    for (int i = 0; i < 4; ++i) {
+        angles[i] = atan2(corners[i].y - center.y, corners[i].x - center.x);
+    }
+    for (int i = 1; i < 4; ++i) {
+        for (int j = i; (j > 0) && (angles[j - 1] > angles[j]); --j) {
+            double angle = angles[j];
+            angles[j] = angles[j - 1];
+            angles[j - 1] = angle;
+            CvPoint2D32f corner = corners[j];
+            corners[j] = corners[j - 1];
+            corners[j - 1] = corner;
+        }
+    }
+
+    // then start from the top left: the one nearest the origin.
+    int first = 0;
+    for (int i = 1; i < 4; ++i) {
+        if (corners[i].x + corners[i].y < corners[first].x + corners[first].y) {
+            first = i;
+        }
+    }
+    CvPoint2D32f ordered[4];
+    for (int i = 0; i < 4; ++i) {
+        ordered[i] = corners[(first + i) % 4];
+    }
+    memcpy(corners, ordered, sizeof(ordered));
+}
+
+// The fast path: the puzzle's outline is the largest contour, so if that is (very nearly) a
+// quadrilateral, its corners are the puzzle's. NULL if it isn't.
+static const CvPoint2D32f *_locate_by_contour(puzzle_context *context, IplImage **annotated) {
+    IplImage *in   = context->in;
+    CvSeq *contour = _locate_puzzle_contour(context);
+    if ((contour == NULL) || (contour->total < 4)) {
+        return NULL;
+    }
+
+    // tolerance observations: 2% of the perimeter absorbs the wobble of a hand-drawn or slightly
+    //   bent outline, but still keeps a real corner.
+    double perimeter = cvArcLength(contour, CV_WHOLE_SEQ, 1);
+    CvSeq *polygon   = cvApproxPoly(contour, sizeof(CvContour), _context_storage(context), CV_POLY_APPROX_DP, perimeter * 0.02, 0);
+    if ((polygon == NULL) || (polygon->total != 4) || (! cvCheckContourConvexity(polygon))) {
+        return NULL;
+    }
+
+    // the polygon should cover (nearly) the same area as the outline it approximates...
+    double contour_area = fabs(cvContourArea(contour, CV_WHOLE_SEQ));
+    double polygon_area = fabs(cvContourArea(polygon, CV_WHOLE_SEQ));
+    if ((contour_area <= 0) || (fabs(polygon_area - contour_area) > 0.05 * contour_area)) {
+        return NULL;
+    }
+
+    CvPoint2D32f *coordinates = arena_alloc(context->arena, sizeof(CvPoint2D32f) * 4);
+    for (int i = 0; i < 4; ++i) {
+        coordinates[i] = cvPointTo32f(*((CvPoint *)cvGetSeqElem(polygon, i)));
+    }
+    _order_corners(coordinates);
+
+    // ...and, like the lines the Hough transform looks for, be a good part of the photo.
+    for (int i = 0; i < 4; ++i) {
+        double dx = coordinates[(i + 1) % 4].x - coordinates[i].x;
+        double dy = coordinates[(i + 1) % 4].y - coordinates[i].y;
+        if (sqrt(dx * dx + dy * dy) < in->width / 4) {
+            return NULL;
+        }
+    }
+
+    canvas annotation = _open_canvas(context, _threshold(context), annotated);
+    CvScalar side_colors[4] = { CV_RGB(0, 0, 255), CV_RGB(255, 255, 0), CV_RGB(0, 255, 255), CV_RGB(0, 255, 0) };
+    for (int i = 0; i < 4; ++i) {
+        _draw_line(&annotation, cvPointFrom32f(coordinates[i]), cvPointFrom32f(coordinates[(i + 1) % 4]), side_colors[i], 6);
+    }
+    for (int i = 0; i < 4; ++i) {
+        _draw_point(&annotation, coordinates[i], CV_RGB(255, 255, 0), 10);
+    }
+
+    context->located_by = LOCATED_BY_CONTOUR;
+    return coordinates;
+}
+
+// at the context's own resolution: the contour fast path if allowed, otherwise (or if the contour
+// isn't a quadrilateral) the Hough transform.
+static const CvPoint2D32f *_locate_at_resolution(puzzle_context *context, IplImage **annotated) {
+    if (context->options.corners == CORNERS_BY_CONTOUR) {
+        const CvPoint2D32f *location = _locate_by_contour(context, annotated);
+        if (location) {
+            return location;
+        }
+    }
+    return _locate_by_hough(context, annotated);
+}
+
+// a context for image (which it takes ownership of), with the same options and annotation
+// list, owned by context.
+static puzzle_context *_create_child_context(puzzle_context *context, IplImage *image) {
+    puzzle_context *child = create_puzzle_context(image, &(context->options));
+    if (child == NULL) {
+        cvReleaseImage(&image);
+        return NULL;
+    }
+    arena_adopt(child->arena, image, _release_image);
+
+    child->parent      = context;
+    child->annotations = context->annotations;
+    if (arena_adopt(context->arena, child, _release_child) == NULL) {
+        return NULL;
+    }
+    return child;
+}
+
+// Moves corner (at full resolution) onto the nearest corner in the image, looking no further
+// than radius pixels away. Only that window of the input is converted to gray.
+static void _refine_corner(IplImage *in, CvPoint2D32f *corner, int radius) {
+    int x0 = (int)corner->x - radius;
+    int y0 = (int)corner->y - radius;
+    int x1 = (int)corner->x + radius + 1;
+    int y1 = (int)corner->y + radius + 1;
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+    x1 = (x1 > in->width) ? in->width : x1;
+    y1 = (y1 > in->height) ? in->height : y1;
+    if ((x1 - x0 < 5) || (y1 - y0 < 5)) {
+        return;
+    }
+
+    // a header onto the window, rather than an ROI on the input: the input may be shared.
+    CvMat window;
+    cvGetSubRect(in, &window, cvRect(x0, y0, x1 - x0, y1 - y0));
+    IplImage *gray = cvCreateImage(cvSize(x1 - x0, y1 - y0), 8, 1);
+    if (in->nChannels == 1) {
+        cvCopy(&window, gray, NULL);
+    } else {
+        cvCvtColor(&window, gray, CV_BGR2GRAY);
+    }
+
+    CvPoint2D32f refined = cvPoint2D32f(corner->x - x0, corner->y - y0);
+    int half = (radius / 2 > 2) ? (radius / 2) : 2;
+    cvFindCornerSubPix(gray, &refined, 1, cvSize(half, half), cvSize(-1, -1),
+        cvTermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.1));
+    cvReleaseImage(&gray);
+
+    refined.x += x0;
+    refined.y += y0;
+    if ((fabs(refined.x - corner->x) <= radius) && (fabs(refined.y - corner->y) <= radius)) {
+        *corner = refined;
+    }
+}
+
+// Locates the puzzle on a downscaled copy of the input (halved until it is no wider than
+// pyramid_width), then refines each corner in a small full-resolution window. NULL if the puzzle
+// wasn't found at the coarse level.
+static const CvPoint2D32f *_locate_by_pyramid(puzzle_context *context, IplImage **annotated) {
+    IplImage *in = context->in;
+
+    int scale = 1;
+    while ((in->width / scale > context->options.pyramid_width) && (in->width / (2 * scale) > 0)) {
+        scale *= 2;
+    }
+
+    IplImage *coarse_image = cvCreateImage(cvSize(in->width / scale, in->height / scale), 8, in->nChannels);
+    cvResize(in, coarse_image, CV_INTER_AREA);
+
+    // the coarse level does its own drawing (to scale) on its own image, if asked; the draw list
+    // only gets the final, full-resolution result.
+    puzzle_context *coarse = _create_child_context(context, coarse_image);
+    if (coarse == NULL) {
+        return NULL;
+    }
+    coarse->options.locate = LOCATE_FULL_RESOLUTION;
+    coarse->annotations    = NULL;
+
+    IplImage *coarse_annotated = NULL;
+    const CvPoint2D32f *coarse_location = _locate_at_resolution(coarse, annotated ? &coarse_annotated : NULL);
+    if (coarse_location == NULL) {
+        return NULL;
+    }
+    context->located_by = coarse->located_by;
+
+    canvas annotation = { NULL, context->annotations };
+    if (annotated) {
+        if (context->caller_owns_annotated) {
+            *annotated = cvCreateImage(cvGetSize(in), 8, 3);
+        } else {
+            *annotated = _context_image(context, cvGetSize(in), 3);
+        }
+        cvResize(coarse_annotated, *annotated, CV_INTER_LINEAR);
+        annotation.image = *annotated;
+    }
+
+    // a coarse pixel either way, plus the coarse level's own slop.
+    int radius = 3 * scale;
+    CvPoint2D32f *coordinates = arena_alloc(context->arena, sizeof(CvPoint2D32f) * 4);
+    for (int i = 0; i < 4; ++i) {
+        // the centre of the coarse pixel, in full-resolution pixels.
+        coordinates[i] = cvPoint2D32f((coarse_location[i].x + 0.5) * scale - 0.5, (coarse_location[i].y + 0.5) * scale - 0.5);
+        _draw_rectangle(&annotation, cvPoint(coordinates[i].x - radius, coordinates[i].y - radius),
+            cvPoint(coordinates[i].x + radius, coordinates[i].y + radius), CV_RGB(0, 255, 0), 2);
+        if (scale > 1) {
+            _refine_corner(in, &(coordinates[i]), radius);
+        }
+        _draw_point(&annotation, coordinates[i], CV_RGB(255, 255, 0), 10);
+    }
+
+    return coordinates;
+}
+
+const CvPoint2D32f* locate_puzzle_with_context(puzzle_context *context, IplImage **annotated) {
+    if ((context->options.locate == LOCATE_PYRAMID) && (context->in->width > context->options.pyramid_width)) {
+        const CvPoint2D32f *location = _locate_by_pyramid(context, annotated);
+        if (location) {
+            return location;
+        }
+        // not found at the coarse level: try again at full resolution.
+    }
+    return _locate_at_resolution(context, annotated);
+}
+
+const CvPoint2D32f* locate_puzzle(IplImage *in, IplImage **annotated) {
+    puzzle_context *context = create_puzzle_context(in, NULL);
+    if (context == NULL) {
+        return NULL;
+    }
+    context->caller_owns_annotated = 1;
+
+    CvPoint2D32f *location = NULL;
+    const CvPoint2D32f *found = locate_puzzle_with_context(context, annotated);
+    if (found && (location = malloc(sizeof(CvPoint2D32f) * 4))) {
+        memcpy(location, found, sizeof(CvPoint2D32f) * 4);
+    }
+
+    release_puzzle_context(&context);
+    return location;
+}
+
+void release_puzzle_location(const CvPoint2D32f **location) {
+    if (location == NULL) {
+        return;
+    }
+    free((void *)*location);
+    *location = NULL;
+}
+
+// warps the quadrilateral at location in in onto the whole of warped_image.
+static void _warp_puzzle(IplImage *in, const CvPoint2D32f *location, IplImage *warped_image) {
+    int xsize = warped_image->width;
+    int ysize = warped_image->height;
 
     CvPoint2D32f warped_coordinates[4];
     warped_coordinates[0] = cvPointTo32f(cvPoint(0,       0));
@@ -252,25 +770,111 @@ IplImage *square_puzzle(IplImage *in, const CvPoint2D32f *location) {
     CvMat *map_matrix = cvCreateMat(3, 3, CV_64FC1);
     cvGetPerspectiveTransform(location, warped_coordinates, map_matrix);
 
-    IplImage *warped_image = cvCreateImage(cvSize(xsize, ysize), 8, in->nChannels);
     CvScalar fillval=cvScalarAll(0);
     cvWarpPerspective(in, warped_image, map_matrix, CV_WARP_FILL_OUTLIERS, fillval);
+    cvReleaseMat(&map_matrix);
+}
+
+IplImage *square_puzzle(IplImage *in, const CvPoint2D32f *location) {
+    int xsize = location[1].x - location[0].x;
+    int ysize = xsize;
+
+    IplImage *warped_image = cvCreateImage(cvSize(xsize, ysize), 8, in->nChannels);
+    _warp_puzzle(in, location, warped_image);
 
     return warped_image;
 }
 
+IplImage *square_puzzle_gray(IplImage *in, const CvPoint2D32f *location, int side) {
+    IplImage *gray_image = cvCreateImage(cvSize(side, side), 8, 1);
+    if (in->nChannels == 1) {
+        _warp_puzzle(in, location, gray_image);
+        return gray_image;
+    }
+
+    // warping first keeps the colour conversion down to the (small, fixed) output size.
+    IplImage *warped_image = cvCreateImage(cvSize(side, side), 8, in->nChannels);
+    _warp_puzzle(in, location, warped_image);
+    cvCvtColor(warped_image, gray_image, CV_BGR2GRAY);
+    cvReleaseImage(&warped_image);
+
+    return gray_image;
+}
+
+puzzle_context *create_squared_puzzle_context(puzzle_context *context, const CvPoint2D32f *location) {
+    if (context->options.canonical_cell_size > 0) {
+        int side = PUZZLE_SIZE_MAX * context->options.canonical_cell_size;
+        return _create_child_context(context, square_puzzle_gray(context->in, location, side));
+    }
+    return _create_child_context(context, square_puzzle(context->in, location));
+}
+
 static int _compare_means(void *means, const void *guess_a, const void *guess_b) {
     return ((unsigned long *)means)[*((unsigned short *)guess_b)] - ((unsigned long *)means)[*((unsigned short *)guess_a)];
 }
 
-enum { PUZZLE_SIZE_MIN = 3 };
-enum { PUZZLE_SIZE_MAX = 9 };
+static void _annotate_size(canvas *annotation, const bitmap *grid, puzzle_size size, int fuzz) {
+    for (unsigned short i = 1; i < size; ++i) {
+        int center = i * (grid->width / size);
+        _draw_rectangle(annotation, cvPoint(0, center - fuzz), cvPoint(grid->width, center + fuzz), CV_RGB(255, 0, 0), 2);
+        _draw_rectangle(annotation, cvPoint(center - fuzz, 0), cvPoint(center + fuzz, grid->height), CV_RGB(255, 0, 0), 2);
+    }
+}
 
-puzzle_size compute_puzzle_size(IplImage *puzzle, IplImage **annotated) {
-    IplImage *threshold_image = _grid(puzzle);
+// A projection profile of the grid image (ink per row, or per column) in running-sum form:
+// prefix[i + 1] - prefix[i] is the ink in row (or column) i, so the ink in any band of rows (or
+// columns) across the whole grid is two lookups. Both size estimators score their bands from
+// these.
+typedef struct grid_profile_s {
+    unsigned long *prefix;
+    int            length;
+} grid_profile;
+
+// The context's row profile, then its column profile (computed on first use; NULL without the
+// memory for them).
+static const grid_profile *_grid_profiles(puzzle_context *context) {
+    if (context->grid_profiles) {
+        return context->grid_profiles;
+    }
+
+    bitmap *grid = _grid(context);
+    grid_profile *profiles = arena_alloc(context->arena, 2 * sizeof(grid_profile));
+    unsigned long *rows    = arena_alloc(context->arena, (grid->height + 1) * sizeof(unsigned long));
+    unsigned long *columns = arena_alloc(context->arena, (grid->width + 1) * sizeof(unsigned long));
+    if ((profiles == NULL) || (rows == NULL) || (columns == NULL)) {
+        return NULL;
+    }
+
+    // rows are counted a word at a time; columns in one pass over the set bits.
+    for (int y = 0; y < grid->height; ++y) {
+        rows[y + 1] = rows[y] + bitmap_count(grid, 0, y, grid->width, y + 1);
+    }
+    bitmap_column_counts(grid, columns + 1);
+    for (int x = 0; x < grid->width; ++x) {
+        columns[x + 1] += columns[x];
+    }
 
-    *annotated = cvCloneImage(puzzle);
-    cvCvtColor(threshold_image, *annotated, CV_GRAY2RGB);
+    profiles[0] = (grid_profile){ rows, grid->height };
+    profiles[1] = (grid_profile){ columns, grid->width };
+    context->grid_profiles = profiles;
+    return profiles;
+}
+
+// ink in rows (or columns) [from, to), clipped to the profile.
+static unsigned long _band_ink(const grid_profile *p, int from, int to) {
+    from = (from < 0) ? 0 : from;
+    to   = (to > p->length) ? p->length : to;
+    return (to > from) ? (p->prefix[to] - p->prefix[from]) : 0;
+}
+
+static puzzle_size _compute_puzzle_size_by_bands(puzzle_context *context, IplImage **annotated) {
+    bitmap *grid = _grid(context);
+    const grid_profile *profiles = _grid_profiles(context);
+    if (profiles == NULL) {
+        return 0;
+    }
+
+    canvas annotation = _open_canvas(context, grid, annotated);
 
     // the logic here is to "rank" the possible sizes, by computing the average pixel intensity
     // in the vicinity of where the lines should be.
@@ -278,25 +882,16 @@ puzzle_size compute_puzzle_size(IplImage *puzzle, IplImage **annotated) {
     puzzle_size guesses[PUZZLE_SIZE_MAX - PUZZLE_SIZE_MIN + 1];
     unsigned long means[PUZZLE_SIZE_MAX + 1];
 
-    const int fuzz = threshold_image->width / 50;
+    const int fuzz = grid->width / 50;
     for (puzzle_size guess_size = PUZZLE_SIZE_MIN; guess_size <= PUZZLE_SIZE_MAX; ++guess_size) {
         guesses[guess_id++] = guess_size;
         means[guess_size] = 0;
 
         for (unsigned short i = 1; i < guess_size; ++i) {
-            int center = i * (threshold_image->width / guess_size);
-            for (int x = 0; x < threshold_image->width; ++x) {
-                for (int y = center - fuzz; y < center + fuzz; ++y) {
-                    CvScalar s = cvGet2D(threshold_image, y, x);
-                    means[guess_size] += s.val[0];
-                }
-            }
-            for (int x = center - fuzz; x < center + fuzz; ++x) {
-                for (int y = 0; y < threshold_image->height; ++y) {
-                    CvScalar s = cvGet2D(threshold_image, y, x);
-                    means[guess_size] += s.val[0];
-                }
-            }
+            int center = i * (grid->width / guess_size);
+            // horizontal band, then vertical band (ink pixels are 255).
+            means[guess_size] += 255 * _band_ink(&profiles[0], center - fuzz, center + fuzz);
+            means[guess_size] += 255 * _band_ink(&profiles[1], center - fuzz, center + fuzz);
         }
         means[guess_size] /= (guess_size - 1);
     }
@@ -314,181 +909,268 @@ puzzle_size compute_puzzle_size(IplImage *puzzle, IplImage **annotated) {
         }
     }
 
-    for (unsigned short i = 1; i < size; ++i) {
-        int center = i * (threshold_image->width / size);
-        cvRectangle(*annotated, cvPoint(0, center - fuzz), cvPoint(threshold_image->width, center + fuzz), CV_RGB(255, 0, 0), 2, 8, 0);
-        cvRectangle(*annotated, cvPoint(center - fuzz, 0), cvPoint(center + fuzz, threshold_image->height), CV_RGB(255, 0, 0), 2, 8, 0);
-    }
-    cvReleaseImage(&threshold_image);
+    _annotate_size(&annotation, grid, size, fuzz);
 
     return size;
 }
 
-typedef enum {
-    LEFT,
-    RIGHT,
-    TOP,
-    BOTTOM
-} border_direction;
+// mean ink per row/column within fuzz of center.
+static double _window_mean(const grid_profile *p, int center, int fuzz) {
+    return (double)_band_ink(p, center - fuzz, center + fuzz) / (2 * fuzz);
+}
+
+static int _line_center(const grid_profile *p, puzzle_size size, int i) {
+    return i * (p->length / size);
+}
 
-static short _border_dx(border_direction b) {
-    switch (b) {
-         case LEFT:  return -1;
-         case RIGHT: return 1;
-         default:    return 0;
+static double _line_mean(const grid_profile *p, puzzle_size size, int fuzz) {
+    double total = 0;
+    for (unsigned short i = 1; i < size; ++i) {
+        total += _window_mean(p, _line_center(p, size, i), fuzz);
     }
+    return total / (size - 1);
 }
 
-static short _border_dy(border_direction b) {
-    switch (b) {
-        case TOP:    return -1;
-        case BOTTOM: return 1;
-        default:     return 0;
+static double _weakest_line(const grid_profile *p, puzzle_size size, int fuzz) {
+    double weakest = INFINITY;
+    for (unsigned short i = 1; i < size; ++i) {
+        double mean = _window_mean(p, _line_center(p, size, i), fuzz);
+        weakest = (mean < weakest) ? mean : weakest;
     }
+    return weakest;
 }
 
-static void _explore_cage(int cage_id, int box_x, int box_y, int cage_ids[PUZZLE_SIZE_MAX][PUZZLE_SIZE_MAX], short cage_borders[PUZZLE_SIZE_MAX][PUZZLE_SIZE_MAX][4]) {
-    if (cage_ids[box_x][box_y] == cage_id) {
-        // been here already
-        return;
+// mean ink away from the lines of the given size, and away from the outline (which every size
+// has in common).
+static double _background_mean(const grid_profile *p, puzzle_size size, int fuzz) {
+    double total = _band_ink(p, fuzz, p->length - fuzz);
+    int count    = p->length - 2 * fuzz;
+    for (unsigned short i = 1; i < size; ++i) {
+        int center = _line_center(p, size, i);
+        total -= _band_ink(p, center - fuzz, center + fuzz);
+        count -= 2 * fuzz;
     }
-    cage_ids[box_x][box_y] = cage_id;
+    return (count > 0) ? (total / count) : 0;
+}
 
-    for (border_direction b = LEFT; b <= BOTTOM; ++b) {
-        if (! cage_borders[box_x][box_y][b]) {
-            _explore_cage(cage_id, box_x + _border_dx(b), box_y + _border_dy(b), cage_ids, cage_borders);
+// mean ink on the lines of finer that are not also lines of coarser (finer a multiple of coarser).
+static double _extra_line_mean(const grid_profile *p, puzzle_size coarser, puzzle_size finer, int fuzz) {
+    double total = 0;
+    int count    = 0;
+    for (unsigned short i = 1; i < finer; ++i) {
+        if ((i % (finer / coarser)) != 0) {
+            total += _window_mean(p, _line_center(p, finer, i), fuzz);
+            ++count;
         }
     }
-    return;
+    return total / count;
 }
 
-static CvScalar _getpixel(IplImage *threshold_image, IplImage **annotated, border_direction d, int across, int along) {
-    CvScalar pixel;
-    if (d == BOTTOM) {
-        pixel = cvGet2D(threshold_image, across, along);
-        if (pixel.val[0] == 0) {
-            cvSet2D(*annotated, across, along, CV_RGB(255, 0, 0));
-        } else {
-            cvSet2D(*annotated, across, along, CV_RGB(0, 0, 255));
+puzzle_size estimate_puzzle_size_with_context(puzzle_context *context, double *confidence, IplImage **annotated) {
+    bitmap *grid = _grid(context);
+
+    const int width  = grid->width;
+    const int height = grid->height;
+    const int fuzz   = (width / 50 > 0) ? (width / 50) : 1;
+
+    const grid_profile *profiles = _grid_profiles(context);
+    if (profiles == NULL) {
+        return 0;
+    }
+
+    canvas annotation = _open_canvas(context, grid, annotated);
+
+    puzzle_size size = PUZZLE_SIZE_MIN;
+    double certainty = 0;
+    if ((width > 2 * fuzz * PUZZLE_SIZE_MAX) && (height > 2 * fuzz * PUZZLE_SIZE_MAX)) {
+        // first pick the size whose lines stand out most from the background between them...
+        double contrast[PUZZLE_SIZE_MAX + 1];
+        for (puzzle_size guess_size = PUZZLE_SIZE_MIN; guess_size <= PUZZLE_SIZE_MAX; ++guess_size) {
+            contrast[guess_size] = 0;
+            for (int p = 0; p < 2; ++p) {
+                contrast[guess_size] += (_line_mean(&profiles[p], guess_size, fuzz) - _background_mean(&profiles[p], guess_size, fuzz)) / 2;
+            }
+            if (contrast[guess_size] > contrast[size]) {
+                size = guess_size;
+            }
         }
-    } else {
-        pixel = cvGet2D(threshold_image, along, across);
-        if (pixel.val[0] == 0) {
-            cvSet2D(*annotated, along, across, CV_RGB(255, 0, 0));
-        } else {
-            cvSet2D(*annotated, along, across, CV_RGB(0, 0, 255));
+
+        // ...which can't tell a size from its multiples (every line of a 4x4 is also a line of an
+        // 8x8, and an 8x8's extra lines barely move the background). So for each multiple, look at
+        // just its extra lines: if they are closer to the weakest line we already believe in than
+        // to the background, they are real lines and the puzzle is the finer size.
+        puzzle_size coarse = size;
+        double weakest    = 0;
+        double background = 0;
+        for (int p = 0; p < 2; ++p) {
+            weakest    += _weakest_line(&profiles[p], coarse, fuzz) / 2;
+            background += _background_mean(&profiles[p], coarse, fuzz) / 2;
+        }
+        double threshold = (weakest + background) / 2;
+        double harmonic_margin = 1;
+        for (puzzle_size finer = 2 * coarse; finer <= PUZZLE_SIZE_MAX; finer += coarse) {
+            double extra = 0;
+            for (int p = 0; p < 2; ++p) {
+                extra += _extra_line_mean(&profiles[p], coarse, finer, fuzz) / 2;
+            }
+            if (extra > threshold) {
+                size = finer;
+            }
+            if (weakest > background) {
+                double margin = fabs(extra - threshold) / ((weakest - background) / 2);
+                harmonic_margin = (margin < harmonic_margin) ? margin : harmonic_margin;
+            }
+        }
+
+        // how far ahead the winner is of the best size which isn't a multiple or divisor of it.
+        double rival = 0;
+        for (puzzle_size guess_size = PUZZLE_SIZE_MIN; guess_size <= PUZZLE_SIZE_MAX; ++guess_size) {
+            if (((guess_size % coarse) != 0) && ((coarse % guess_size) != 0) && (contrast[guess_size] > rival)) {
+                rival = contrast[guess_size];
+            }
         }
+        double rival_margin = (contrast[coarse] > 0) ? ((contrast[coarse] - rival) / contrast[coarse]) : 0;
+
+        certainty = (rival_margin < harmonic_margin) ? rival_margin : harmonic_margin;
     }
-    return pixel;
-}
 
-static short *_getborder(short cage_borders[PUZZLE_SIZE_MAX][PUZZLE_SIZE_MAX][4], border_direction d, int across, int along) {
-    if ((d == BOTTOM) || (d == TOP)) {
-        return &(cage_borders[along][across][d]);
+    if (confidence) {
+        *confidence = certainty;
     }
-    return &(cage_borders[across][along][d]);
-}
 
-static void _find_cage_borders(IplImage *threshold_image, IplImage **annotated, puzzle_size size, border_direction direction, border_direction opposite, short cage_borders[PUZZLE_SIZE_MAX][PUZZLE_SIZE_MAX][4]) {
-    assert(threshold_image->height == threshold_image->width);
+    _annotate_size(&annotation, grid, size, fuzz);
 
-    int px_size = threshold_image->height;
+    return size;
+}
 
-    // first figure out, for this puzzle, the difference between a cage border and
-    // a regular edge. We'll do this via the mean intensity of the rough location
-    // where we expect the edges to be.
-    int fuzz_along  = px_size / (size * 3.9);
-    int fuzz_across = px_size / (size * 4.0);
+puzzle_size compute_puzzle_size_with_context(puzzle_context *context, IplImage **annotated) {
+    if (context->options.size_estimator == SIZE_BY_PROFILE) {
+        return estimate_puzzle_size_with_context(context, NULL, annotated);
+    }
+    return _compute_puzzle_size_by_bands(context, annotated);
+}
 
-    int means[size][size];
-    int mean_max = -1;
-    int mean_min = -1;
-    for (int box_along = 0; box_along < size; ++box_along) {
-        int along_center = (2 * box_along + 1) * (px_size / size / 2);
-        for (int box_across = 0; box_across < (size - 1); ++box_across) {
-            int across_center = (box_across + 1) * (px_size / size);
+puzzle_size compute_puzzle_size(IplImage *puzzle, IplImage **annotated) {
+    puzzle_context *context = create_puzzle_context(puzzle, NULL);
+    if (context == NULL) {
+        return 0;
+    }
+    context->caller_owns_annotated = 1;
+    puzzle_size size = compute_puzzle_size_with_context(context, annotated);
+    release_puzzle_context(&context);
+    return size;
+}
 
-            long total = 0;
-            for (int across = across_center - fuzz_across; across <= across_center + fuzz_across; ++across) {
-                for (int along = along_center - fuzz_along; along <= along_center + fuzz_along; ++along) {
-                    CvScalar s = _getpixel(threshold_image, annotated, direction, across, along);
-                    total += s.val[0];
-                }
-            }
+char *compute_puzzle_cages_with_context(puzzle_context *context, puzzle_size size, IplImage **annotated) {
+    if ((size < PUZZLE_SIZE_MIN) || (size > PUZZLE_SIZE_MAX)) {
+        return NULL;
+    }
 
-            int mean = total / ((2 * fuzz_along + 1) * (2 * fuzz_across + 1));
-            means[box_across][box_along] = mean;
-            if ((mean_max == -1) || (mean > mean_max)) {
-                mean_max = mean;
+    bitmap *grid = _grid(context);
+    assert(grid->height == grid->width);
+
+    canvas annotation = _open_canvas(context, grid, annotated);
+    if (annotation.image || annotation.list) {
+        // show every sampled pixel: red for blank, blue for ink.
+        cage_sample samples[CAGE_SAMPLES_MAX];
+        int sample_n = cage_samples(grid->width, size, samples);
+        for (int i = 0; i < sample_n; ++i) {
+            cage_sample s = samples[i];
+            if (annotation.image) {
+                paint_mask(grid, annotation.image, cvRect(s.x0, s.y0, s.x1 - s.x0 + 1, s.y1 - s.y0 + 1),
+                    CV_RGB(255, 0, 0), CV_RGB(0, 0, 255));
             }
-            if ((mean_min == -1) || (mean < mean_min)) {
-                mean_min = mean;
+            if (annotation.list) {
+                add_annotation(annotation.list, ANNOTATION_RECTANGLE, cvPoint(s.x0, s.y0), cvPoint(s.x1, s.y1), CV_RGB(0, 0, 255), 1);
             }
         }
     }
 
-    for (int box_along = 0; box_along < size; ++box_along) {
-        int box_across;
-        for (box_across = 0; box_across < (size - 1); ++box_across) {
-            int delta_min = abs(means[box_across][box_along] - mean_min);
-            int delta_max = abs(means[box_across][box_along] - mean_max);
-            *(_getborder(cage_borders, direction, box_across, box_along)) = (delta_max < delta_min);
-        }
-        *(_getborder(cage_borders, direction, box_across, box_along)) = 1;
-    }
-    for (int box_along = 0; box_along < size; ++box_along) {
-        int box_across = 0;
-        *(_getborder(cage_borders, opposite, box_across, box_along)) = 1;
-        for (box_across = 1; box_across < size; ++box_across) {
-            *(_getborder(cage_borders, opposite, box_across, box_along)) = *(_getborder(cage_borders, direction, box_across - 1, box_along));
-        }
+    char *puzzle_cages = arena_alloc(context->arena, size * size + 1);
+    if (puzzle_cages == NULL) {
+        return NULL;
     }
+    find_cages(grid, size, puzzle_cages);
 
-    return;
+    return puzzle_cages;
 }
 
 char *compute_puzzle_cages(IplImage *puzzle, puzzle_size size, IplImage **annotated) {
-    IplImage *threshold_image = _grid(puzzle);
+    puzzle_context *context = create_puzzle_context(puzzle, NULL);
+    if (context == NULL) {
+        return NULL;
+    }
+    context->caller_owns_annotated = 1;
 
-    *annotated = cvCloneImage(puzzle);
-    cvCvtColor(threshold_image, *annotated, CV_GRAY2RGB);
+    char *cages = NULL;
+    const char *found = compute_puzzle_cages_with_context(context, size, annotated);
+    if (found && (cages = malloc(strlen(found) + 1))) {
+        strcpy(cages, found);
+    }
 
-    short cage_borders[PUZZLE_SIZE_MAX][PUZZLE_SIZE_MAX][4];
+    release_puzzle_context(&context);
+    return cages;
+}
 
-    _find_cage_borders(threshold_image, annotated, size, RIGHT, LEFT, cage_borders);
-    _find_cage_borders(threshold_image, annotated, size, BOTTOM, TOP, cage_borders);
+void release_puzzle_cages(char **cages) {
+    if (cages == NULL) {
+        return;
+    }
+    free(*cages);
+    *cages = NULL;
+}
 
-    int cage_ids[PUZZLE_SIZE_MAX][PUZZLE_SIZE_MAX];
-    for (int box_x = 0; box_x < size; ++box_x) {
-        for (int box_y = 0; box_y < size; ++box_y) {
-            cage_ids[box_x][box_y] = -1;
-        }
+char *compute_puzzle_clues_with_context(puzzle_context *context, puzzle_size size, const char *cages,
+        IplImage **annotated) {
+    IplImage *gray = _gray(context);
+    assert(gray->width == gray->height);
+
+    canvas annotation = _open_canvas(context, _grid(context), annotated);
+    // (only kept if they're to be drawn)
+    clue_glyph glyphs[CLUES_LENGTH_MAX];
+    int glyph_n = 0;
+    const int drawn = annotation.image || annotation.list;
+
+    char *puzzle_clues = arena_alloc(context->arena, CLUES_LENGTH_MAX);
+    if (puzzle_clues == NULL) {
+        return NULL;
+    }
+    if (read_clues((const unsigned char *)gray->imageData, gray->widthStep, gray->width, size, cages, puzzle_clues,
+            drawn ? glyphs : NULL, &glyph_n) < 0) {
+        return NULL;
     }
 
-    // pass through the puzzle from top to bottom, left to right, propagating cage_id values
-    // through edges which are not cage borders.
-    int next_cage_id = 0;
-    for (int box_y = 0; box_y < size; ++box_y) {
-        for (int box_x = 0; box_x < size; ++box_x) {
-            if (cage_ids[box_x][box_y] == -1) {
-                _explore_cage(next_cage_id++, box_x, box_y, cage_ids, cage_borders);
-            }
-        }
+    // each character read in green, or in red if it couldn't be.
+    for (int g = 0; g < glyph_n; ++g) {
+        _draw_rectangle(&annotation, cvPoint(glyphs[g].x0, glyphs[g].y0), cvPoint(glyphs[g].x1, glyphs[g].y1),
+            (glyphs[g].symbol == '?') ? CV_RGB(255, 0, 0) : CV_RGB(0, 255, 0), 1);
     }
+    return puzzle_clues;
+}
 
-    // serialize the cages into string representation
-    static char puzzle_cages[PUZZLE_SIZE_MAX * PUZZLE_SIZE_MAX + 1];
-    static char cage_names[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-    int i = 0;
-    for (int box_y = 0; box_y < size; ++box_y) {
-        for (int box_x = 0; box_x < size; ++box_x) {
-            puzzle_cages[i++] = cage_names[cage_ids[box_x][box_y]];
-        }
+char *compute_puzzle_clues(IplImage *puzzle, puzzle_size size, const char *cages, IplImage **annotated) {
+    puzzle_context *context = create_puzzle_context(puzzle, NULL);
+    if (context == NULL) {
+        return NULL;
     }
-    puzzle_cages[i] = 0;
+    context->caller_owns_annotated = 1;
 
-    cvReleaseImage(&threshold_image);
-    return puzzle_cages;
+    char *clues = NULL;
+    const char *read = compute_puzzle_clues_with_context(context, size, cages, annotated);
+    if (read && (clues = malloc(strlen(read) + 1))) {
+        strcpy(clues, read);
+    }
+
+    release_puzzle_context(&context);
+    return clues;
+}
+
+void release_puzzle_clues(char **clues) {
+    if (clues == NULL) {
+        return;
+    }
+    free(*clues);
+    *clues = NULL;
 }
 
 void showSmaller (IplImage *in, char *window_name) {
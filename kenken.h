@@ -4,15 +4,158 @@
 #include "cv.h"
 #include "highgui.h"
 
+#include "annotations.h"
+#include "bitmap.h"
+#include "pool.h"
+
+typedef unsigned short puzzle_size;
+
+// A puzzle_context caches the intermediate images (grayscale, threshold, grid) and the puzzle
+// contour computed from one input image, so that several analyses of the same image only pay
+// for them once. The input image must outlive the context.
+//
+// Everything a context allocates (caches, results, annotated images) is owned by it and freed in
+// one go by release_puzzle_context, so a long-running process which releases its contexts keeps a
+// flat footprint.
+typedef struct puzzle_context_s puzzle_context;
+
+typedef enum {
+    // grayscale conversion and adaptive thresholding fused into one pass (see threshold.h). Not
+    // the default until bench_threshold finds it matching THRESHOLD_OPENCV pixel for pixel over
+    // the test photos.
+    THRESHOLD_FUSED,
+    // cvCvtColor followed by cvAdaptiveThreshold (the default)
+    THRESHOLD_OPENCV
+} threshold_method;
+
+typedef enum {
+    // rank every candidate size by the ink in bands where its lines would be
+    SIZE_BY_BANDS,
+    // the same band scoring, but over one row and one column profile of the grid (rather than the
+    // grid image itself), with multiples of the best size checked for their extra lines
+    SIZE_BY_PROFILE
+} size_estimator;
+
+typedef enum {
+    // threshold, contour and Hough transform over the whole input
+    LOCATE_FULL_RESOLUTION,
+    // the same on a downscaled copy, then each corner refined in a small full-resolution window
+    // (falling back to full resolution if the puzzle isn't found)
+    LOCATE_PYRAMID
+} locate_mode;
+
+typedef enum {
+    // straight from the puzzle's outline, if that is a quadrilateral (otherwise as below)
+    CORNERS_BY_CONTOUR,
+    // intersecting the outline's sides, as found by a Hough transform
+    CORNERS_BY_HOUGH
+} corner_method;
+
+typedef struct {
+    threshold_method threshold;
+    size_estimator   size_estimator;
+    // if set, thresholding's per-pixel scans are split into bands of rows across its workers.
+    // Results are the same with or without it. The pool must outlive every context using it.
+    work_pool       *pool;
+    locate_mode      locate;
+    // LOCATE_PYRAMID halves the input until it is no wider than this.
+    int              pyramid_width;
+    corner_method    corners;
+    // if > 0, squared contexts (see create_squared_puzzle_context) analyse a grayscale square of
+    // this many pixels per cell of a 9x9 puzzle, whatever the size of the photo; otherwise a colour
+    // square as big as the puzzle is in the photo.
+    int              canonical_cell_size;
+} puzzle_options;
+
+// DEFAULT_PUZZLE_OPTIONS, for initializing other constants which embed it.
+#define DEFAULT_PUZZLE_OPTIONS_INITIALIZER \
+    { THRESHOLD_OPENCV, SIZE_BY_BANDS, NULL, LOCATE_FULL_RESOLUTION, 800, CORNERS_BY_CONTOUR, 0 }
+
+extern const puzzle_options DEFAULT_PUZZLE_OPTIONS;
+
+// options may be NULL, meaning DEFAULT_PUZZLE_OPTIONS.
+puzzle_context *create_puzzle_context(IplImage *in, const puzzle_options *options);
+void release_puzzle_context(puzzle_context **context);
+
+// The pixel layouts create_puzzle_context_from_pixels reads.
+typedef enum {
+    // 3 bytes per pixel: blue, green, red (as cvLoadImage gives them)
+    PIXELS_BGR,
+    // 1 byte of luma per pixel
+    PIXELS_GRAY,
+    // a plane of 1 byte of luma per pixel, followed by a half-resolution plane of interleaved
+    // chroma (as cameras and video decoders give them). Only the luma plane is read.
+    PIXELS_NV12
+} pixel_format;
+
+// A context reading width x height pixels of the given format straight out of the caller's
+// buffer, stride bytes per row (of the luma plane, for NV12): nothing is copied, and grayscale and
+// NV12 input skip colour conversion altogether. The buffer must outlive the context, and must not
+// change while it is in use. puzzle_context_image gives a header over the buffer (single-channel,
+// unless the format is PIXELS_BGR). NULL if the dimensions make no sense.
+puzzle_context *create_puzzle_context_from_pixels(const unsigned char *pixels, int width, int height, int stride,
+    pixel_format format, const puzzle_options *options);
+
+// A context for the squared-up puzzle at location in the context's image (see square_puzzle),
+// with the same options and annotation list. It belongs to context, and is released with it;
+// releasing it directly does nothing.
+puzzle_context *create_squared_puzzle_context(puzzle_context *context, const CvPoint2D32f *location);
+IplImage *puzzle_context_image(const puzzle_context *context);
+
+// The context's grid image, packed: the puzzle's outline and every line joined to it (computed on
+// first use, and owned by the context).
+const bitmap *puzzle_context_grid(puzzle_context *context);
+
+typedef enum {
+    // not (yet) located
+    LOCATED_NOWHERE,
+    LOCATED_BY_CONTOUR,
+    LOCATED_BY_HOUGH
+} locate_path;
+
+// which way locate_puzzle_with_context found the puzzle (in pyramid mode, at the coarse level).
+locate_path puzzle_context_locate_path(const puzzle_context *context);
+
+// While list is set (NULL to stop), every analysis run on the context appends what it draws to
+// the list, whether or not an annotated image was asked for. See render_annotations.
+void record_puzzle_annotations(puzzle_context *context, annotations *list);
+
+// In all of the following, annotated may be NULL, in which case no annotated image is produced
+// (and none of its cost is paid). Otherwise *annotated receives a new image, owned by the context.
+// Results are also owned by the context, and are valid until it is released.
+const CvPoint2D32f* locate_puzzle_with_context(puzzle_context *context, IplImage **annotated);
+puzzle_size compute_puzzle_size_with_context(puzzle_context *context, IplImage **annotated);
+// SIZE_BY_PROFILE directly, also reporting how clearly the winning size beat the runner-up (0 = a
+// coin toss, 1 = no contest). confidence may be NULL. 0 without the memory for the profiles.
+puzzle_size estimate_puzzle_size_with_context(puzzle_context *context, double *confidence, IplImage **annotated);
+char *compute_puzzle_cages_with_context(puzzle_context *context, puzzle_size size, IplImage **annotated);
+// The clue of each cage of the cage layout cages (as computed above), in cage order, separated by
+// spaces, e.g. "12x 3- 5=" (see read_clues). The context must be of a squared puzzle. NULL if the
+// size is out of range.
+char *compute_puzzle_clues_with_context(puzzle_context *context, puzzle_size size, const char *cages,
+    IplImage **annotated);
+
+// one-shot equivalents of the above, each using a throwaway context. Here the caller owns (and
+// releases) the annotated images, the location and the cages. Without the memory for the context
+// (or for the copy returned), each fails as the above do: NULL, or a size of 0.
+//
+// Nothing here keeps any state between calls, so any of these (and any analysis of a context) may
+// run concurrently with another, as long as no context (counting a squared context as part of its
+// parent) or annotation list is used by two threads at once. showSmaller is the exception.
 const CvPoint2D32f* locate_puzzle(IplImage *in, IplImage **annotated);
+void release_puzzle_location(const CvPoint2D32f **location);
 
 IplImage *square_puzzle(IplImage *in, const CvPoint2D32f *location);
-
-typedef unsigned short puzzle_size;
+// the same, but always side x side, and single-channel 8-bit.
+IplImage *square_puzzle_gray(IplImage *in, const CvPoint2D32f *location, int side);
 
 puzzle_size compute_puzzle_size(IplImage *puzzle, IplImage **annotated);
 
 char *compute_puzzle_cages(IplImage *puzzle, puzzle_size size, IplImage **annotated);
+void release_puzzle_cages(char **cages);
+
+char *compute_puzzle_clues(IplImage *puzzle, puzzle_size size, const char *cages, IplImage **annotated);
+void release_puzzle_clues(char **clues);
 
 void showSmaller (IplImage *in, char *window_name);
 
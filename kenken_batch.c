@@ -0,0 +1,149 @@
+#include <getopt.h>
+#include <stdio.h>
+
+#include "batch.h"
+
+// Analyses photos in bulk through the batch pipeline, printing one line per photo:
+//
+//   index <tab> path <tab> status <tab> size <tab> cages
+//
+// Photos are taken from the command line, or one path per line from stdin if there are none.
+// --repeat submits the command line photos that many times over (for throughput runs on a
+// replicated corpus). --cache keeps what the analysis made of each photo in a file, so that a
+// photo seen before (in this run or an earlier one) isn't analysed again. Throughput, and how
+// often the cache was hit, go to stderr at the end.
+
+static void usage(void) {
+    fprintf(stderr, "usage: ./kenken_batch [ --workers decode,locate,size,cages ] [ --queue n ] [ --unordered ] [ --repeat n ] [ --canonical cell_pixels ] [ --decode_width pixels ] [ --cache path ] [ --cache_entries n ] [ image... ]\n");
+    exit(255);
+}
+
+static struct option options[] = {
+    { "workers",       required_argument, NULL, 'w' },
+    { "queue",         required_argument, NULL, 'q' },
+    { "unordered",     no_argument,       NULL, 'u' },
+    { "repeat",        required_argument, NULL, 'r' },
+    { "canonical",     required_argument, NULL, 'c' },
+    { "decode_width",  required_argument, NULL, 'd' },
+    { "cache",         required_argument, NULL, 'k' },
+    { "cache_entries", required_argument, NULL, 'e' },
+    { NULL,            0,                 NULL, 0   }
+};
+
+static const char *STATUS_NAMES[] = { "solved", "unreadable", "no_puzzle", "no_memory" };
+
+static void print_result(const batch_result *result, void *argument) {
+    long *counts = argument;
+    ++counts[result->status];
+    if (result->status == BATCH_SOLVED) {
+        printf("%ld\t%s\t%s\t%d\t%s\n", result->index, result->path, STATUS_NAMES[result->status], result->size, result->cages);
+    } else {
+        printf("%ld\t%s\t%s\t\t\n", result->index, result->path, STATUS_NAMES[result->status]);
+    }
+}
+
+// 1 if path was queued.
+static int submit(batch *b, const char *path) {
+    if (batch_submit(b, path)) {
+        return 1;
+    }
+    fprintf(stderr, "no memory to queue %s\n", path);
+    return 0;
+}
+
+int main (int argc, char** argv) {
+    batch_options pipeline_options = DEFAULT_BATCH_OPTIONS;
+    cache_options caching = DEFAULT_CACHE_OPTIONS;
+    int repeat = 1;
+    char ch;
+    while ((ch = getopt_long(argc, argv, "w:q:ur:c:d:k:e:", options, NULL)) != -1) {
+        switch (ch) {
+            case 'w':
+                if (sscanf(optarg, "%d,%d,%d,%d", &pipeline_options.workers[DECODE_STAGE], &pipeline_options.workers[LOCATE_STAGE],
+                        &pipeline_options.workers[SIZE_STAGE], &pipeline_options.workers[CAGES_STAGE]) != BATCH_STAGES) {
+                    usage();
+                }
+                break;
+            case 'q':
+                pipeline_options.queue_capacity = atoi(optarg);
+                break;
+            case 'u':
+                pipeline_options.ordered = 0;
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                if (repeat < 1) {
+                    usage();
+                }
+                break;
+            case 'c':
+                // bounded work per photo after the warp, however big the photo.
+                pipeline_options.analysis.canonical_cell_size = atoi(optarg);
+                break;
+            case 'd':
+                // decode JPEGs no bigger than the analysis needs.
+                pipeline_options.decode_width = atoi(optarg);
+                break;
+            case 'k':
+                caching.path = optarg;
+                break;
+            case 'e':
+                caching.capacity = atoi(optarg);
+                if (caching.capacity < 1) {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (caching.path) {
+        caching.analysis = pipeline_options.analysis;
+        pipeline_options.cache = create_result_cache(&caching);
+        if (pipeline_options.cache == NULL) {
+            fprintf(stderr, "couldn't open the cache at %s (or another process has it)\n", caching.path);
+            exit(255);
+        }
+    }
+
+    long counts[BATCH_NO_MEMORY + 1] = { 0 };
+    batch *b = create_batch(&pipeline_options, print_result, counts);
+    if (b == NULL) {
+        fprintf(stderr, "couldn't start the pipeline\n");
+        exit(255);
+    }
+
+    int64 start = cvGetTickCount();
+    long submitted = 0;
+    for (int r = 0; r < repeat; ++r) {
+        if (optind < argc) {
+            for (int i = optind; i < argc; ++i) {
+                submitted += submit(b, argv[i]);
+            }
+        } else if (r == 0) {
+            char line[4096];
+            while (fgets(line, sizeof(line), stdin) != NULL) {
+                line[strcspn(line, "\r\n")] = 0;
+                if (line[0] != 0) {
+                    submitted += submit(b, line);
+                }
+            }
+        }
+    }
+    release_batch(&b);
+
+    double seconds = (cvGetTickCount() - start) / (cvGetTickFrequency() * 1e6);
+    fprintf(stderr, "%ld photos (%ld solved, %ld unreadable, %ld without a puzzle, %ld out of memory) in %.2fs: %.1f photos/s\n",
+        submitted, counts[BATCH_SOLVED], counts[BATCH_UNREADABLE], counts[BATCH_NO_PUZZLE], counts[BATCH_NO_MEMORY],
+        seconds, (seconds > 0) ? (submitted / seconds) : 0);
+    if (pipeline_options.cache) {
+        cache_counters counters = result_cache_counters(pipeline_options.cache);
+        fprintf(stderr, "cache: %ld of %ld photos hit (%.0f%%), saving %.2fs of analysis\n", counters.hits,
+            counters.lookups, (counters.lookups > 0) ? (100. * counters.hits / counters.lookups) : 0,
+            counters.saved_ms / 1000);
+        release_result_cache(&(pipeline_options.cache));
+    }
+
+    return 0;
+}
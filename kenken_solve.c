@@ -0,0 +1,399 @@
+// for clock_gettime
+#define _POSIX_C_SOURCE 200112L
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "solver.h"
+
+// Solves puzzles in bulk, one per line (as parse_puzzle reads them: a cage layout, then its
+// clues), from a file or from stdin, printing one line per puzzle:
+//
+//   index <tab> status <tab> solution
+//
+// where index counts the puzzles from 0 (blank lines aren't puzzles), status is one of solved,
+// unsolvable, malformed or abandoned, and the solution is the value of every cell, in reading
+// order. A puzzle is abandoned once it has taken --limit guesses (see solve_puzzle_within) without
+// an answer, so that no one puzzle holds up the rest; 0 is no limit.
+//
+// Lines are read in chunks, which a set of worker threads solve, each its own chunk at a time; a
+// chunk's results are written out in one go. Chunks are reused, so the buffers for lines and
+// results don't grow with the number of puzzles (the solver still allocates its working memory
+// afresh for each puzzle). Results come out in the order of the input, unless --unordered, when
+// each chunk comes out as soon as it's done. --repeat reads the file that many times over (for
+// throughput runs on a small corpus). Throughput goes to stderr at the end.
+
+// the longest line read as a puzzle (a 9x9 layout with a long clue for each of 52 cages fits
+// easily); anything longer is malformed.
+enum { LINE_LENGTH_MAX = 1024 };
+// what one result line takes, at most: an index, a status and a 9x9 solution.
+enum { RESULT_LENGTH_MAX = 128 };
+// (the hardest 9x9 puzzles bench_solver turns up take some thousands)
+enum { DEFAULT_GUESS_LIMIT = 100000 };
+
+typedef enum {
+    SOLVE_SOLVED,
+    SOLVE_UNSOLVABLE,
+    SOLVE_MALFORMED,
+    SOLVE_ABANDONED
+} solve_status;
+
+static const char *STATUS_NAMES[] = { "solved", "unsolvable", "malformed", "abandoned" };
+
+// lines of input, and (once solved) their results.
+typedef struct chunk_s {
+    // the first puzzle's index
+    long             index;
+    int              line_n;
+    // line i is text + line_start[i]; the text is line_n lines of up to LINE_LENGTH_MAX.
+    char            *text;
+    int             *line_start;
+    char            *results;
+    size_t           result_length;
+    long             counts[SOLVE_ABANDONED + 1];
+    // next in a queue, or in the list of chunks waiting for an earlier one (ordered output).
+    struct chunk_s  *next;
+} chunk;
+
+// chunks waiting for a worker (or for the reader, once they're written out).
+typedef struct {
+    chunk           *head;
+    chunk           *tail;
+    // set once nothing more will be pushed.
+    unsigned short   closed;
+    pthread_mutex_t  lock;
+    pthread_cond_t   not_empty;
+} chunk_queue;
+
+typedef struct {
+    int              chunk_lines;
+    unsigned short   ordered;
+    long             guess_limit;
+    chunk_queue      empty;
+    chunk_queue      full;
+
+    // output, one chunk at a time.
+    pthread_mutex_t  write_lock;
+    long             next_index;
+    // solved chunks which are waiting for an earlier one, sorted by index (ordered output).
+    chunk           *pending;
+    long             counts[SOLVE_ABANDONED + 1];
+} solve_run;
+
+static void _init_queue(chunk_queue *q) {
+    q->head   = NULL;
+    q->tail   = NULL;
+    q->closed = 0;
+    pthread_mutex_init(&(q->lock), NULL);
+    pthread_cond_init(&(q->not_empty), NULL);
+}
+
+static void _destroy_queue(chunk_queue *q) {
+    pthread_cond_destroy(&(q->not_empty));
+    pthread_mutex_destroy(&(q->lock));
+}
+
+static void _push(chunk_queue *q, chunk *c) {
+    pthread_mutex_lock(&(q->lock));
+    c->next = NULL;
+    if (q->tail) {
+        q->tail->next = c;
+    } else {
+        q->head = c;
+    }
+    q->tail = c;
+    pthread_cond_signal(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
+// the next chunk, or NULL once the queue is closed and empty.
+static chunk *_pop(chunk_queue *q) {
+    pthread_mutex_lock(&(q->lock));
+    while ((q->head == NULL) && (! q->closed)) {
+        pthread_cond_wait(&(q->not_empty), &(q->lock));
+    }
+    chunk *c = q->head;
+    if (c) {
+        q->head = c->next;
+        q->tail = q->head ? q->tail : NULL;
+    }
+    pthread_mutex_unlock(&(q->lock));
+    return c;
+}
+
+static void _close(chunk_queue *q) {
+    pthread_mutex_lock(&(q->lock));
+    q->closed = 1;
+    pthread_cond_broadcast(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
+static chunk *_create_chunk(int lines) {
+    chunk *c = calloc(1, sizeof(chunk));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->text       = malloc((size_t)lines * LINE_LENGTH_MAX);
+    c->line_start = malloc(lines * sizeof(int));
+    c->results    = malloc((size_t)lines * RESULT_LENGTH_MAX);
+    if ((c->text == NULL) || (c->line_start == NULL) || (c->results == NULL)) {
+        free(c->text);
+        free(c->line_start);
+        free(c->results);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void _release_chunk(chunk **c) {
+    if ((c == NULL) || (*c == NULL)) {
+        return;
+    }
+    free((*c)->text);
+    free((*c)->line_start);
+    free((*c)->results);
+    free(*c);
+    *c = NULL;
+}
+
+// Fills c with up to chunk_lines puzzles from in. Returns the number read: fewer than
+// chunk_lines only at the end of in.
+static int _read_chunk(FILE *in, chunk *c, int chunk_lines) {
+    c->line_n = 0;
+    size_t used = 0;
+    while (c->line_n < chunk_lines) {
+        char *line = c->text + used;
+        if (fgets(line, LINE_LENGTH_MAX, in) == NULL) {
+            break;
+        }
+        size_t length = strlen(line);
+        if ((length == LINE_LENGTH_MAX - 1) && (line[length - 1] != '\n')) {
+            // too long to be a puzzle: the rest of it is skipped, and what's left can't be read.
+            int ch;
+            while (((ch = fgetc(in)) != EOF) && (ch != '\n')) {
+            }
+            strcpy(line, "?");
+            length = 1;
+        }
+        if (line[strspn(line, " \t\r\n")] == 0) {
+            continue;
+        }
+        c->line_start[c->line_n++] = (int)used;
+        used += length + 1;
+    }
+    return c->line_n;
+}
+
+static void _solve_chunk(chunk *c, long guess_limit) {
+    memset(c->counts, 0, sizeof(c->counts));
+    c->result_length = 0;
+    for (int i = 0; i < c->line_n; ++i) {
+        kenken_puzzle puzzle;
+        char cages[CAGES_SIZE_MAX * CAGES_SIZE_MAX + 1];
+        cage_clue clues[PUZZLE_CAGES_MAX];
+        unsigned char solution[CAGES_SIZE_MAX * CAGES_SIZE_MAX];
+
+        solve_status status = SOLVE_MALFORMED;
+        if (parse_puzzle(c->text + c->line_start[i], &puzzle, cages, clues)) {
+            int solved = solve_puzzle_within(&puzzle, guess_limit, solution, NULL);
+            status = (solved == 1) ? SOLVE_SOLVED : (solved == 0) ? SOLVE_UNSOLVABLE :
+                (solved == -2) ? SOLVE_ABANDONED : SOLVE_MALFORMED;
+        }
+        ++c->counts[status];
+
+        char *out = c->results + c->result_length;
+        int length = sprintf(out, "%ld\t%s\t", c->index + i, STATUS_NAMES[status]);
+        if (status == SOLVE_SOLVED) {
+            for (int cell = 0; cell < puzzle.size * puzzle.size; ++cell) {
+                out[length++] = (char)('0' + solution[cell]);
+            }
+        }
+        out[length++] = '\n';
+        c->result_length += length;
+    }
+}
+
+static void _write_chunk(solve_run *run, chunk *c) {
+    fwrite(c->results, 1, c->result_length, stdout);
+    for (int s = 0; s <= SOLVE_ABANDONED; ++s) {
+        run->counts[s] += c->counts[s];
+    }
+    run->next_index = c->index + c->line_n;
+    _push(&(run->empty), c);
+}
+
+static void _deliver(solve_run *run, chunk *c) {
+    pthread_mutex_lock(&(run->write_lock));
+    if (! run->ordered) {
+        _write_chunk(run, c);
+    } else {
+        chunk **p = &(run->pending);
+        while ((*p != NULL) && ((*p)->index < c->index)) {
+            p = &((*p)->next);
+        }
+        c->next = *p;
+        *p = c;
+
+        while ((run->pending != NULL) && (run->pending->index == run->next_index)) {
+            chunk *ready = run->pending;
+            run->pending = ready->next;
+            _write_chunk(run, ready);
+        }
+    }
+    pthread_mutex_unlock(&(run->write_lock));
+}
+
+static void *_worker(void *argument) {
+    solve_run *run = argument;
+    chunk *c;
+    while ((c = _pop(&(run->full))) != NULL) {
+        _solve_chunk(c, run->guess_limit);
+        _deliver(run, c);
+    }
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: ./kenken_solve [ --workers n ] [ --chunk lines ] [ --unordered ] [ --repeat n ] [ --limit guesses ] [ puzzles ]\n");
+    exit(255);
+}
+
+static struct option options[] = {
+    { "workers",   required_argument, NULL, 'w' },
+    { "chunk",     required_argument, NULL, 'c' },
+    { "unordered", no_argument,       NULL, 'u' },
+    { "repeat",    required_argument, NULL, 'r' },
+    { "limit",     required_argument, NULL, 'l' },
+    { NULL,        0,                 NULL, 0   }
+};
+
+int main (int argc, char** argv) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = (cores > 0) ? (int)cores : 1;
+    int repeat = 1;
+    solve_run run;
+    memset(&run, 0, sizeof(run));
+    run.chunk_lines = 256;
+    run.ordered     = 1;
+    run.guess_limit = DEFAULT_GUESS_LIMIT;
+    char ch;
+    while ((ch = getopt_long(argc, argv, "w:c:ur:l:", options, NULL)) != -1) {
+        switch (ch) {
+            case 'w':
+                workers = atoi(optarg);
+                if (workers < 1) {
+                    usage();
+                }
+                break;
+            case 'c':
+                run.chunk_lines = atoi(optarg);
+                if (run.chunk_lines < 1) {
+                    usage();
+                }
+                break;
+            case 'u':
+                run.ordered = 0;
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                if (repeat < 1) {
+                    usage();
+                }
+                break;
+            case 'l':
+                run.guess_limit = atol(optarg);
+                if (run.guess_limit < 0) {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+    if ((optind + 1 < argc) || ((repeat > 1) && (optind == argc))) {
+        usage();
+    }
+    FILE *in = (optind < argc) ? fopen(argv[optind], "r") : stdin;
+    if (in == NULL) {
+        fprintf(stderr, "couldn't open %s\n", argv[optind]);
+        exit(255);
+    }
+
+    _init_queue(&(run.empty));
+    _init_queue(&(run.full));
+    pthread_mutex_init(&(run.write_lock), NULL);
+    // two chunks a worker: one being solved, one read ahead (or waiting its turn to be written).
+    int chunk_n = 0;
+    chunk **chunks = calloc(2 * workers, sizeof(chunk *));
+    for (int i = 0; (chunks != NULL) && (i < 2 * workers); ++i) {
+        if ((chunks[i] = _create_chunk(run.chunk_lines)) == NULL) {
+            break;
+        }
+        _push(&(run.empty), chunks[i]);
+        ++chunk_n;
+    }
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; (chunk_n > 0) && (threads != NULL) && (i < workers); ++i) {
+        if (pthread_create(&(threads[i]), NULL, _worker, &run) != 0) {
+            break;
+        }
+        ++started;
+    }
+    if (started == 0) {
+        fprintf(stderr, "couldn't start the workers\n");
+        exit(255);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long read = 0;
+    for (int r = 0; r < repeat; ++r) {
+        if (r > 0) {
+            rewind(in);
+        }
+        int line_n;
+        do {
+            chunk *c = _pop(&(run.empty));
+            c->index = read;
+            line_n = _read_chunk(in, c, run.chunk_lines);
+            read += line_n;
+            if (line_n > 0) {
+                _push(&(run.full), c);
+            } else {
+                _push(&(run.empty), c);
+            }
+        } while (line_n == run.chunk_lines);
+    }
+    _close(&(run.full));
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    fflush(stdout);
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(stderr, "%ld puzzles (%ld solved, %ld unsolvable, %ld malformed, %ld abandoned) in %.2fs: %.1f puzzles/s\n",
+        read, run.counts[SOLVE_SOLVED], run.counts[SOLVE_UNSOLVABLE], run.counts[SOLVE_MALFORMED],
+        run.counts[SOLVE_ABANDONED], seconds, (seconds > 0) ? (read / seconds) : 0);
+
+    for (int i = 0; i < chunk_n; ++i) {
+        _release_chunk(&(chunks[i]));
+    }
+    free(chunks);
+    free(threads);
+    pthread_mutex_destroy(&(run.write_lock));
+    _destroy_queue(&(run.full));
+    _destroy_queue(&(run.empty));
+    if (in != stdin) {
+        fclose(in);
+    }
+    return 0;
+}
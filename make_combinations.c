@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "combinations.h"
+
+// Writes combination_tables.h (see combinations.h) to stdout. Each size and cage length has its
+// multisets of values walked in order, and a multiset ORs its values into the mask of every
+// target it makes.
+//
+// usage: ./make_combinations > combination_tables.h
+
+enum { SIZE_N = CAGES_SIZE_MAX - CAGES_SIZE_MIN + 1 };
+
+// 9^6: the greatest product the tables hold
+enum { PRODUCT_MAX = 531441 };
+
+typedef struct {
+    int              size;
+    int              k;
+    int              values[COMBINATIONS_CELLS_MAX];
+    // indexed by sum, and by product
+    combination_mask sums[COMBINATIONS_CELLS_MAX * CAGES_SIZE_MAX + 1];
+    combination_mask *products;
+} walk;
+
+static void _walk(walk *w, int i, int least) {
+    if (i == w->k) {
+        int sum = 0;
+        long product = 1;
+        combination_mask mask = 0;
+        for (int j = 0; j < w->k; ++j) {
+            sum += w->values[j];
+            product *= w->values[j];
+            mask |= (combination_mask)(1 << (w->values[j] - 1));
+        }
+        w->sums[sum] |= mask;
+        w->products[product] |= mask;
+        return;
+    }
+    for (int v = least; v <= w->size; ++v) {
+        w->values[i] = v;
+        _walk(w, i + 1, v);
+    }
+}
+
+static void _print_masks(const char *name, const combination_mask *masks, int n) {
+    printf("static const combination_mask %s[%d] = {", name, n);
+    for (int i = 0; i < n; ++i) {
+        printf("%s0x%03x,", (i % 12) ? " " : "\n    ", masks[i]);
+    }
+    printf("\n};\n\n");
+}
+
+int main (int argc, char** argv) {
+    if (argc > 1) {
+        fprintf(stderr, "usage: ./make_combinations > combination_tables.h\n");
+        exit(255);
+    }
+
+    walk w;
+    w.products = malloc((PRODUCT_MAX + 1) * sizeof(combination_mask));
+    if (w.products == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    // the tables, flattened: each size and cage length's run of entries starts at its *_first
+    static combination_mask sums[SIZE_N * COMBINATIONS_CELLS_MAX * (COMBINATIONS_CELLS_MAX * CAGES_SIZE_MAX + 1)];
+    static uint32_t products[SIZE_N * COMBINATIONS_CELLS_MAX * 4096];
+    static combination_mask product_masks[SIZE_N * COMBINATIONS_CELLS_MAX * 4096];
+    int sum_first[SIZE_N * COMBINATIONS_CELLS_MAX + 1];
+    int product_first[SIZE_N * COMBINATIONS_CELLS_MAX + 1];
+    int sum_n = 0;
+    int product_n = 0;
+
+    static combination_mask differences[SIZE_N * CAGES_SIZE_MAX];
+    static combination_mask quotients[SIZE_N * CAGES_SIZE_MAX];
+
+    for (int size = CAGES_SIZE_MIN; size <= CAGES_SIZE_MAX; ++size) {
+        for (int k = 1; k <= COMBINATIONS_CELLS_MAX; ++k) {
+            int run = (size - CAGES_SIZE_MIN) * COMBINATIONS_CELLS_MAX + (k - 1);
+            w.size = size;
+            w.k = k;
+            for (int t = 0; t <= COMBINATIONS_CELLS_MAX * CAGES_SIZE_MAX; ++t) {
+                w.sums[t] = 0;
+            }
+            for (long t = 0; t <= PRODUCT_MAX; ++t) {
+                w.products[t] = 0;
+            }
+            _walk(&w, 0, 1);
+
+            // sums run from k (all ones) to k * size (all size)
+            sum_first[run] = sum_n;
+            for (int t = k; t <= k * size; ++t) {
+                sums[sum_n++] = w.sums[t];
+            }
+            product_first[run] = product_n;
+            for (long t = 1; t <= PRODUCT_MAX; ++t) {
+                if (w.products[t]) {
+                    products[product_n] = (uint32_t)t;
+                    product_masks[product_n++] = w.products[t];
+                }
+            }
+        }
+
+        // the two cells of a subtract or divide cage: differences 0 .. size - 1, quotients
+        // 1 .. size
+        for (int a = 1; a <= size; ++a) {
+            for (int b = 1; b <= size; ++b) {
+                combination_mask mask = (combination_mask)((1 << (a - 1)) | (1 << (b - 1)));
+                if (a >= b) {
+                    differences[(size - CAGES_SIZE_MIN) * CAGES_SIZE_MAX + (a - b)] |= mask;
+                }
+                if ((a >= b) && (a % b == 0)) {
+                    quotients[(size - CAGES_SIZE_MIN) * CAGES_SIZE_MAX + (a / b - 1)] |= mask;
+                }
+            }
+        }
+    }
+    sum_first[SIZE_N * COMBINATIONS_CELLS_MAX] = sum_n;
+    product_first[SIZE_N * COMBINATIONS_CELLS_MAX] = product_n;
+    free(w.products);
+
+    printf("// Written by make_combinations: don't edit. See combinations.h.\n\n");
+    printf("// runs are by size (from %d) then cage length (from 1); each starts at its *_FIRST.\n",
+        CAGES_SIZE_MIN);
+    printf("static const unsigned short COMBINATION_SUM_FIRST[%d] = {", SIZE_N * COMBINATIONS_CELLS_MAX + 1);
+    for (int i = 0; i <= SIZE_N * COMBINATIONS_CELLS_MAX; ++i) {
+        printf("%s%d,", (i % 12) ? " " : "\n    ", sum_first[i]);
+    }
+    printf("\n};\n\n");
+    printf("// a run of k cells holds the sums k .. k * size\n");
+    _print_masks("COMBINATION_SUMS", sums, sum_n);
+
+    printf("static const unsigned short COMBINATION_PRODUCT_FIRST[%d] = {", SIZE_N * COMBINATIONS_CELLS_MAX + 1);
+    for (int i = 0; i <= SIZE_N * COMBINATIONS_CELLS_MAX; ++i) {
+        printf("%s%d,", (i % 12) ? " " : "\n    ", product_first[i]);
+    }
+    printf("\n};\n\n");
+    printf("// each run in increasing order, alongside COMBINATION_PRODUCT_MASKS\n");
+    printf("static const uint32_t COMBINATION_PRODUCTS[%d] = {", product_n);
+    for (int i = 0; i < product_n; ++i) {
+        printf("%s%u,", (i % 10) ? " " : "\n    ", products[i]);
+    }
+    printf("\n};\n\n");
+    _print_masks("COMBINATION_PRODUCT_MASKS", product_masks, product_n);
+
+    printf("// by size, then difference (from 0) or quotient (from 1)\n");
+    _print_masks("COMBINATION_DIFFERENCES", differences, SIZE_N * CAGES_SIZE_MAX);
+    _print_masks("COMBINATION_QUOTIENTS", quotients, SIZE_N * CAGES_SIZE_MAX);
+
+    return 0;
+}
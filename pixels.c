@@ -0,0 +1,69 @@
+#include "pixels.h"
+
+CvRect clip_region(const IplImage *image, CvRect region) {
+    int x0 = (region.x < 0) ? 0 : region.x;
+    int y0 = (region.y < 0) ? 0 : region.y;
+    int x1 = region.x + region.width;
+    int y1 = region.y + region.height;
+    x1 = (x1 > image->width) ? image->width : x1;
+    y1 = (y1 > image->height) ? image->height : y1;
+    if ((x1 <= x0) || (y1 <= y0)) {
+        return cvRect(x0, y0, 0, 0);
+    }
+    return cvRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+unsigned long sum_region(const IplImage *image, CvRect region) {
+    CvRect r = clip_region(image, region);
+    unsigned long total = 0;
+    for (int y = r.y; y < r.y + r.height; ++y) {
+        const unsigned char *row = pixel_row(image, y) + r.x;
+        // a plain reduction over bytes, which the compiler can vectorize; a row of up to 2^24
+        // pixels can't overflow it.
+        unsigned int row_total = 0;
+        for (int x = 0; x < r.width; ++x) {
+            row_total += row[x];
+        }
+        total += row_total;
+    }
+    return total;
+}
+
+// a CvScalar channel as cvSet2D would store it in an 8-bit image: rounded, and saturated.
+static unsigned char _saturate(double value) {
+    int v = cvRound(value);
+    return (unsigned char)((v < 0) ? 0 : ((v > 255) ? 255 : v));
+}
+
+void paint_mask(const bitmap *mask, IplImage *out, CvRect region, CvScalar off, CvScalar on) {
+    CvRect r = clip_region(out, region);
+    const unsigned char colors[2][3] = {
+        { _saturate(off.val[0]), _saturate(off.val[1]), _saturate(off.val[2]) },
+        { _saturate(on.val[0]),  _saturate(on.val[1]),  _saturate(on.val[2])  }
+    };
+    for (int y = r.y; y < r.y + r.height; ++y) {
+        unsigned char *row = pixel_row(out, y) + 3 * r.x;
+        for (int x = 0; x < r.width; ++x) {
+            const unsigned char *color = colors[bitmap_get(mask, r.x + x, y)];
+            row[3 * x]     = color[0];
+            row[3 * x + 1] = color[1];
+            row[3 * x + 2] = color[2];
+        }
+    }
+}
+
+void paint_brighter(const IplImage *gray, IplImage *out, CvRect region, int threshold, CvScalar color) {
+    CvRect r = clip_region(gray, region);
+    const unsigned char c[3] = { _saturate(color.val[0]), _saturate(color.val[1]), _saturate(color.val[2]) };
+    for (int y = r.y; y < r.y + r.height; ++y) {
+        const unsigned char *in = pixel_row(gray, y) + r.x;
+        unsigned char *row      = pixel_row(out, y) + 3 * r.x;
+        for (int x = 0; x < r.width; ++x) {
+            if (in[x] > threshold) {
+                row[3 * x]     = c[0];
+                row[3 * x + 1] = c[1];
+                row[3 * x + 2] = c[2];
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef _PIXELS_H
+#define _PIXELS_H
+
+#include "bitmap.h"
+#include "cv.h"
+
+// Raster-order access to 8-bit images: a row at a time, through plain pointers, instead of
+// cvGet2D/cvSet2D per pixel (a call and a CvScalar of four doubles each, and - in the x-outer
+// loops this replaces - a stride-sized jump between every pair of pixels).
+
+// the first byte of row y.
+static inline unsigned char *pixel_row(const IplImage *image, int y) {
+    return (unsigned char *)image->imageData + (size_t)y * image->widthStep;
+}
+
+// region, clipped to the image (width or height 0 if they don't overlap).
+CvRect clip_region(const IplImage *image, CvRect region);
+
+// The region visitors below walk region (clipped) row by row, each row a contiguous inner loop.
+
+// the sum of the (single-channel) pixels in region.
+unsigned long sum_region(const IplImage *image, CvRect region);
+
+// Paints region of the 3-channel image out: on where the corresponding pixel of mask is set, off
+// where it is clear.
+void paint_mask(const bitmap *mask, IplImage *out, CvRect region, CvScalar off, CvScalar on);
+
+// Paints region of the 3-channel image out with color, wherever the corresponding pixel of the
+// single-channel gray is brighter than threshold.
+void paint_brighter(const IplImage *gray, IplImage *out, CvRect region, int threshold, CvScalar color);
+
+#endif /* _PIXELS_H */
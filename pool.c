@@ -0,0 +1,185 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+// bands thinner than this aren't worth handing to another thread.
+enum { MIN_BAND_ROWS = 16 };
+
+struct work_pool_s {
+    int              workers;
+    pthread_t       *threads;
+
+    // one job at a time; callers queue up on this.
+    pthread_mutex_t  job_lock;
+
+    // the current job, guarded by lock.
+    pthread_mutex_t  lock;
+    pthread_cond_t   work_ready;
+    pthread_cond_t   work_done;
+    band_task        task;
+    void            *argument;
+    int              rows;
+    int              bands;
+    int              next_band;
+    int              finished_bands;
+    // bumped for every job, so that sleeping workers can tell a new one from a spurious wakeup.
+    unsigned long    generation;
+    int              shutting_down;
+};
+
+int band_count(const work_pool *pool, int rows, int min_band_rows) {
+    if (min_band_rows < MIN_BAND_ROWS) {
+        min_band_rows = MIN_BAND_ROWS;
+    }
+    int bands = pool ? pool->workers : 1;
+    if (bands > rows / min_band_rows) {
+        bands = rows / min_band_rows;
+    }
+    return (bands < 1) ? 1 : bands;
+}
+
+int band_start(int band, int bands, int rows) {
+    return (int)(((long)band * rows) / bands);
+}
+
+// takes bands from the current job until there are none left. Called (and returns) with lock held.
+static void _work(work_pool *pool) {
+    while (pool->next_band < pool->bands) {
+        int band = pool->next_band++;
+        pthread_mutex_unlock(&(pool->lock));
+
+        pool->task(pool->argument, band, band_start(band, pool->bands, pool->rows),
+            band_start(band + 1, pool->bands, pool->rows));
+
+        pthread_mutex_lock(&(pool->lock));
+        if (++pool->finished_bands == pool->bands) {
+            pthread_cond_broadcast(&(pool->work_done));
+        }
+    }
+}
+
+static void *_worker(void *argument) {
+    work_pool *pool = argument;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&(pool->lock));
+    while (1) {
+        while ((! pool->shutting_down) && (pool->generation == seen)) {
+            pthread_cond_wait(&(pool->work_ready), &(pool->lock));
+        }
+        if (pool->shutting_down) {
+            break;
+        }
+        seen = pool->generation;
+        _work(pool);
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    return NULL;
+}
+
+work_pool *create_work_pool(int workers) {
+    work_pool *pool = calloc(1, sizeof(work_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->workers = (workers < 1) ? 1 : workers;
+    pool->threads = calloc(pool->workers, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&(pool->job_lock), NULL);
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->work_ready), NULL);
+    pthread_cond_init(&(pool->work_done), NULL);
+
+    // the caller of run_bands is a worker too.
+    for (int i = 1; i < pool->workers; ++i) {
+        if (pthread_create(&(pool->threads[i]), NULL, _worker, pool) != 0) {
+            // carry on with the ones we've got.
+            pool->workers = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+void release_work_pool(work_pool **pool) {
+    if ((pool == NULL) || (*pool == NULL)) {
+        return;
+    }
+    work_pool *p = *pool;
+
+    pthread_mutex_lock(&(p->lock));
+    p->shutting_down = 1;
+    pthread_cond_broadcast(&(p->work_ready));
+    pthread_mutex_unlock(&(p->lock));
+    for (int i = 1; i < p->workers; ++i) {
+        pthread_join(p->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&(p->work_done));
+    pthread_cond_destroy(&(p->work_ready));
+    pthread_mutex_destroy(&(p->lock));
+    pthread_mutex_destroy(&(p->job_lock));
+    free(p->threads);
+    free(p);
+    *pool = NULL;
+}
+
+int work_pool_workers(const work_pool *pool) {
+    return pool ? pool->workers : 1;
+}
+
+// hands the bands out to the workers (the calling thread among them) and waits for them all.
+static void _run(work_pool *pool, int bands, int rows, band_task task, void *argument) {
+    pthread_mutex_lock(&(pool->job_lock));
+    pthread_mutex_lock(&(pool->lock));
+    pool->task           = task;
+    pool->argument       = argument;
+    pool->rows           = rows;
+    pool->bands          = bands;
+    pool->next_band      = 0;
+    pool->finished_bands = 0;
+    ++pool->generation;
+    pthread_cond_broadcast(&(pool->work_ready));
+
+    _work(pool);
+    while (pool->finished_bands < pool->bands) {
+        pthread_cond_wait(&(pool->work_done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    pthread_mutex_unlock(&(pool->job_lock));
+}
+
+void run_bands(work_pool *pool, int rows, int min_band_rows, band_task task, void *argument) {
+    int bands = band_count(pool, rows, min_band_rows);
+    if (bands == 1) {
+        task(argument, 0, 0, rows);
+        return;
+    }
+    _run(pool, bands, rows, task, argument);
+}
+
+typedef struct {
+    worker_task  task;
+    void        *argument;
+} worker_job;
+
+static void _worker_band(void *argument, int band, int y0, int y1) {
+    worker_job *job = argument;
+    job->task(job->argument, band);
+}
+
+void run_workers(work_pool *pool, worker_task task, void *argument) {
+    if (work_pool_workers(pool) == 1) {
+        task(argument, 0);
+        return;
+    }
+    worker_job job = { task, argument };
+    // one band per worker
+    _run(pool, pool->workers, pool->workers, _worker_band, &job);
+}
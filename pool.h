@@ -0,0 +1,38 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+// A fixed set of worker threads for splitting one image's scans into bands of rows, or one search
+// among all of them.
+typedef struct work_pool_s work_pool;
+
+// a band of rows [y0, y1); band is its index (0 for the top band), for per-band results.
+typedef void (*band_task)(void *argument, int band, int y0, int y1);
+// one worker's part of a job; worker runs from 0 to work_pool_workers(pool) - 1.
+typedef void (*worker_task)(void *argument, int worker);
+
+// workers counts the calling thread, so 1 means no extra threads at all.
+work_pool *create_work_pool(int workers);
+void release_work_pool(work_pool **pool);
+
+int work_pool_workers(const work_pool *pool);
+
+// The number of bands run_bands splits rows into: always the same for the same pool, rows and
+// min_band_rows, so per-band results can be reduced in band order, deterministically. No band is
+// thinner than min_band_rows (0 for no more than the usual minimum). pool may be NULL (1 band).
+int band_count(const work_pool *pool, int rows, int min_band_rows);
+// the first row of band (of bands) over rows; band bands gives rows.
+int band_start(int band, int bands, int rows);
+
+// Runs task over [0, rows) in band_count(pool, rows, min_band_rows) bands, and returns once all of
+// them are done. The calling thread takes a share of the bands. Jobs from different threads take
+// turns.
+void run_bands(work_pool *pool, int rows, int min_band_rows, band_task task, void *argument);
+
+// Runs task once for each worker, and returns once all of them are done. As with bands, the calling
+// thread is one of the workers, and a worker's part may start late or after another's on the same
+// thread, so the parts shouldn't wait on each other to start. pool may be NULL (1 worker).
+// Like any job, it holds the pool until every part is done; a task may not start another job on
+// the pool it's running on.
+void run_workers(work_pool *pool, worker_task task, void *argument);
+
+#endif /* _POOL_H */
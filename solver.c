@@ -0,0 +1,1533 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "combinations.h"
+#include "solver.h"
+
+enum { CELLS_MAX = CAGES_SIZE_MAX * CAGES_SIZE_MAX };
+enum { CAGES_MAX = PUZZLE_CAGES_MAX };
+// Rows and columns are taken in bands of up to this many for deriving cages (see _derive_cages),
+// and only derived cages of up to DERIVED_CELLS_MAX cells are kept. (The product of a band of
+// more than 3 rows of a 9x9 puzzle is too big for a long.)
+enum { BAND_MAX = 3 };
+enum { DERIVED_CELLS_MAX = 6 };
+enum { DERIVED_MAX = 2 * 2 * CAGES_SIZE_MAX * BAND_MAX };
+enum { ALL_CAGES_MAX = CAGES_MAX + DERIVED_MAX };
+// A cage with more assignments of its candidates than this isn't enumerated, but given a cheaper
+// check which may keep a few more candidates (see _propagate_cage).
+enum { ENUMERATION_LIMIT = 256 };
+// Once propagation alone has run out, the assignments which make the target of each cage of up to
+// TUPLE_CELLS_MAX cells are listed (see _list_tuples), as long as the puzzle's come to no more
+// than TUPLES_MAX in all; a cage left unlisted keeps the checks above.
+enum { TUPLE_CELLS_MAX = 8 };
+enum { TUPLES_MAX = 1 << 16 };
+// The parallel search hands out every branch of its first SPLIT_DEPTH guesses as a task, and after
+// that splits a guess whenever workers are left waiting. A worker's deque holds up to
+// DEQUE_CAPACITY tasks; once it's full, the worker takes its branches itself.
+enum { SPLIT_DEPTH = 2 };
+enum { DEQUE_CAPACITY = 256 };
+
+// the values a cell may still take: bit v - 1 is v.
+typedef uint16_t candidates;
+
+// sets of cages, by number: bit c % 64 of word c / 64.
+typedef struct {
+    uint64_t words[(ALL_CAGES_MAX + 63) / 64];
+} cage_set;
+
+// A puzzle, checked and turned inside out: the cells of each cage, and the cages of each cell.
+// The puzzle's own cages come first, then those derived from them (see _derive_cages).
+typedef struct {
+    int             size;
+    int             cell_n;
+    int             named_cage_n;
+    int             cage_n;
+    cage_clue       clues[ALL_CAGES_MAX];
+    // the cells of cage c are cells[first[c]] ... cells[first[c + 1] - 1].
+    unsigned short  first[ALL_CAGES_MAX + 1];
+    unsigned char   cells[CELLS_MAX + DERIVED_MAX * DERIVED_CELLS_MAX];
+    // the puzzle's own cage of each cell, and all of the cages it's in
+    unsigned char   cage_of[CELLS_MAX];
+    cage_set        cages_of[CELLS_MAX];
+    // The listed assignments of each cage, as bitsets over them: bit t of _tuple_mask(p, cage, i,
+    // v) is set if assignment t puts v in the cage's i-th cell. An unlisted cage has NULL
+    // tuple_masks. They all live in tuple_block. Which of a cage's assignments are still open
+    // takes tuple_words of a search's open_words words, from tuple_start on (see solver_search).
+    long            tuple_n[ALL_CAGES_MAX];
+    int             tuple_words[ALL_CAGES_MAX];
+    int             tuple_start[ALL_CAGES_MAX];
+    int             open_words;
+    uint64_t       *tuple_masks[ALL_CAGES_MAX];
+    uint64_t       *tuple_block;
+} solver_puzzle;
+
+typedef struct {
+    candidates cells[CELLS_MAX];
+} solver_grid;
+
+// What is left to look at after cells have changed: bit l of lines is row l (l < size) or column
+// l - size; bit c of cages is cage c.
+typedef struct {
+    uint32_t lines;
+    cage_set cages;
+} solver_pending;
+
+static void _add_cage(cage_set *set, int cage) {
+    set->words[cage / 64] |= (uint64_t)1 << (cage % 64);
+}
+
+static void _add_cages(cage_set *set, const cage_set *more) {
+    for (int w = 0; w < (int)(sizeof(set->words) / sizeof(set->words[0])); ++w) {
+        set->words[w] |= more->words[w];
+    }
+}
+
+static void _remove_cage(cage_set *set, int cage) {
+    set->words[cage / 64] &= ~((uint64_t)1 << (cage % 64));
+}
+
+// the lowest numbered cage in set, which it removes; -1 if set is empty.
+static int _take_cage(cage_set *set) {
+    for (int w = 0; w < (int)(sizeof(set->words) / sizeof(set->words[0])); ++w) {
+        if (set->words[w]) {
+            int cage = 64 * w + __builtin_ctzll(set->words[w]);
+            set->words[w] &= set->words[w] - 1;
+            return cage;
+        }
+    }
+    return -1;
+}
+
+static int _cage_number(char name) {
+    if ((name >= 'A') && (name <= 'Z')) {
+        return name - 'A';
+    }
+    if ((name >= 'a') && (name <= 'z')) {
+        return 26 + (name - 'a');
+    }
+    return -1;
+}
+
+// 0 if puzzle is malformed.
+static int _compile(const kenken_puzzle *puzzle, solver_puzzle *p) {
+    if ((puzzle->size < CAGES_SIZE_MIN) || (puzzle->size > CAGES_SIZE_MAX) || (puzzle->cages == NULL)) {
+        return 0;
+    }
+    p->size   = puzzle->size;
+    p->cell_n = puzzle->size * puzzle->size;
+
+    // cages are numbered in order of their names, skipping any name which isn't used.
+    int count[CAGES_MAX] = { 0 };
+    for (int i = 0; i < p->cell_n; ++i) {
+        int name = _cage_number(puzzle->cages[i]);
+        if ((name < 0) || (name >= puzzle->clue_n)) {
+            return 0;
+        }
+        ++count[name];
+    }
+    int number[CAGES_MAX];
+    p->cage_n = 0;
+    p->first[0] = 0;
+    for (int name = 0; name < CAGES_MAX; ++name) {
+        if (count[name] == 0) {
+            continue;
+        }
+        cage_clue clue = puzzle->clues[name];
+        if (((clue.operation == CAGE_SUBTRACT) || (clue.operation == CAGE_DIVIDE)) && (count[name] != 2)) {
+            return 0;
+        }
+        if ((clue.operation == CAGE_GIVEN) && (count[name] != 1)) {
+            return 0;
+        }
+        number[name]              = p->cage_n;
+        p->clues[p->cage_n]       = clue;
+        p->first[p->cage_n + 1]   = p->first[p->cage_n] + count[name];
+        ++p->cage_n;
+    }
+    // (a clue left over is for a cage the layout doesn't have)
+    if (puzzle->clue_n > p->cage_n) {
+        return 0;
+    }
+
+    memset(p->cages_of, 0, sizeof(p->cages_of));
+    int filled[CAGES_MAX] = { 0 };
+    for (int i = 0; i < p->cell_n; ++i) {
+        int cage = number[_cage_number(puzzle->cages[i])];
+        p->cells[p->first[cage] + filled[cage]++] = i;
+        p->cage_of[i] = cage;
+        _add_cage(&p->cages_of[i], cage);
+    }
+    p->named_cage_n = p->cage_n;
+    memset(p->tuple_masks, 0, sizeof(p->tuple_masks));
+    p->tuple_block = NULL;
+    p->open_words  = 0;
+    return 1;
+}
+
+// Every row holds each value once, so a row's values add up to 1 + 2 + ... + size, and multiply
+// to size!; so do a column's, and a band of rows or columns makes that many times as much. Where
+// adding (or multiplying) cages and givens lie wholly inside a band, the band's other cells must
+// make up what's left, and if there are only a few of them they make a cage of their own: one
+// which nothing in the puzzle spells out, but which narrows candidates all the same.
+static void _derive_cages(solver_puzzle *p) {
+    const int size = p->size;
+    long line_sum = 0;
+    long line_product = 1;
+    for (int v = 1; v <= size; ++v) {
+        line_sum     += v;
+        line_product *= v;
+    }
+
+    // the first and last row (span[0]) and column (span[1]) of each cage
+    int span[2][CAGES_MAX][2];
+    for (int cage = 0; cage < p->named_cage_n; ++cage) {
+        for (int columns = 0; columns <= 1; ++columns) {
+            span[columns][cage][0] = size;
+            span[columns][cage][1] = -1;
+            for (int i = p->first[cage]; i < p->first[cage + 1]; ++i) {
+                int line = columns ? p->cells[i] % size : p->cells[i] / size;
+                span[columns][cage][0] = (line < span[columns][cage][0]) ? line : span[columns][cage][0];
+                span[columns][cage][1] = (line > span[columns][cage][1]) ? line : span[columns][cage][1];
+            }
+        }
+    }
+
+    for (int columns = 0; columns <= 1; ++columns) {
+        for (int a = 0; a < size; ++a) {
+            for (int b = a; (b < size) && (b < a + BAND_MAX); ++b) {
+                // what the band's cells make, adding (index 0) and multiplying (index 1), less
+                // what the cages inside it which it can account for make; and which those are.
+                long target[2] = { (b - a + 1) * line_sum, 1 };
+                uint64_t accounted[2] = { 0, 0 };
+                for (int line = a; line <= b; ++line) {
+                    target[1] *= line_product;
+                }
+                for (int cage = 0; cage < p->named_cage_n; ++cage) {
+                    if ((span[columns][cage][0] < a) || (span[columns][cage][1] > b)) {
+                        continue;
+                    }
+                    cage_operation operation = p->clues[cage].operation;
+                    long made = p->clues[cage].target;
+                    if ((operation == CAGE_ADD) || (operation == CAGE_GIVEN)) {
+                        accounted[0] |= (uint64_t)1 << cage;
+                        target[0] -= made;
+                    }
+                    if ((operation == CAGE_MULTIPLY) || (operation == CAGE_GIVEN)) {
+                        accounted[1] |= (uint64_t)1 << cage;
+                        // (a target which doesn't divide leaves nothing which can make the rest)
+                        target[1] = ((made > 0) && (target[1] % made == 0)) ? target[1] / made : 0;
+                    }
+                }
+
+                // the band's other cells make the rest
+                for (int multiply = 0; multiply <= 1; ++multiply) {
+                    unsigned char rest[CELLS_MAX];
+                    int rest_n = 0;
+                    for (int line = a; line <= b; ++line) {
+                        for (int i = 0; i < size; ++i) {
+                            int cell = columns ? i * size + line : line * size + i;
+                            if (! ((accounted[multiply] >> p->cage_of[cell]) & 1)) {
+                                rest[rest_n++] = cell;
+                            }
+                        }
+                    }
+                    if ((rest_n == 0) || (rest_n > DERIVED_CELLS_MAX) || (p->cage_n == ALL_CAGES_MAX)) {
+                        continue;
+                    }
+
+                    int cage = p->cage_n++;
+                    p->clues[cage] = (cage_clue){ multiply ? CAGE_MULTIPLY : CAGE_ADD, target[multiply] };
+                    p->first[cage + 1] = p->first[cage] + rest_n;
+                    for (int i = 0; i < rest_n; ++i) {
+                        p->cells[p->first[cage] + i] = rest[i];
+                        _add_cage(&p->cages_of[rest[i]], cage);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static int _single(candidates c) {
+    return (c & (c - 1)) == 0;
+}
+
+static void _narrow(const solver_puzzle *p, solver_grid *g, solver_pending *pending, int cell, candidates to) {
+    if (g->cells[cell] != to) {
+        g->cells[cell] = to;
+        pending->lines |= (1u << (cell / p->size)) | (1u << (p->size + cell % p->size));
+        _add_cages(&pending->cages, &p->cages_of[cell]);
+    }
+}
+
+// Strikes the values placed in a row or column from the rest of it, and places the values which
+// have only one cell left to go in. 0 if that leaves a cell or a value with nowhere to go.
+static int _propagate_line(const solver_puzzle *p, solver_grid *g, solver_pending *pending, int line) {
+    const int size = p->size;
+    int start  = (line < size) ? line * size : line - size;
+    int stride = (line < size) ? 1 : size;
+    const candidates all = (candidates)((1 << size) - 1);
+
+    int narrowed;
+    do {
+        candidates placed = 0;
+        candidates once   = 0;
+        candidates twice  = 0;
+        for (int i = 0, cell = start; i < size; ++i, cell += stride) {
+            candidates c = g->cells[cell];
+            if (_single(c)) {
+                if (c == 0 || (placed & c)) {
+                    return 0;
+                }
+                placed |= c;
+            }
+            twice |= once & c;
+            once  |= c;
+        }
+        if (once != all) {
+            return 0;
+        }
+
+        // values not yet placed, with exactly one cell left to go in
+        candidates hidden = once & ~twice & ~placed;
+        narrowed = 0;
+        for (int i = 0, cell = start; i < size; ++i, cell += stride) {
+            candidates c = g->cells[cell];
+            if (_single(c)) {
+                continue;
+            }
+            candidates only = c & hidden;
+            if (only && ! _single(only)) {
+                return 0;
+            }
+            candidates left = only ? only : (candidates)(c & ~placed);
+            if (left == 0) {
+                return 0;
+            }
+            if (left != c) {
+                _narrow(p, g, pending, cell, left);
+                narrowed = 1;
+            }
+        }
+    } while (narrowed);
+    // (narrowing marked the line as pending again, but there's nothing left in it to find)
+    pending->lines &= ~(1u << line);
+    return 1;
+}
+
+static int _makes_target(cage_operation operation, long target, const int *values, int k) {
+    switch (operation) {
+        case CAGE_ADD: {
+            long sum = 0;
+            for (int i = 0; i < k; ++i) {
+                sum += values[i];
+            }
+            return sum == target;
+        }
+        case CAGE_MULTIPLY: {
+            long product = 1;
+            for (int i = 0; (i < k) && (product <= target); ++i) {
+                product *= values[i];
+            }
+            return product == target;
+        }
+        case CAGE_SUBTRACT:
+            return (values[0] - values[1] == target) || (values[1] - values[0] == target);
+        case CAGE_DIVIDE: {
+            int larger  = (values[0] > values[1]) ? values[0] : values[1];
+            int smaller = (values[0] > values[1]) ? values[1] : values[0];
+            return (larger % smaller == 0) && (larger / smaller == target);
+        }
+        case CAGE_GIVEN:
+            return values[0] == target;
+    }
+    return 0;
+}
+
+// Assignments of cages' cells, k values each, one after another.
+typedef struct {
+    unsigned char *values;
+    long           used;
+    long           room;
+} tuple_list;
+
+// 0 if there's no memory for it.
+static int _append_tuple(tuple_list *list, const int *values, int k) {
+    if (list->used + k > list->room) {
+        long room = 2 * list->room + 64 * k;
+        unsigned char *more = realloc(list->values, room);
+        if (more == NULL) {
+            return 0;
+        }
+        list->values = more;
+        list->room   = room;
+    }
+    for (int i = 0; i < k; ++i) {
+        list->values[list->used++] = (unsigned char)values[i];
+    }
+    return 1;
+}
+
+// The state of trying every assignment of a cage's candidates.
+typedef struct {
+    const solver_puzzle *p;
+    const unsigned char *cells;
+    int                  k;
+    cage_operation       operation;
+    long                 target;
+    candidates           domain[CELLS_MAX];
+    // the values of each cell in some assignment which makes the target
+    candidates           support[CELLS_MAX];
+    int                  values[CELLS_MAX];
+    // the least and greatest sums of cells [i, k)
+    int                  rest_min[CELLS_MAX + 1];
+    int                  rest_max[CELLS_MAX + 1];
+    // the values taken so far in each row and column of the puzzle (cells in a row or column
+    // differ, even within a cage)
+    candidates           row_used[CAGES_SIZE_MAX];
+    candidates           column_used[CAGES_SIZE_MAX];
+    // cells whose whole domain is supported already; once all are, there's nothing to learn
+    int                  supported;
+    // if list is set, the assignments which make the target are appended to it instead, until
+    // there are more than tuple_limit of them
+    tuple_list          *list;
+    long                 tuple_n;
+    long                 tuple_limit;
+} cage_search;
+
+static void _enumerate(cage_search *s, int i, long partial) {
+    if (i == s->k) {
+        if (! _makes_target(s->operation, s->target, s->values, s->k)) {
+            return;
+        }
+        if (s->list) {
+            // (without the memory for another, the cage has too many)
+            s->tuple_n = _append_tuple(s->list, s->values, s->k) ? s->tuple_n + 1 : s->tuple_limit + 1;
+            return;
+        }
+        for (int j = 0; j < s->k; ++j) {
+            candidates before = s->support[j];
+            s->support[j] |= (candidates)(1 << (s->values[j] - 1));
+            s->supported += (before != s->domain[j]) && (s->support[j] == s->domain[j]);
+        }
+        return;
+    }
+
+    int cell   = s->cells[i];
+    int row    = cell / s->p->size;
+    int column = cell % s->p->size;
+    candidates open = s->domain[i] & ~s->row_used[row] & ~s->column_used[column];
+    if ((i == s->k - 1) && ((s->operation == CAGE_ADD) || (s->operation == CAGE_MULTIPLY))) {
+        // the last cell is what's left of the sum or product
+        long rest = (s->operation == CAGE_ADD) ? s->target - partial : s->target / partial;
+        open &= ((rest >= 1) && (rest <= s->p->size)) ? (candidates)(1 << (rest - 1)) : 0;
+    } else if (s->operation == CAGE_ADD) {
+        // the cells from here on make up the rest of the sum (or product) between them
+        open &= combination_candidates(s->p->size, CAGE_ADD, s->k - i, s->target - partial);
+    } else if (s->operation == CAGE_MULTIPLY) {
+        open &= combination_candidates(s->p->size, CAGE_MULTIPLY, s->k - i, s->target / partial);
+    }
+    for (; open && (s->supported < s->k) && (s->tuple_n <= s->tuple_limit); open &= open - 1) {
+        int v = __builtin_ctz(open) + 1;
+        long next = partial;
+        if (s->operation == CAGE_ADD) {
+            next = partial + v;
+            if ((next + s->rest_min[i + 1] > s->target) || (next + s->rest_max[i + 1] < s->target)) {
+                continue;
+            }
+        } else if (s->operation == CAGE_MULTIPLY) {
+            next = partial * v;
+            if (s->target % next != 0) {
+                continue;
+            }
+        }
+
+        candidates bit = (candidates)(1 << (v - 1));
+        s->values[i] = v;
+        s->row_used[row]       |= bit;
+        s->column_used[column] |= bit;
+        _enumerate(s, i + 1, next);
+        s->row_used[row]       &= ~bit;
+        s->column_used[column] &= ~bit;
+    }
+}
+
+static int _lowest(candidates c) {
+    return __builtin_ctz(c) + 1;
+}
+
+static int _highest(candidates c) {
+    return 32 - __builtin_clz(c);
+}
+
+static void _start_enumerating(const solver_puzzle *p, const solver_grid *g, int cage, cage_search *s) {
+    s->p           = p;
+    s->cells       = p->cells + p->first[cage];
+    s->k           = p->first[cage + 1] - p->first[cage];
+    s->operation   = p->clues[cage].operation;
+    s->target      = p->clues[cage].target;
+    s->supported   = 0;
+    s->list        = NULL;
+    s->tuple_n     = 0;
+    s->tuple_limit = 0;
+    s->rest_min[s->k] = 0;
+    s->rest_max[s->k] = 0;
+    for (int i = s->k - 1; i >= 0; --i) {
+        s->domain[i]   = g->cells[s->cells[i]];
+        s->support[i]  = 0;
+        s->rest_min[i] = s->rest_min[i + 1] + _lowest(s->domain[i]);
+        s->rest_max[i] = s->rest_max[i + 1] + _highest(s->domain[i]);
+    }
+    memset(s->row_used, 0, sizeof(s->row_used));
+    memset(s->column_used, 0, sizeof(s->column_used));
+}
+
+// Tries every assignment of the cage's cells, writing the values which are in one that makes
+// the target to support.
+static void _enumerate_cage(const solver_puzzle *p, const solver_grid *g, int cage, candidates *support) {
+    cage_search s;
+    _start_enumerating(p, g, cage, &s);
+    _enumerate(&s, 0, (s.operation == CAGE_ADD) ? 0 : 1);
+    memcpy(support, s.support, s.k * sizeof(candidates));
+}
+
+static const uint64_t *_tuple_mask(const solver_puzzle *p, int cage, int i, int v) {
+    return p->tuple_masks[cage] + (long)(i * p->size + v - 1) * p->tuple_words[cage];
+}
+
+// Lists the assignments of each cage's cells which make its target, from their candidates in g,
+// as bitsets for _propagate_tuples. A cage is left unlisted if it has more than TUPLE_CELLS_MAX
+// cells, or more assignments than are left of TUPLES_MAX; they all are if there's no memory.
+static void _list_tuples(solver_puzzle *p, const solver_grid *g) {
+    tuple_list list = { NULL, 0, 0 };
+    // where each listed cage's assignments start in list
+    long first[ALL_CAGES_MAX];
+    long listed = 0;
+    long words  = 0;
+    for (int cage = 0; cage < p->cage_n; ++cage) {
+        const int k = p->first[cage + 1] - p->first[cage];
+        first[cage] = -1;
+        if (k > TUPLE_CELLS_MAX) {
+            continue;
+        }
+        cage_search s;
+        _start_enumerating(p, g, cage, &s);
+        s.list        = &list;
+        s.tuple_limit = TUPLES_MAX - listed;
+        long start = list.used;
+        _enumerate(&s, 0, (s.operation == CAGE_ADD) ? 0 : 1);
+        if (s.tuple_n > s.tuple_limit) {
+            list.used = start;
+            continue;
+        }
+        first[cage]          = start;
+        p->tuple_n[cage]     = s.tuple_n;
+        p->tuple_words[cage] = (int)((s.tuple_n + 63) / 64);
+        listed += s.tuple_n;
+        words  += (long)k * p->size * p->tuple_words[cage];
+    }
+
+    p->tuple_block = calloc(words ? words : 1, sizeof(uint64_t));
+    if (p->tuple_block == NULL) {
+        free(list.values);
+        return;
+    }
+    uint64_t *masks = p->tuple_block;
+    p->open_words = 0;
+    for (int cage = 0; cage < p->cage_n; ++cage) {
+        if (first[cage] == -1) {
+            continue;
+        }
+        const int k = p->first[cage + 1] - p->first[cage];
+        p->tuple_masks[cage] = masks;
+        p->tuple_start[cage] = p->open_words;
+        p->open_words       += p->tuple_words[cage];
+        const unsigned char *values = list.values + first[cage];
+        for (long t = 0; t < p->tuple_n[cage]; ++t, values += k) {
+            for (int i = 0; i < k; ++i) {
+                masks[(long)(i * p->size + values[i] - 1) * p->tuple_words[cage] + t / 64] |= (uint64_t)1 << (t % 64);
+            }
+        }
+        masks += (long)k * p->size * p->tuple_words[cage];
+    }
+    free(list.values);
+}
+
+// Sets of the totals a cage's cells can make so far, as bitsets: bit t of words[t / 64]. A total
+// is a sum, or a product written as its powers of 2, 3, 5 and 7 (see _product_moves).
+enum { TOTAL_WORDS = (CELLS_MAX * CAGES_SIZE_MAX) / 64 + 1 };
+typedef struct {
+    uint64_t words[TOTAL_WORDS];
+} total_set;
+
+// How a value moves a cage's total along: v takes total t to t + step[v], for the t in fits[v]
+// (those it doesn't take past the target). Totals start at 0.
+typedef struct {
+    int        words;
+    int        target;
+    int        step[CAGES_SIZE_MAX + 1];
+    total_set  fits[CAGES_SIZE_MAX + 1];
+} total_moves;
+
+static void _shift_up(const total_set *in, int words, int by, total_set *out) {
+    int w_by = by / 64;
+    int b_by = by % 64;
+    for (int w = words - 1; w >= 0; --w) {
+        int from = w - w_by;
+        uint64_t word = (from >= 0) ? (in->words[from] << b_by) : 0;
+        if ((b_by != 0) && (from >= 1)) {
+            word |= in->words[from - 1] >> (64 - b_by);
+        }
+        out->words[w] = word;
+    }
+}
+
+static void _shift_down(const total_set *in, int words, int by, total_set *out) {
+    int w_by = by / 64;
+    int b_by = by % 64;
+    for (int w = 0; w < words; ++w) {
+        int from = w + w_by;
+        uint64_t word = (from < words) ? (in->words[from] >> b_by) : 0;
+        if ((b_by != 0) && (from + 1 < words)) {
+            word |= in->words[from + 1] << (64 - b_by);
+        }
+        out->words[w] = word;
+    }
+}
+
+// sets totals [0, n) of set.
+static void _fill_totals(total_set *set, int words, int n) {
+    for (int w = 0; w < words; ++w) {
+        int bits = n - 64 * w;
+        set->words[w] = (bits >= 64) ? ~(uint64_t)0 : ((bits <= 0) ? 0 : (((uint64_t)1 << bits) - 1));
+    }
+}
+
+// 0 if the target is out of reach of any k values.
+static int _sum_moves(int size, int k, long target, total_moves *m) {
+    if ((target < k) || (target > (long)size * k)) {
+        return 0;
+    }
+    m->words  = target / 64 + 1;
+    m->target = target;
+    for (int v = 1; v <= size; ++v) {
+        m->step[v] = v;
+        _fill_totals(&m->fits[v], m->words, target - v + 1);
+    }
+    return 1;
+}
+
+// the powers of 2, 3, 5 and 7 in each value
+static const unsigned char FACTORS[CAGES_SIZE_MAX + 1][4] = {
+    { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 2, 0, 0, 0 },
+    { 0, 0, 1, 0 }, { 1, 1, 0, 0 }, { 0, 0, 0, 1 }, { 3, 0, 0, 0 }, { 0, 2, 0, 0 }
+};
+static const int PRIMES[4] = { 2, 3, 5, 7 };
+
+// A product is numbered by its powers of 2, 3, 5 and 7 as digits, each in base one more than
+// the target's power of that prime; so every divisor of the target gets a number, the target
+// the greatest. 0 if the target has any other factor, or more divisors than there are totals.
+static int _product_moves(int size, long target, total_moves *m) {
+    if (target < 1) {
+        return 0;
+    }
+    int powers[4];
+    int place[4];
+    int divisors = 1;
+    for (int j = 0; j < 4; ++j) {
+        for (powers[j] = 0; target % PRIMES[j] == 0; ++powers[j]) {
+            target /= PRIMES[j];
+        }
+        place[j]  = divisors;
+        divisors *= powers[j] + 1;
+        if (divisors > 64 * TOTAL_WORDS) {
+            return 0;
+        }
+    }
+    if (target != 1) {
+        return 0;
+    }
+
+    m->words  = (divisors + 63) / 64;
+    m->target = divisors - 1;
+    for (int v = 1; v <= size; ++v) {
+        m->step[v] = 0;
+        for (int j = 0; j < 4; ++j) {
+            m->step[v] += FACTORS[v][j] * place[j];
+        }
+        memset(&m->fits[v], 0, sizeof(total_set));
+    }
+    // the divisors in order, counting up their powers (the digits) with carries
+    int digits[4] = { 0, 0, 0, 0 };
+    for (int t = 0; t < divisors; ++t) {
+        for (int v = 1; v <= size; ++v) {
+            int fits = (digits[0] + FACTORS[v][0] <= powers[0]) && (digits[1] + FACTORS[v][1] <= powers[1]) &&
+                (digits[2] + FACTORS[v][2] <= powers[2]) && (digits[3] + FACTORS[v][3] <= powers[3]);
+            m->fits[v].words[t / 64] |= (uint64_t)fits << (t % 64);
+        }
+        for (int j = 0; (j < 4) && (++digits[j] > powers[j]); ++j) {
+            digits[j] = 0;
+        }
+    }
+    return 1;
+}
+
+// For a cage too big to enumerate: keeps the values which leave the other cells some way of
+// making up the rest of the target. The totals the cells before each one can make are carried
+// forward, and the totals still needed from the cells after it backward. Cells of the cage in
+// the same row or column aren't kept apart, so it keeps a little more than enumerating would.
+static void _total_support(const solver_puzzle *p, const solver_grid *g, int cage, candidates *support) {
+    const unsigned char *cells = p->cells + p->first[cage];
+    const int k = p->first[cage + 1] - p->first[cage];
+    const cage_clue clue = p->clues[cage];
+
+    total_moves m;
+    int reachable = (clue.operation == CAGE_ADD) ? _sum_moves(p->size, k, clue.target, &m) :
+        _product_moves(p->size, clue.target, &m);
+    if (! reachable) {
+        // (either nothing makes the target, or a product too big to follow, which only happens
+        // in cages far bigger than any real puzzle has: then any divisor will do)
+        for (int i = 0; i < k; ++i) {
+            support[i] = 0;
+            for (candidates left = g->cells[cells[i]]; left; left &= left - 1) {
+                int v = _lowest(left);
+                int divides = (clue.operation == CAGE_MULTIPLY) && (clue.target > 0) && (clue.target % v == 0);
+                support[i] |= divides ? (left & -left) : 0;
+            }
+        }
+        return;
+    }
+    const int words = m.words;
+
+    // reach[i]: the totals cells [0, i) can make
+    total_set reach[CELLS_MAX + 1];
+    memset(&reach[0], 0, sizeof(total_set));
+    reach[0].words[0] = 1;
+    for (int i = 0; i < k; ++i) {
+        memset(&reach[i + 1], 0, sizeof(total_set));
+        for (candidates left = g->cells[cells[i]]; left; left &= left - 1) {
+            int v = _lowest(left);
+            total_set from;
+            for (int w = 0; w < words; ++w) {
+                from.words[w] = reach[i].words[w] & m.fits[v].words[w];
+            }
+            total_set to;
+            _shift_up(&from, words, m.step[v], &to);
+            for (int w = 0; w < words; ++w) {
+                reach[i + 1].words[w] |= to.words[w];
+            }
+        }
+    }
+
+    // need: the totals cells [0, i] must make, working back from the target
+    total_set need;
+    memset(&need, 0, sizeof(need));
+    need.words[m.target / 64] = (uint64_t)1 << (m.target % 64);
+    for (int i = k - 1; i >= 0; --i) {
+        total_set before;
+        memset(&before, 0, sizeof(before));
+        support[i] = 0;
+        for (candidates left = g->cells[cells[i]]; left; left &= left - 1) {
+            int v = _lowest(left);
+            total_set back;
+            _shift_down(&need, words, m.step[v], &back);
+            uint64_t met = 0;
+            for (int w = 0; w < words; ++w) {
+                back.words[w] &= m.fits[v].words[w];
+                before.words[w] |= back.words[w];
+                met |= back.words[w] & reach[i].words[w];
+            }
+            support[i] |= met ? (left & -left) : 0;
+        }
+        need = before;
+    }
+}
+
+// How many assignments enumerating the cage would try, up to a little over ENUMERATION_LIMIT.
+static long _assignments(const solver_puzzle *p, const solver_grid *g, int cage) {
+    const unsigned char *cells = p->cells + p->first[cage];
+    const int k = p->first[cage + 1] - p->first[cage];
+
+    long assignments = 1;
+    for (int i = 0; (i < k) && (assignments <= ENUMERATION_LIMIT); ++i) {
+        assignments *= __builtin_popcount(g->cells[cells[i]]);
+    }
+    return assignments;
+}
+
+static int _narrow_cage(const solver_puzzle *p, solver_grid *g, solver_pending *pending, int cage, const candidates *support) {
+    const unsigned char *cells = p->cells + p->first[cage];
+    const int k = p->first[cage + 1] - p->first[cage];
+    for (int i = 0; i < k; ++i) {
+        if (support[i] == 0) {
+            return 0;
+        }
+        _narrow(p, g, pending, cells[i], support[i]);
+    }
+    return 1;
+}
+
+// The cells of a sum or product cage already decided leave the others a smaller cage, of what's
+// left of the target, whose values the combination tables give. 0 if nothing makes it.
+static int _residual_cage(const solver_puzzle *p, solver_grid *g, solver_pending *pending, int cage) {
+    const unsigned char *cells = p->cells + p->first[cage];
+    const int k = p->first[cage + 1] - p->first[cage];
+    const cage_clue clue = p->clues[cage];
+
+    long decided = (clue.operation == CAGE_ADD) ? 0 : 1;
+    int open = 0;
+    for (int i = 0; i < k; ++i) {
+        candidates c = g->cells[cells[i]];
+        if (! _single(c)) {
+            ++open;
+        } else if (clue.operation == CAGE_ADD) {
+            decided += _lowest(c);
+        } else {
+            decided *= _lowest(c);
+        }
+    }
+    if (open == 0) {
+        // (enumerating checks the target)
+        return 1;
+    }
+    long rest = clue.target - decided;
+    if (clue.operation == CAGE_MULTIPLY) {
+        if (clue.target % decided != 0) {
+            return 0;
+        }
+        rest = clue.target / decided;
+    }
+    candidates allowed = combination_candidates(p->size, clue.operation, open, rest);
+    for (int i = 0; i < k; ++i) {
+        candidates c = g->cells[cells[i]];
+        if (_single(c)) {
+            continue;
+        }
+        if ((c & allowed) == 0) {
+            return 0;
+        }
+        _narrow(p, g, pending, cells[i], c & allowed);
+    }
+    return 1;
+}
+
+// Strikes the candidates of a cage's cells which are in no assignment that makes its target. 0 if
+// there's no such assignment at all. A sum or product cage is first held to what the combination
+// tables allow its undecided cells, and one with too many assignments to enumerate then gets the
+// cheaper check, which may leave it few enough.
+static int _propagate_cage(const solver_puzzle *p, solver_grid *g, solver_pending *pending, int cage) {
+    candidates support[CELLS_MAX];
+    cage_operation operation = p->clues[cage].operation;
+    if (((operation == CAGE_ADD) || (operation == CAGE_MULTIPLY)) && ! _residual_cage(p, g, pending, cage)) {
+        return 0;
+    }
+    if (_assignments(p, g, cage) > ENUMERATION_LIMIT) {
+        _total_support(p, g, cage, support);
+        if (! _narrow_cage(p, g, pending, cage, support)) {
+            return 0;
+        }
+        if (_assignments(p, g, cage) > ENUMERATION_LIMIT) {
+            // the cheaper check might find more on a second look
+            return 1;
+        }
+    }
+
+    _enumerate_cage(p, g, cage, support);
+    if (! _narrow_cage(p, g, pending, cage, support)) {
+        return 0;
+    }
+    // enumerating leaves nothing more to find in the cage until one of its cells changes again
+    _remove_cage(&pending->cages, cage);
+    return 1;
+}
+
+// As enumerating the cage, from its listed assignments: those still open are the ones with a
+// candidate in every cell, and a cell's candidates which are in none of them go. Then, for each
+// row and column the cage is in, a value which every open assignment puts in the cage's cells
+// there goes from the rest of the line. open is the cage's part of the search's, and seen the
+// candidates of its cells when it was last brought up to date (see solver_search), so only the
+// candidates gone since need to be looked at. 0 if no assignment is left open.
+static int _propagate_tuples(const solver_puzzle *p, solver_grid *g, solver_pending *pending, int cage,
+    uint64_t *open, candidates *seen) {
+    const unsigned char *cells = p->cells + p->first[cage];
+    const int k = p->first[cage + 1] - p->first[cage];
+    const int size = p->size;
+
+    // the words of open with any assignments still in them
+    unsigned short live[TUPLES_MAX / 64];
+    int live_n = 0;
+    for (int w = 0; w < p->tuple_words[cage]; ++w) {
+        live[live_n] = (unsigned short)w;
+        live_n += open[w] != 0;
+    }
+    // (if no assignment closes, there's nothing new to find, unless the cage hasn't been looked
+    // at yet)
+    int closed = seen[0] == (candidates)~0;
+    for (int i = 0; (i < k) && (live_n > 0); ++i) {
+        candidates c = g->cells[cells[i]];
+        candidates gone = seen[i] & ~c & (candidates)((1 << size) - 1);
+        seen[i] = c;
+        if (gone == 0) {
+            continue;
+        }
+        // (closing the assignments with a value that's gone, or keeping those with one that's
+        // left, whichever is less work)
+        int keep = __builtin_popcount(c) < __builtin_popcount(gone);
+        candidates by = keep ? c : gone;
+        int still = 0;
+        for (int l = 0; l < live_n; ++l) {
+            int w = live[l];
+            uint64_t in = 0;
+            for (candidates left = by; left; left &= left - 1) {
+                in |= _tuple_mask(p, cage, i, _lowest(left))[w];
+            }
+            uint64_t was = open[w];
+            open[w] &= keep ? in : ~in;
+            closed |= open[w] != was;
+            live[still] = (unsigned short)w;
+            still += open[w] != 0;
+        }
+        live_n = still;
+    }
+    if (live_n == 0) {
+        return 0;
+    }
+    // (narrowing puts the cage back on pending, but there's nothing more in it to find)
+    if (! closed) {
+        _remove_cage(&pending->cages, cage);
+        return 1;
+    }
+
+    for (int i = 0; i < k; ++i) {
+        candidates support = 0;
+        for (candidates left = g->cells[cells[i]]; left; left &= left - 1) {
+            const uint64_t *mask = _tuple_mask(p, cage, i, _lowest(left));
+            for (int l = 0; l < live_n; ++l) {
+                if (open[live[l]] & mask[live[l]]) {
+                    support |= left & -left;
+                    break;
+                }
+            }
+        }
+        _narrow(p, g, pending, cells[i], support);
+    }
+
+    for (int columns = 0; columns <= 1; ++columns) {
+        uint32_t done = 0;
+        for (int i = 0; i < k; ++i) {
+            int line = columns ? cells[i] % size : cells[i] / size;
+            if (done & (1u << line)) {
+                continue;
+            }
+            done |= 1u << line;
+            // the cage's cells in the line (by their place in the cage, and in the line), and
+            // what they and the line's other cells might hold
+            int in[CAGES_SIZE_MAX];
+            int in_n = 0;
+            uint32_t mine = 0;
+            candidates held = 0;
+            candidates elsewhere = 0;
+            for (int j = i; j < k; ++j) {
+                if ((columns ? cells[j] % size : cells[j] / size) == line) {
+                    in[in_n++] = j;
+                    mine |= 1u << (columns ? cells[j] / size : cells[j] % size);
+                    held |= g->cells[cells[j]];
+                }
+            }
+            for (int x = 0; x < size; ++x) {
+                if (! (mine & (1u << x))) {
+                    elsewhere |= g->cells[columns ? x * size + line : line * size + x];
+                }
+            }
+
+            for (candidates left = held & elsewhere; left; left &= left - 1) {
+                int v = _lowest(left);
+                // an open assignment without v in the line
+                uint64_t without = 0;
+                for (int l = 0; (l < live_n) && ! without; ++l) {
+                    uint64_t with = 0;
+                    for (int j = 0; j < in_n; ++j) {
+                        with |= _tuple_mask(p, cage, in[j], v)[live[l]];
+                    }
+                    without = open[live[l]] & ~with;
+                }
+                for (int x = 0; (x < size) && ! without; ++x) {
+                    int cell = columns ? x * size + line : line * size + x;
+                    if (! (mine & (1u << x))) {
+                        _narrow(p, g, pending, cell, g->cells[cell] & ~(left & -left));
+                    }
+                }
+            }
+        }
+    }
+    _remove_cage(&pending->cages, cage);
+    return 1;
+}
+
+// A branch of a parallel search, for whichever worker gets to it first.
+typedef struct {
+    solver_grid    grid;
+    solver_pending pending;
+    int            depth;
+} search_task;
+
+// One worker's tasks, in a ring. The worker pushes and pops at the bottom, so it goes depth first;
+// the others steal from the top, where the oldest and so biggest branches are.
+typedef struct {
+    pthread_mutex_t lock;
+    // tasks[top % DEQUE_CAPACITY] ... tasks[(bottom - 1) % DEQUE_CAPACITY]
+    long            top;
+    long            bottom;
+    search_task     tasks[DEQUE_CAPACITY];
+} task_deque;
+
+// What the workers of a parallel search share.
+typedef struct {
+    const solver_puzzle *p;
+    int                  workers;
+    task_deque          *deques;
+    // guards found, solution and nodes, and is what idle workers wait on
+    pthread_mutex_t      lock;
+    pthread_cond_t       work_ready;
+    long                 wanted;
+    long                 found;
+    unsigned char       *solution;
+    long                 nodes;
+    // The rest are updated atomically. stop is set once the search is over; outstanding counts
+    // the tasks pushed and not yet finished, queued those still in a deque, and idle the workers
+    // waiting for one.
+    int                  stop;
+    long                 outstanding;
+    long                 queued;
+    long                 idle;
+} search_shared;
+
+// The state of one search (or one worker's part of a parallel search): what it has learnt about
+// where contradictions come from, and where it writes its answer.
+typedef struct {
+    const solver_puzzle *p;
+    // how often each cage, and each row and column (as in solver_pending), has been found
+    // unsatisfiable
+    unsigned int         cage_failures[ALL_CAGES_MAX];
+    unsigned int         line_failures[2 * CAGES_SIZE_MAX];
+    // the search stops once it has found this many solutions; the first is written to solution.
+    long                 wanted;
+    long                 found;
+    unsigned char       *solution;
+    solver_stats        *stats;
+    // it gives up (with gave_up set) rather than make more than guess_limit guesses, unless 0
+    long                 guess_limit;
+    int                  gave_up;
+    // What _propagate_tuples has found of the listed assignments at each level of the search: a
+    // guess only closes more of them, so each level starts as a copy of the one above. A level is
+    // which are open, p->open_words words, and the candidates of every cage's cells when it last
+    // looked at the cage, in the order of p->cells (all bits set for one it hasn't). open and seen
+    // are the current level's. NULL if there's no memory for them, when the cages are enumerated.
+    uint64_t            *open_levels;
+    candidates          *seen_levels;
+    uint64_t            *open;
+    candidates          *seen;
+    // for a parallel search, which takes its solutions there instead, and this worker's number
+    search_shared       *shared;
+    int                  worker;
+} solver_search;
+
+// Propagates until nothing more follows. 0 on a contradiction, which is blamed on the line or
+// cage which found it.
+static int _propagate(solver_search *s, solver_grid *g, solver_pending *pending) {
+    const solver_puzzle *p = s->p;
+    for (;;) {
+        // lines are cheap, so they go first
+        if (pending->lines) {
+            int line = __builtin_ctz(pending->lines);
+            pending->lines &= pending->lines - 1;
+            if (! _propagate_line(p, g, pending, line)) {
+                ++s->line_failures[line];
+                return 0;
+            }
+        } else {
+            int cage = _take_cage(&pending->cages);
+            if (cage == -1) {
+                break;
+            }
+            int propagated = (p->tuple_masks[cage] && s->open) ?
+                _propagate_tuples(p, g, pending, cage, s->open + p->tuple_start[cage], s->seen + p->first[cage]) :
+                _propagate_cage(p, g, pending, cage);
+            if (! propagated) {
+                ++s->cage_failures[cage];
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// The cell to guess at: the one with the fewest candidates left (but more than one) for the
+// contradictions its cage, row and column have run into so far. Early on that is simply the
+// cell with the fewest candidates; as the search goes on it turns to the parts of the puzzle
+// which keep going wrong. -1 if every cell is down to one candidate.
+static int _choose(const solver_search *s, const solver_grid *g) {
+    const solver_puzzle *p = s->p;
+    int best = -1;
+    // n / failures < best_n / best_failures, without dividing
+    unsigned long best_n = 1;
+    unsigned long best_failures = 0;
+    for (int cell = 0; cell < p->cell_n; ++cell) {
+        unsigned long n = __builtin_popcount(g->cells[cell]);
+        if (n < 2) {
+            continue;
+        }
+        unsigned long failures = 1 + s->cage_failures[p->cage_of[cell]] + s->line_failures[cell / p->size] +
+            s->line_failures[p->size + cell % p->size];
+        if ((best == -1) || (n * best_failures < best_n * failures)) {
+            best          = cell;
+            best_n        = n;
+            best_failures = failures;
+        }
+    }
+    return best;
+}
+
+static int _stopped(const search_shared *shared) {
+    return __atomic_load_n(&shared->stop, __ATOMIC_RELAXED);
+}
+
+// Records a solution of a parallel search. 1 if the search is over.
+static int _shared_solution(search_shared *shared, const solver_grid *g) {
+    pthread_mutex_lock(&shared->lock);
+    if (! _stopped(shared)) {
+        if (shared->found++ == 0) {
+            for (int i = 0; i < shared->p->cell_n; ++i) {
+                shared->solution[i] = _lowest(g->cells[i]);
+            }
+        }
+        if (shared->found == shared->wanted) {
+            __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+            pthread_cond_broadcast(&shared->work_ready);
+        }
+    }
+    int over = _stopped(shared);
+    pthread_mutex_unlock(&shared->lock);
+    return over;
+}
+
+// Whether to hand out the other branches of a guess at depth: always near the top, and otherwise
+// only if there are workers waiting with nothing queued for them.
+static int _splits(const search_shared *shared, int depth) {
+    return (depth < SPLIT_DEPTH) ||
+        (__atomic_load_n(&shared->idle, __ATOMIC_RELAXED) > __atomic_load_n(&shared->queued, __ATOMIC_RELAXED));
+}
+
+// Pushes the branch of g where cell is guessed as value onto the worker's deque. 0 if it's full.
+static int _push_branch(solver_search *s, const solver_grid *g, int cell, candidates value, int depth) {
+    search_shared *shared = s->shared;
+    task_deque *deque = &shared->deques[s->worker];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == DEQUE_CAPACITY) {
+        pthread_mutex_unlock(&deque->lock);
+        return 0;
+    }
+    search_task *task = &deque->tasks[deque->bottom % DEQUE_CAPACITY];
+    task->grid = *g;
+    memset(&task->pending, 0, sizeof(task->pending));
+    _narrow(s->p, &task->grid, &task->pending, cell, value);
+    task->depth = depth;
+    ++deque->bottom;
+    pthread_mutex_unlock(&deque->lock);
+
+    __atomic_add_fetch(&shared->outstanding, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&shared->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&shared->lock);
+        pthread_cond_broadcast(&shared->work_ready);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return 1;
+}
+
+// Starts the search's levels over, at the top with every listed assignment open.
+static void _reset_levels(solver_search *s) {
+    const solver_puzzle *p = s->p;
+    if (s->open_levels == NULL) {
+        return;
+    }
+    s->open = s->open_levels;
+    s->seen = s->seen_levels;
+    for (int cage = 0; cage < p->cage_n; ++cage) {
+        uint64_t *open = s->open + p->tuple_start[cage];
+        for (int w = 0; (p->tuple_masks[cage] != NULL) && (w < p->tuple_words[cage]); ++w) {
+            long bits = p->tuple_n[cage] - 64L * w;
+            open[w] = (bits >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+        }
+    }
+    memset(s->seen, 0xff, p->first[p->cage_n] * sizeof(candidates));
+}
+
+// Makes room for the search's levels (see solver_search), if any cages are listed.
+static void _create_levels(solver_search *s) {
+    const solver_puzzle *p = s->p;
+    s->open_levels = NULL;
+    s->seen_levels = NULL;
+    s->open        = NULL;
+    s->seen        = NULL;
+    if (p->tuple_block == NULL) {
+        return;
+    }
+    // each guess leaves one more cell decided, so there are no more levels than cells
+    const long levels = p->cell_n + 1;
+    s->open_levels = malloc(levels * (p->open_words ? p->open_words : 1) * sizeof(uint64_t));
+    s->seen_levels = malloc(levels * p->first[p->cage_n] * sizeof(candidates));
+    if ((s->open_levels == NULL) || (s->seen_levels == NULL)) {
+        free(s->open_levels);
+        free(s->seen_levels);
+        s->open_levels = NULL;
+        s->seen_levels = NULL;
+        return;
+    }
+    _reset_levels(s);
+}
+
+static void _release_levels(solver_search *s) {
+    free(s->open_levels);
+    free(s->seen_levels);
+}
+
+// Moves down a level, starting it as a copy of the one above; or back up.
+static void _level_down(solver_search *s) {
+    const solver_puzzle *p = s->p;
+    if (s->open) {
+        memcpy(s->open + p->open_words, s->open, p->open_words * sizeof(uint64_t));
+        memcpy(s->seen + p->first[p->cage_n], s->seen, p->first[p->cage_n] * sizeof(candidates));
+        s->open += p->open_words;
+        s->seen += p->first[p->cage_n];
+    }
+}
+
+static void _level_up(solver_search *s) {
+    const solver_puzzle *p = s->p;
+    if (s->open) {
+        s->open -= p->open_words;
+        s->seen -= p->first[p->cage_n];
+    }
+}
+
+// Returns 1 once the search is to stop: it has found as many solutions as it wanted (or, in a
+// parallel search, some worker has), or used up its guesses.
+static int _search(solver_search *s, solver_grid *g, solver_pending pending, int depth) {
+    const solver_puzzle *p = s->p;
+    if (s->shared && _stopped(s->shared)) {
+        return 1;
+    }
+    if (! _propagate(s, g, &pending)) {
+        return 0;
+    }
+
+    int cell = _choose(s, g);
+    if (cell == -1) {
+        if (s->shared) {
+            return _shared_solution(s->shared, g);
+        }
+        if (s->found++ == 0) {
+            for (int i = 0; i < p->cell_n; ++i) {
+                s->solution[i] = _lowest(g->cells[i]);
+            }
+        }
+        return s->found == s->wanted;
+    }
+
+    if (s->guess_limit && (s->stats->nodes >= s->guess_limit)) {
+        s->gave_up = 1;
+        return 1;
+    }
+    ++s->stats->nodes;
+    candidates mine = g->cells[cell];
+    if (s->shared && _splits(s->shared, depth)) {
+        // the first branch stays here, and as many of the others as fit go to the deque
+        candidates others = mine & (mine - 1);
+        while (others && _push_branch(s, g, cell, others & -others, depth + 1)) {
+            others &= others - 1;
+        }
+        mine = (mine & -mine) | others;
+    }
+    int over = 0;
+    for (; mine && ! over; mine &= mine - 1) {
+        solver_grid guess = *g;
+        solver_pending next;
+        memset(&next, 0, sizeof(next));
+        _narrow(p, &guess, &next, cell, mine & -mine);
+        _level_down(s);
+        over = _search(s, &guess, next, depth + 1);
+        _level_up(s);
+    }
+    return over;
+}
+
+// Takes a task for worker: its own newest, or failing that another's oldest, or else waits for
+// one. 0 once the search is over.
+static int _next_task(search_shared *shared, int worker, search_task *task) {
+    for (;;) {
+        if (_stopped(shared)) {
+            return 0;
+        }
+        for (int i = 0; i < shared->workers; ++i) {
+            task_deque *deque = &shared->deques[(worker + i) % shared->workers];
+            pthread_mutex_lock(&deque->lock);
+            int taken = deque->bottom > deque->top;
+            if (taken) {
+                long from = (i == 0) ? --deque->bottom : deque->top++;
+                *task = deque->tasks[from % DEQUE_CAPACITY];
+            }
+            pthread_mutex_unlock(&deque->lock);
+            if (taken) {
+                __atomic_sub_fetch(&shared->queued, 1, __ATOMIC_SEQ_CST);
+                return 1;
+            }
+        }
+
+        pthread_mutex_lock(&shared->lock);
+        __atomic_add_fetch(&shared->idle, 1, __ATOMIC_SEQ_CST);
+        while ((! _stopped(shared)) && (__atomic_load_n(&shared->outstanding, __ATOMIC_SEQ_CST) > 0) &&
+            (__atomic_load_n(&shared->queued, __ATOMIC_SEQ_CST) <= 0)) {
+            pthread_cond_wait(&shared->work_ready, &shared->lock);
+        }
+        __atomic_sub_fetch(&shared->idle, 1, __ATOMIC_SEQ_CST);
+        int over = _stopped(shared) || (__atomic_load_n(&shared->outstanding, __ATOMIC_SEQ_CST) == 0);
+        pthread_mutex_unlock(&shared->lock);
+        if (over) {
+            return 0;
+        }
+    }
+}
+
+static void _search_worker(void *argument, int worker) {
+    search_shared *shared = argument;
+    solver_stats stats = { 0 };
+    solver_search s;
+    memset(&s, 0, sizeof(s));
+    s.p      = shared->p;
+    s.stats  = &stats;
+    s.shared = shared;
+    s.worker = worker;
+
+    _create_levels(&s);
+
+    search_task task;
+    while (_next_task(shared, worker, &task)) {
+        // (what the last task found of the listed assignments needn't hold for this one)
+        _reset_levels(&s);
+        _search(&s, &task.grid, task.pending, task.depth);
+        if (__atomic_sub_fetch(&shared->outstanding, 1, __ATOMIC_SEQ_CST) == 0) {
+            pthread_mutex_lock(&shared->lock);
+            pthread_cond_broadcast(&shared->work_ready);
+            pthread_mutex_unlock(&shared->lock);
+        }
+    }
+
+    _release_levels(&s);
+    pthread_mutex_lock(&shared->lock);
+    shared->nodes += stats.nodes;
+    pthread_mutex_unlock(&shared->lock);
+}
+
+// Runs the search from g across pool's workers, starting from a single task on the first one's
+// deque. -1 if there's no memory for the deques.
+static long _search_parallel(const solver_puzzle *p, const solver_grid *g, solver_pending pending, long wanted,
+    unsigned char *solution, solver_stats *stats, work_pool *pool) {
+    search_shared shared;
+    memset(&shared, 0, sizeof(shared));
+    shared.p        = p;
+    shared.workers  = work_pool_workers(pool);
+    shared.wanted   = wanted;
+    shared.solution = solution;
+    shared.deques   = calloc(shared.workers, sizeof(task_deque));
+    if (shared.deques == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < shared.workers; ++i) {
+        pthread_mutex_init(&shared.deques[i].lock, NULL);
+    }
+    pthread_mutex_init(&shared.lock, NULL);
+    pthread_cond_init(&shared.work_ready, NULL);
+
+    shared.deques[0].tasks[0] = (search_task){ *g, pending, 0 };
+    shared.deques[0].bottom   = 1;
+    shared.outstanding        = 1;
+    shared.queued             = 1;
+    run_workers(pool, _search_worker, &shared);
+    stats->nodes = shared.nodes;
+
+    pthread_cond_destroy(&shared.work_ready);
+    pthread_mutex_destroy(&shared.lock);
+    for (int i = 0; i < shared.workers; ++i) {
+        pthread_mutex_destroy(&shared.deques[i].lock);
+    }
+    free(shared.deques);
+    return shared.found;
+}
+
+static long _solve(const kenken_puzzle *puzzle, long wanted, long guess_limit, unsigned char *solution,
+    solver_stats *stats, work_pool *pool) {
+    solver_puzzle p;
+    if (! _compile(puzzle, &p)) {
+        return -1;
+    }
+    solver_stats ignored;
+    stats = stats ? stats : &ignored;
+    stats->nodes = 0;
+    _derive_cages(&p);
+
+    solver_grid g;
+    for (int cell = 0; cell < p.cell_n; ++cell) {
+        g.cells[cell] = (candidates)((1 << p.size) - 1);
+    }
+    for (int cage = 0; cage < p.cage_n; ++cage) {
+        candidates admissible = combination_candidates(p.size, p.clues[cage].operation, p.first[cage + 1] - p.first[cage],
+            p.clues[cage].target);
+        for (int i = p.first[cage]; i < p.first[cage + 1]; ++i) {
+            g.cells[p.cells[i]] &= admissible;
+        }
+    }
+    solver_pending pending;
+    memset(&pending, 0, sizeof(pending));
+    pending.lines = (uint32_t)((1u << (2 * p.size)) - 1);
+    for (int cage = 0; cage < p.cage_n; ++cage) {
+        _add_cage(&pending.cages, cage);
+    }
+    solver_search s;
+    memset(&s, 0, sizeof(s));
+    s.p           = &p;
+    s.solution    = solution;
+    s.stats       = stats;
+    s.wanted      = wanted;
+    s.guess_limit = guess_limit;
+    if (! _propagate(&s, &g, &pending)) {
+        return 0;
+    }
+
+    // A puzzle which propagating alone doesn't solve has what's left of its cages listed, and
+    // looked at again through the lists.
+    int decided = 1;
+    for (int cell = 0; cell < p.cell_n; ++cell) {
+        decided &= _single(g.cells[cell]);
+    }
+    if (! decided) {
+        _list_tuples(&p, &g);
+        for (int cage = 0; cage < p.cage_n; ++cage) {
+            _add_cage(&pending.cages, cage);
+        }
+    }
+
+    long found = -1;
+    if (work_pool_workers(pool) > 1) {
+        // (without the memory for it, the search just isn't split)
+        found = _search_parallel(&p, &g, pending, wanted, solution, stats, pool);
+    }
+    if (found == -1) {
+        _create_levels(&s);
+        _search(&s, &g, pending, 0);
+        _release_levels(&s);
+        found = s.gave_up ? -2 : s.found;
+    }
+    free(p.tuple_block);
+    return found;
+}
+
+int solve_puzzle(const kenken_puzzle *puzzle, unsigned char *solution, solver_stats *stats) {
+    return (int)_solve(puzzle, 1, 0, solution, stats, NULL);
+}
+
+int solve_puzzle_within(const kenken_puzzle *puzzle, long guess_limit, unsigned char *solution, solver_stats *stats) {
+    return (int)_solve(puzzle, 1, guess_limit, solution, stats, NULL);
+}
+
+long count_solutions(const kenken_puzzle *puzzle, long limit, solver_stats *stats) {
+    unsigned char solution[CELLS_MAX];
+    return _solve(puzzle, limit, 0, solution, stats, NULL);
+}
+
+int solve_puzzle_parallel(const kenken_puzzle *puzzle, unsigned char *solution, solver_stats *stats, work_pool *pool) {
+    return (int)_solve(puzzle, 1, 0, solution, stats, pool);
+}
+
+long count_solutions_parallel(const kenken_puzzle *puzzle, long limit, solver_stats *stats, work_pool *pool) {
+    unsigned char solution[CELLS_MAX];
+    return _solve(puzzle, limit, 0, solution, stats, pool);
+}
+
+// a clue is followed by a space, or the end of its line.
+static int _ends_clue(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == 0);
+}
+
+int parse_puzzle(const char *text, kenken_puzzle *puzzle, char *cages, cage_clue *clues) {
+    const int length = (int)strcspn(text, " \t\r\n");
+    int size = CAGES_SIZE_MIN;
+    while ((size < CAGES_SIZE_MAX) && (size * size < length)) {
+        ++size;
+    }
+    if (size * size != length) {
+        return 0;
+    }
+    memcpy(cages, text, length);
+    cages[length] = 0;
+
+    static const char operations[] = "+-x/=";
+    static const cage_operation by_symbol[] = { CAGE_ADD, CAGE_SUBTRACT, CAGE_MULTIPLY, CAGE_DIVIDE, CAGE_GIVEN };
+    int clue_n = 0;
+    const char *at = text + length;
+    for (;;) {
+        while ((*at == ' ') || (*at == '\t') || (*at == '\r')) {
+            ++at;
+        }
+        if ((*at == '\n') || (*at == 0)) {
+            break;
+        }
+        if ((clue_n == PUZZLE_CAGES_MAX) || (*at < '0') || (*at > '9')) {
+            return 0;
+        }
+        char *end;
+        long target = strtol(at, &end, 10);
+        const char *found = (*end != 0) ? strchr(operations, *end) : NULL;
+        if ((found == NULL) || (! _ends_clue(end[1]))) {
+            return 0;
+        }
+        clues[clue_n++] = (cage_clue){ by_symbol[found - operations], target };
+        at = end + 1;
+    }
+    *puzzle = (kenken_puzzle){ size, cages, clues, clue_n };
+    return 1;
+}
+
+int check_solution(const kenken_puzzle *puzzle, const unsigned char *solution) {
+    solver_puzzle p;
+    if (! _compile(puzzle, &p)) {
+        return 0;
+    }
+    candidates rows[CAGES_SIZE_MAX]    = { 0 };
+    candidates columns[CAGES_SIZE_MAX] = { 0 };
+    for (int cell = 0; cell < p.cell_n; ++cell) {
+        if ((solution[cell] < 1) || (solution[cell] > p.size)) {
+            return 0;
+        }
+        candidates bit = (candidates)(1 << (solution[cell] - 1));
+        if ((rows[cell / p.size] & bit) || (columns[cell % p.size] & bit)) {
+            return 0;
+        }
+        rows[cell / p.size]    |= bit;
+        columns[cell % p.size] |= bit;
+    }
+
+    for (int cage = 0; cage < p.cage_n; ++cage) {
+        int values[CELLS_MAX];
+        int k = p.first[cage + 1] - p.first[cage];
+        for (int i = 0; i < k; ++i) {
+            values[i] = solution[p.cells[p.first[cage] + i]];
+        }
+        if (! _makes_target(p.clues[cage].operation, p.clues[cage].target, values, k)) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,102 @@
+#ifndef _SOLVER_H
+#define _SOLVER_H
+
+#include "cages.h"
+#include "pool.h"
+
+// Solving a puzzle once its cages are known: every cell of a size x size puzzle holds one of
+// 1..size, each exactly once per row and per column, and the cells of every cage combine under
+// its operation to its target.
+//
+// Each cell keeps its remaining candidates as a bitmask. Placing a value strikes it from the
+// cell's row and column, a value with only one place left in a row or column goes there, and
+// every cage strikes the candidates which are in no assignment of its cells that makes its
+// target. What propagating that way doesn't solve has each of its cages of up to 8 cells listed,
+// every assignment which makes the target and keeps the rows and columns distinct, as bitsets; the
+// assignments a cell's struck candidates close stay closed for the rest of the branch, and a value
+// every open assignment puts in a row or column of the cage goes from the rest of it. Once nothing
+// more follows, the search guesses at a cell with the fewest candidates left, and backtracks.
+//
+// Puzzles like printed ones (small cages, every operation) take about a tenth of a millisecond,
+// and at most one (see bench_solver). Puzzles of large add and multiply cages and no givens can
+// take far longer: the worst 9x9s found take thousands of guesses, tens of milliseconds.
+
+typedef enum {
+    // the cells sum to the target
+    CAGE_ADD,
+    // two cells, the larger less the smaller
+    CAGE_SUBTRACT,
+    // the cells multiply to the target
+    CAGE_MULTIPLY,
+    // two cells, the larger over the smaller (exactly)
+    CAGE_DIVIDE,
+    // one cell, which is the target
+    CAGE_GIVEN
+} cage_operation;
+
+// as many cages as there are cage names
+enum { PUZZLE_CAGES_MAX = 52 };
+
+typedef struct {
+    cage_operation  operation;
+    long            target;
+} cage_clue;
+
+typedef struct {
+    int              size;
+    // the layout as compute_puzzle_cages gives it: size * size cage names in reading order.
+    const char      *cages;
+    // the clue of each cage, by its number: A is 0, ..., Z is 25, a is 26, ..., z is 51.
+    const cage_clue *clues;
+    int              clue_n;
+} kenken_puzzle;
+
+typedef struct {
+    // guesses made; a puzzle which propagation alone solves takes none.
+    long nodes;
+} solver_stats;
+
+// Writes a solution (size * size values, 1..size, in reading order) to solution. Returns 1 if
+// there is one, 0 if there isn't, or -1 if the puzzle is malformed: a size out of range, a cage
+// name with no clue, more clues than cages, or a subtract, divide or given cage of the wrong
+// number of cells. stats may be NULL.
+int solve_puzzle(const kenken_puzzle *puzzle, unsigned char *solution, solver_stats *stats);
+
+// As solve_puzzle, but giving up, and returning -2, rather than make more than guess_limit
+// guesses (for puzzles in bulk, where one which is out of all reason shouldn't hold up the rest).
+int solve_puzzle_within(const kenken_puzzle *puzzle, long guess_limit, unsigned char *solution, solver_stats *stats);
+
+// The number of solutions puzzle has, counting no further than limit (so a limit of 2 tells a
+// puzzle with one solution from one with several), or -1 if it's malformed. stats may be NULL.
+long count_solutions(const kenken_puzzle *puzzle, long limit, solver_stats *stats);
+
+// As solve_puzzle and count_solutions, with the search spread over pool's workers (see pool.h).
+// The branches of the first few guesses, and later those of any guess made while workers are
+// left waiting, become tasks on per-worker deques: each worker takes its own newest task, or
+// steals another's oldest. Once as many solutions as wanted have turned up, the other tasks are
+// dropped. Of several solutions, the one written may differ from run to run; stats counts the
+// guesses of all the workers. pool may be NULL, for the same search as solve_puzzle.
+//
+// Whether this is any faster than solve_puzzle on several cores hasn't been measured: it has only
+// run on one, where it takes 0.65 to 1.1 times as long as with one worker, only because the split
+// changes the order branches are searched in (see bench_solver).
+//
+// The search is one run_workers job, so it has the pool to itself until it's over: scans and
+// other searches on the same pool wait behind it, however long it takes. Give searches a pool of
+// their own rather than the one in puzzle_options, and don't start one from a task already
+// running on that pool.
+int solve_puzzle_parallel(const kenken_puzzle *puzzle, unsigned char *solution, solver_stats *stats, work_pool *pool);
+long count_solutions_parallel(const kenken_puzzle *puzzle, long limit, solver_stats *stats, work_pool *pool);
+
+// Reads a puzzle written as its layout, then the clue of each cage in cage order, each a target
+// followed by one of + - x / = (as compute_puzzle_clues writes them), separated by spaces: e.g.
+// "AABCDDCCD 2- 2= 7+ 5+". text ends at its first newline, if it has one. puzzle is left pointing
+// into cages (room for CAGES_SIZE_MAX * CAGES_SIZE_MAX + 1) and clues (room for PUZZLE_CAGES_MAX).
+// Returns 1, or 0 if text isn't a puzzle written so (whether the puzzle is well-formed is left to
+// the solver).
+int parse_puzzle(const char *text, kenken_puzzle *puzzle, char *cages, cage_clue *clues);
+
+// 1 if solution (as solve_puzzle writes it) is a solution of puzzle, otherwise 0.
+int check_solution(const kenken_puzzle *puzzle, const unsigned char *solution);
+
+#endif /* _SOLVER_H */
@@ -0,0 +1,115 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "combinations.h"
+
+// Checks the solver's combination tables (see combinations.h) against every way of filling each
+// cage, worked out the slow way: for every size, cage length and operation, every target, and
+// those just out of reach either side, must give exactly the values that appear in its fillings.
+//
+// usage: ./test_combinations
+
+static unsigned int test_n = 1;
+static unsigned int fail_n = 0;
+static unsigned short ok (unsigned short condition, char *description, ...) {
+    va_list args;
+    char description_buffer[1000];
+
+    va_start(args, description);
+    vsnprintf(description_buffer, 1000, description, args);
+    va_end(args);
+
+    printf("%sok %d - %s\n", condition ? "" : "not ", test_n, description_buffer);
+    ++test_n;
+
+    fail_n += (! condition);
+
+    return condition;
+}
+
+static void check_combinations(void) {
+    // size^k for the biggest size and cage in the tables
+    long product_max = 1;
+    for (int i = 0; i < COMBINATIONS_CELLS_MAX; ++i) {
+        product_max *= CAGES_SIZE_MAX;
+    }
+    combination_mask *products = malloc((product_max + 2) * sizeof(combination_mask));
+    const char *operation_names[] = { "+", "-", "x", "/", "=" };
+
+    for (int size = CAGES_SIZE_MIN; size <= CAGES_SIZE_MAX; ++size) {
+        for (int k = 1; k <= COMBINATIONS_CELLS_MAX; ++k) {
+            combination_mask sums[COMBINATIONS_CELLS_MAX * CAGES_SIZE_MAX + 2] = { 0 };
+            combination_mask differences[CAGES_SIZE_MAX + 1] = { 0 };
+            combination_mask quotients[CAGES_SIZE_MAX + 2] = { 0 };
+            memset(products, 0, (product_max + 2) * sizeof(combination_mask));
+            long tuple_n = 1;
+            for (int i = 0; i < k; ++i) {
+                tuple_n *= size;
+            }
+            for (long tuple = 0; tuple < tuple_n; ++tuple) {
+                int values[COMBINATIONS_CELLS_MAX];
+                long rest = tuple;
+                int sum = 0;
+                long product = 1;
+                combination_mask mask = 0;
+                for (int i = 0; i < k; ++i, rest /= size) {
+                    values[i] = rest % size + 1;
+                    sum += values[i];
+                    product *= values[i];
+                    mask |= 1 << (values[i] - 1);
+                }
+                sums[sum] |= mask;
+                products[product] |= mask;
+                if (k == 2) {
+                    int larger = (values[0] > values[1]) ? values[0] : values[1];
+                    int smaller = (values[0] > values[1]) ? values[1] : values[0];
+                    differences[larger - smaller] |= mask;
+                    quotients[larger / smaller] |= (larger % smaller == 0) ? mask : 0;
+                }
+            }
+
+            // every target, and those just out of reach either side
+            for (cage_operation operation = CAGE_ADD; operation <= CAGE_GIVEN; ++operation) {
+                long last = (operation == CAGE_MULTIPLY) ? tuple_n + 1 : k * size + 1;
+                long wrong = -2;
+                combination_mask expected = 0;
+                combination_mask actual = 0;
+                for (long target = -1; (target <= last) && (wrong == -2); ++target) {
+                    int in_range = (target >= 0);
+                    switch (operation) {
+                        case CAGE_ADD:
+                            expected = (in_range && (target <= k * size)) ? sums[target] : 0;
+                            break;
+                        case CAGE_MULTIPLY:
+                            expected = (in_range && (target <= tuple_n)) ? products[target] : 0;
+                            break;
+                        case CAGE_SUBTRACT:
+                            expected = ((k == 2) && in_range && (target < size)) ? differences[target] : 0;
+                            break;
+                        case CAGE_DIVIDE:
+                            expected = ((k == 2) && in_range && (target <= size)) ? quotients[target] : 0;
+                            break;
+                        case CAGE_GIVEN:
+                            expected = ((k == 1) && in_range && (target <= size)) ? sums[target] : 0;
+                            break;
+                    }
+                    actual = combination_candidates(size, operation, k, target);
+                    wrong = (actual != expected) ? target : -2;
+                }
+                char detail[100] = "";
+                if (wrong != -2) {
+                    snprintf(detail, sizeof(detail), ": target %ld gives %03x, expecting %03x", wrong, actual, expected);
+                }
+                ok(wrong == -2, "combinations: %dx%d, %d cells, %s%s", size, size, k, operation_names[operation], detail);
+            }
+        }
+    }
+    free(products);
+}
+
+int main(void) {
+    check_combinations();
+    exit(fail_n);
+}
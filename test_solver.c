@@ -0,0 +1,126 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "solver.h"
+
+// Checks the solver on puzzles given as text (see parse_puzzle), without OpenCV: small ones with
+// known answers, malformed ones, and the hardest 9x9 puzzles bench_solver's hard suite turned up,
+// each of which has to be solved within GUESSES_MAX guesses, checked, found to have just the one
+// solution, given up on with a guess too few, and solved the same on a pool of workers.
+//
+// usage: ./test_solver
+
+enum { CELLS_MAX = CAGES_SIZE_MAX * CAGES_SIZE_MAX };
+
+// (the most the hard puzzles take is 1419, sequentially)
+enum { GUESSES_MAX = 2500 };
+
+static const char *HARD[] = {
+    "ABCCDDDDEBBCCCFFGEBBHCIJJGGKBHIIILGGMNOOPLLLGMNOOPPQQRMSTUPPVRRMSTUUWXXYMSTUWWXXX 3= 3072x 33+ 23+ 10x 10+ 27+ 6x 432x 12+ 5= 27+ 3024x 63x 168x 27+ 4+ 192x 9+ 14+ 26+ 2= 15+ 720x 3=",
+    "AAABBCDEEFFBBBCDDEGGGHHCIIJKLLLHCCIJKMMNOOOJJKKNNOPPQRKSTNPPQQRSSTTUVVWWXXTTTVYYY 16+ 23+ 8640x 35x 28x 27x 12+ 17+ 15+ 26+ 19+ 16+ 20x 630x 9+ 420x 21+ 24x 432x 36288x 1= 9+ 15x 7+ 16+",
+    "ABBBCCDDDEBBFCCDDDEEGFHCIIJEEGGGKJJJLLMNNKOJJLLPPNNOQQRRPNNSTUURRVSSSWXXRYYYYWWXX 2= 21+ 1260x 37+ 1440x 15+ 20+ 6= 9+ 1120x 9x 2520x 2= 3360x 6x 54x 18x 24+ 18+ 7= 14+ 6= 108x 17+ 432x",
+    "AABBBBCCCDBBEFFCGGDHHHIJKGGLMMHNJKKOLMHHNJPKKMMQQQPPPKMRQQSSSPTRRRQUUTTTVRRWXXXYT 12x 39+ 21+ 11+ 1= 15x 25+ 10080x 2= 216x 540x 6+ 31+ 63x 4= 240x 33+ 29+ 19+ 27+ 10+ 6= 2= 20x 8=",
+    "ABBCCDDEEAABBCDDEFAAAGHHEEIJJGGGHKLIJMMGKKKIINNOOPPQRISTTUPPQRVSTTWWXRRVSTTYWXXVV 30+ 180x 30x 22+ 3360x 3= 12096x 15+ 1080x 15+ 17+ 8= 9+ 8+ 8+ 25+ 6+ 18+ 240x 1728x 3= 18+ 17+ 18+ 4=",
+    "ABBBCCDDEAFFFFDDGGAHFFIIJJGAHKKIILLGMMKKIILNGOOKPPPLNNQORRSSLNNTTRRRUUNVTTTWRXUUU 72x 24+ 20x 162x 1= 10080x 22+ 14+ 35+ 12+ 15+ 32+ 14x 6048x 42x 72x 5= 22680x 3x 26+ 840x 6= 3= 6=",
+    "AAABBCCDEABBBBCFDDGHHIIIFDDGGJJIIIKKGGGJLLKKMNNNNOOPMMQRNSSPPMTQRRRUUUVTQRWXXXUVT 12+ 21600x 12x 4032x 9= 30x 17010x 10+ 1764x 16+ 23+ 30x 42x 32+ 11+ 162x 8+ 24+ 6+ 10+ 1512x 10x 5= 18+",
+    "ABBCCCDDDAAAECDDFFGAAEHHHIIJJKELHHIIJJKKMMMIINOPPQQQRRNSSSSQTURNNNVSTTTWXXNVVYTTW 2160x 20x 28+ 22+ 11+ 11+ 8= 2016x 8640x 315x 15+ 2= 15+ 648x 7= 8+ 225x 14+ 10080x 23+ 6= 16+ 35x 11+ 4=",
+    "ABCDEFFFFBBDDGHFIJBBKDGGLIJMKKDGNLOJKKPPPQQJJKRRRRQQQJSTRUVQWWWSTUUVXXXWYYUUVVVWW 1= 20+ 2= 30+ 6= 33+ 26+ 3= 28x 29+ 29+ 3+ 9= 4= 6= 24x 35280x 480x 12+ 11+ 31+ 810x 5376x 9+ 6x",
+};
+enum { HARD_N = sizeof(HARD) / sizeof(HARD[0]) };
+
+static unsigned int test_n = 1;
+static unsigned int fail_n = 0;
+static unsigned short ok (unsigned short condition, char *description, ...) {
+    va_list args;
+    char description_buffer[1000];
+
+    va_start(args, description);
+    vsnprintf(description_buffer, 1000, description, args);
+    va_end(args);
+
+    printf("%sok %d - %s\n", condition ? "" : "not ", test_n, description_buffer);
+    ++test_n;
+
+    fail_n += (! condition);
+
+    return condition;
+}
+
+typedef struct {
+    kenken_puzzle puzzle;
+    char          cages[CELLS_MAX + 1];
+    cage_clue     clues[PUZZLE_CAGES_MAX];
+} parsed_puzzle;
+
+static const kenken_puzzle *_parse(const char *text, parsed_puzzle *parsed) {
+    if (! parse_puzzle(text, &parsed->puzzle, parsed->cages, parsed->clues)) {
+        fprintf(stderr, "can't parse %s\n", text);
+        exit(1);
+    }
+    return &parsed->puzzle;
+}
+
+static void check_small(void) {
+    parsed_puzzle parsed;
+    unsigned char solution[CELLS_MAX];
+
+    const kenken_puzzle *puzzle = _parse("AABCDDCCD 2- 2= 7+ 5+", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == 1, "3x3 puzzle solved");
+    ok(memcmp(solution, "\1\3\2\2\1\3\3\2\1", 9) == 0, "  with its one solution");
+    ok(count_solutions(puzzle, 10, NULL) == 1, "  which is the only one");
+
+    // every 4x4 Latin square sums to 40
+    puzzle = _parse("AAAAAAAAAAAAAAAA 40+", &parsed);
+    ok(count_solutions(puzzle, 1000, NULL) == 576, "4x4 puzzle of one cage has all 576 Latin squares");
+    ok(count_solutions(puzzle, 100, NULL) == 100, "  counting stops at the limit");
+
+    puzzle = _parse("AABCDDCCD 2- 3= 7+ 5+", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == 0, "3x3 puzzle with no solution");
+    ok(count_solutions(puzzle, 10, NULL) == 0, "  counts none");
+
+    puzzle = _parse("AAAABBBBC 6+ 6+ 3=", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == 0, "3x3 puzzle with a cage too small for its target has none");
+
+    puzzle = _parse("AAABBBCCC 2- 6+ 6+", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == -1, "subtract cage of three cells is malformed");
+    puzzle = _parse("AABCDDCCE 2- 2= 7+ 5+", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == -1, "cage with no clue is malformed");
+    puzzle = _parse("AABCDDCCD 2- 2= 7+ 5+ 9x", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == -1, "clue with no cage is malformed");
+    puzzle = _parse("AABCDDCCD 2- 2- 7+ 5+", &parsed);
+    ok(solve_puzzle(puzzle, solution, NULL) == -1, "subtract cage of one cell is malformed");
+}
+
+static void check_hard(void) {
+    work_pool *pool = create_work_pool(4);
+    for (int i = 0; i < HARD_N; ++i) {
+        parsed_puzzle parsed;
+        const kenken_puzzle *puzzle = _parse(HARD[i], &parsed);
+        unsigned char solution[CELLS_MAX];
+        solver_stats stats;
+
+        int solved = solve_puzzle(puzzle, solution, &stats);
+        ok((solved == 1) && check_solution(puzzle, solution), "hard puzzle %d solved", i);
+        ok(stats.nodes <= GUESSES_MAX, "  in %ld guesses", stats.nodes);
+        ok(count_solutions(puzzle, 2, NULL) == 1, "  which is the only solution");
+        ok(solve_puzzle_within(puzzle, GUESSES_MAX, solution, NULL) == 1, "  solved within %d guesses", GUESSES_MAX);
+        // (a limit of 0 is none)
+        ok((stats.nodes < 2) || (solve_puzzle_within(puzzle, stats.nodes - 1, solution, NULL) == -2),
+            "  given up a guess short");
+
+        memset(solution, 0, sizeof(solution));
+        solved = solve_puzzle_parallel(puzzle, solution, NULL, pool);
+        ok((solved == 1) && check_solution(puzzle, solution), "  solved on %d workers", work_pool_workers(pool));
+    }
+    release_work_pool(&pool);
+}
+
+int main (int argc, char** argv) {
+    check_small();
+    check_hard();
+
+    printf("1..%d\n", test_n - 1);
+    return fail_n ? 1 : 0;
+}
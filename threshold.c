@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "threshold.h"
+
+// fixed-point BGR -> gray weights, as used by cvCvtColor.
+enum { GRAY_SHIFT = 14 };
+enum { GRAY_B = 1868, GRAY_G = 9617, GRAY_R = 4899 };
+
+static int _clamp(int v, int lo, int hi) {
+    return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+static void _gray_row(const unsigned char *in, int channels, int width, unsigned char *gray) {
+    if (channels == 1) {
+        memcpy(gray, in, width);
+        return;
+    }
+    for (int x = 0; x < width; ++x, in += channels) {
+        gray[x] = (unsigned char)((in[0] * GRAY_B + in[1] * GRAY_G + in[2] * GRAY_R + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+    }
+}
+
+// a rolling strip of gray rows: row r lives at r % rows, and rows are converted on demand. total
+// sums the gray of the rows in [total_from, total_to) as they are loaded.
+typedef struct {
+    const unsigned char *in;
+    int                  in_step;
+    int                  channels;
+    int                  width;
+    int                  rows;
+    int                  loaded;
+    int                  total_from;
+    int                  total_to;
+    long                 total;
+    unsigned char       *pixels;
+} gray_strip;
+
+static const unsigned char *_strip_row(gray_strip *strip, int r) {
+    while (strip->loaded <= r) {
+        unsigned char *gray = strip->pixels + (size_t)(strip->loaded % strip->rows) * strip->width;
+        _gray_row(strip->in + (size_t)strip->loaded * strip->in_step, strip->channels, strip->width, gray);
+        if ((strip->loaded >= strip->total_from) && (strip->loaded < strip->total_to)) {
+            for (int x = 0; x < strip->width; ++x) {
+                strip->total += gray[x];
+            }
+        }
+        ++strip->loaded;
+    }
+    return strip->pixels + (size_t)(r % strip->rows) * strip->width;
+}
+
+int threshold_offsets(const unsigned char *in, int in_step, int channels, int width, int height,
+    int block_size, signed char *out, int out_step) {
+    if ((width <= 0) || (height <= 0)) {
+        return 0;
+    }
+    long total = threshold_offsets_rows(in, in_step, channels, width, height, block_size, 0, height, out, out_step);
+    return (int)(total / ((long)width * height));
+}
+
+long threshold_offsets_rows(const unsigned char *in, int in_step, int channels, int width, int height,
+    int block_size, int y0, int y1, signed char *out, int out_step) {
+    if ((width <= 0) || (y1 <= y0)) {
+        return 0;
+    }
+
+    const int radius = block_size / 2;
+    const long area  = (long)block_size * block_size;
+
+    // the strip needs rows y - radius - 1 .. y + radius; column_sums[x] is the sum of column x over
+    // rows y - radius .. y + radius (clamped into the image).
+    gray_strip strip = { in, in_step, channels, width, block_size + 1, _clamp(y0 - radius, 0, height - 1), y0, y1, 0, NULL };
+    strip.pixels      = malloc((size_t)strip.rows * width);
+    long *column_sums = calloc(width, sizeof(long));
+    long *row_sums    = malloc((width + 2 * radius + 1) * sizeof(long));
+    if ((strip.pixels == NULL) || (column_sums == NULL) || (row_sums == NULL)) {
+        free(strip.pixels);
+        free(column_sums);
+        free(row_sums);
+        return 0;
+    }
+
+    for (int k = y0 - radius; k <= y0 + radius; ++k) {
+        const unsigned char *gray = _strip_row(&strip, _clamp(k, 0, height - 1));
+        for (int x = 0; x < width; ++x) {
+            column_sums[x] += gray[x];
+        }
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        if (y > y0) {
+            // slide the window down a row.
+            const unsigned char *add = _strip_row(&strip, _clamp(y + radius, 0, height - 1));
+            const unsigned char *sub = _strip_row(&strip, _clamp(y - radius - 1, 0, height - 1));
+            for (int x = 0; x < width; ++x) {
+                column_sums[x] += add[x] - sub[x];
+            }
+        }
+
+        // prefix sums over the row of column sums (with replicated borders), so that each box sum
+        // is a single subtraction.
+        long running = 0;
+        row_sums[0] = 0;
+        for (int i = 0; i < width + 2 * radius; ++i) {
+            running += column_sums[_clamp(i - radius, 0, width - 1)];
+            row_sums[i + 1] = running;
+        }
+
+        const unsigned char *gray = _strip_row(&strip, y);
+        signed char *offsets = out + (size_t)y * out_step;
+        for (int x = 0; x < width; ++x) {
+            long box = row_sums[x + 2 * radius + 1] - row_sums[x];
+            // rounded to nearest; the area is odd, so there are no ties to break.
+            int mean = (int)((2 * box + area) / (2 * area));
+            offsets[x] = (signed char)_clamp(gray[x] - mean, -128, 127);
+        }
+    }
+
+    free(strip.pixels);
+    free(column_sums);
+    free(row_sums);
+
+    return strip.total;
+}
+
+void threshold_apply(unsigned char *pixels, int step, int width, int height, int constant_reduction) {
+    for (int y = 0; y < height; ++y) {
+        unsigned char *row = pixels + (size_t)y * step;
+        for (int x = 0; x < width; ++x) {
+            row[x] = ((signed char)row[x] <= -constant_reduction) ? 255 : 0;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef _THRESHOLD_H
+#define _THRESHOLD_H
+
+// Fused grayscale conversion and mean adaptive thresholding, equivalent to cvCvtColor(CV_BGR2GRAY)
+// followed by cvAdaptiveThreshold(CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV) with a
+// block_size x block_size box and replicated borders.
+//
+// The constant subtracted from the local mean usually depends on the mean intensity of the whole
+// image, which isn't known until every pixel has been seen, so this is split in two:
+//
+// threshold_offsets makes the single pass over the input. Rows are converted to gray as they
+// enter a rolling strip of block_size + 1 rows, which stays in cache while the box sums slide
+// over it. For each pixel, (gray - local mean) is written to out as a signed byte (clamped to
+// -128..127). Returns the mean intensity of the whole image. in may have 1 (gray), 3 (BGR) or
+// 4 (BGRA) channels.
+int threshold_offsets(const unsigned char *in, int in_step, int channels, int width, int height,
+    int block_size, signed char *out, int out_step);
+
+// The same for just rows [y0, y1) of the output (in and out still point at row 0), reading
+// whichever input rows their boxes cover, so that bands of rows can be done in parallel. Returns
+// the total gray of rows [y0, y1): the band totals, summed and divided by width * height, give
+// the mean intensity.
+long threshold_offsets_rows(const unsigned char *in, int in_step, int channels, int width, int height,
+    int block_size, int y0, int y1, signed char *out, int out_step);
+
+// threshold_apply then finishes the job in place on the (much smaller) output: pixels at least
+// constant_reduction darker than their local mean become 255, everything else 0.
+// constant_reduction must be in the range -127..128.
+void threshold_apply(unsigned char *pixels, int step, int width, int height, int constant_reduction);
+
+#endif /* _THRESHOLD_H */